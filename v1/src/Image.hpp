@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "Util.hpp"
+#include "PixelFormat.hpp"
+#include "TGAImage.hpp"
+
+namespace SRender {
+
+// Image with a pixel format fixed at compile time, so that pixels are accessed as FORMAT::Pixel without
+// branching on the pixel size. TGAImage remains the runtime-format container for reading and writing files;
+// ToTGAImage() and FromTGAImage() convert between the two.
+template<class FORMAT>
+class Image {
+public:
+	using Format = FORMAT;
+	using Pixel = typename FORMAT::Pixel;
+
+private:
+	std::vector<Pixel> pixels;
+	u32 width;
+	u32 height;
+
+public:
+	Image()
+		: width{0}, height{0} {}
+
+	// Pixels start out zeroed
+	Image(u32 w, u32 h)
+		: pixels(static_cast<usize>(w) * h), width{w}, height{h} {}
+
+	Image(u32 w, u32 h, Pixel fill)
+		: pixels(static_cast<usize>(w) * h, fill), width{w}, height{h} {}
+
+	Image(const Image&) = default;
+	Image& operator=(const Image&) = default;
+	Image(Image&&) = default;
+	Image& operator=(Image&&) = default;
+
+	// Out of bounds reads return a zeroed pixel and writes are dropped, like TGAImage
+	auto Get(u32 x, u32 y) const -> Pixel {
+		if (x >= width || y >= height) {
+			return Pixel{};
+		}
+		return pixels[x + static_cast<usize>(y) * width];
+	}
+
+	auto Set(u32 x, u32 y, Pixel p) -> bool {
+		if (x >= width || y >= height) {
+			return false;
+		}
+		pixels[x + static_cast<usize>(y) * width] = p;
+		return true;
+	}
+
+	auto Fill(Pixel p) -> void {
+		std::fill(pixels.begin(), pixels.end(), p);
+	}
+
+	// Explicit conversion to another format, see PixelCast()
+	template<class TO>
+	auto ConvertTo() const -> Image<TO> {
+		auto result = Image<TO>{width, height};
+		auto* out = result.Pixels();
+		for (usize i = 0; i < pixels.size(); ++i) {
+			out[i] = PixelCast<TO, FORMAT>(pixels[i]);
+		}
+		return result;
+	}
+
+	// Copies into a TGAImage of FORMAT::TGAFormat, converting first if this format has no TGA layout. Float
+	// formats are clamped to [0, 1].
+	auto ToTGAImage() const -> TGAImage {
+		if constexpr (FORMAT::TGA_BYTESPP == 0) {
+			return ConvertTo<typename FORMAT::TGAFormat>().ToTGAImage();
+		} else {
+			auto result = TGAImage{width, height, FORMAT::TGA_BYTESPP};
+			if (!pixels.empty()) {
+				memcpy(result.Buffer(), pixels.data(), pixels.size() * sizeof(Pixel));
+			}
+			return result;
+		}
+	}
+
+	// Converts from whichever format the TGAImage holds. An empty or invalid TGAImage gives an empty image.
+	static auto FromTGAImage(const TGAImage& tga) -> Image {
+		switch (tga.GetBytesPP()) {
+			case TGAImage::GRAYSCALE: return FromTGALayout<R8>(tga);
+			case TGAImage::RGB: return FromTGALayout<RGB8>(tga);
+			case TGAImage::RGBA: return FromTGALayout<RGBA8>(tga);
+			default: return Image{};
+		}
+	}
+
+	auto GetWidth() const -> u32 { return width; }
+	auto GetHeight() const -> u32 { return height; }
+	auto Pixels() -> Pixel* { return pixels.data(); }
+	auto Pixels() const -> const Pixel* { return pixels.data(); }
+	auto Row(u32 y) -> Pixel* { return pixels.data() + static_cast<usize>(y) * width; }
+	auto Row(u32 y) const -> const Pixel* { return pixels.data() + static_cast<usize>(y) * width; }
+
+private:
+	template<class SRC>
+	static auto FromTGALayout(const TGAImage& tga) -> Image {
+		auto img = Image<SRC>{tga.GetWidth(), tga.GetHeight()};
+		usize nbytes = static_cast<usize>(tga.GetWidth()) * tga.GetHeight() * sizeof(typename SRC::Pixel);
+		if (nbytes > 0 && tga.Buffer()) {
+			memcpy(img.Pixels(), tga.Buffer(), nbytes);
+		}
+		if constexpr (std::is_same_v<SRC, FORMAT>) {
+			return img;
+		} else {
+			return img.template ConvertTo<FORMAT>();
+		}
+	}
+};
+
+} // namespace SRender
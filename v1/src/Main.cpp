@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 #include <span>
@@ -11,14 +14,38 @@
 
 using namespace SRender;
 
-auto Render(u32 width, u32 height, std::span<Eigen::Vector3f> vertices, std::span<usize> indices) -> FrameBuffer {
+// Triangles a worker takes at a time. Small enough that a few large on-screen triangles can't keep one worker
+// busy long after the others ran out of work, large enough that the shared counter isn't contended.
+static constexpr usize BATCH_TRIANGLES = 256;
+
+struct WorkerStats {
+	usize batches = 0;
+	usize triangles = 0;
+	f64 milliseconds = 0.0;
+};
+
+// Renders batches of triangles into a layer of its own until nextBatch runs past the end of indices
+auto RenderWorker(
+	u32 width, u32 height,
+	std::span<Eigen::Vector3f> vertices, std::span<usize> indices,
+	std::atomic<usize>& nextBatch, WorkerStats& stats
+) -> FrameBuffer {
+	auto startTime = std::chrono::steady_clock::now();
+
 	auto fr = FrameBuffer{width, height};
-	fr.RenderTriangles(
-		vertices, indices,
-		[](const Eigen::Vector2f& pos) {
-			return TGAColor{255, 255, 255, 255}; // TODO
-		}
-	);
+	auto frag = [](const Eigen::Vector2f& pos) {
+		return FrameBuffer::Pixel{255, 255, 255}; // TODO
+	};
+	usize triangleCount = indices.size() / 3;
+	for (usize batch; (batch = nextBatch.fetch_add(1, std::memory_order_relaxed)) * BATCH_TRIANGLES < triangleCount;) {
+		usize first = batch * BATCH_TRIANGLES;
+		usize count = std::min(BATCH_TRIANGLES, triangleCount - first);
+		fr.RenderTriangles(vertices, indices.subspan(first * 3, count * 3), frag);
+		stats.batches += 1;
+		stats.triangles += count;
+	}
+
+	stats.milliseconds = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - startTime).count();
 	return fr;
 }
 
@@ -47,32 +74,29 @@ auto main(i32 argc, char** argv) -> i32 {
 		return -1;
 	}
 
-	auto resWidth = program.get<u32>("--resolution-height");
+	auto resWidth = program.get<u32>("--resolution-width");
 	auto resHeight = program.get<u32>("--resolution-height");
 	auto outputPath = program.get<std::string>("--output-file");
 	auto modelPath = program.get<std::string>("model");
-	auto workersCount = program.get<u32>("--workers");
+	auto workersCount = std::max(1u, program.get<u32>("--workers"));
 
 	auto model = Mesh::ReadOBJAt(modelPath);
-	auto splittedTrCount = (model.Indices().size() / 3) / workersCount;
-	auto splittedExtras = model.Indices().size() - splittedTrCount * workersCount;
 
+	// Workers pull batches from the shared counter instead of getting a fixed range each, so the ones that drew
+	// cheap triangles keep going while another is stuck on expensive ones
+	std::atomic<usize> nextBatch = 0;
+	std::vector<WorkerStats> workerStats(workersCount);
 	std::vector<std::future<FrameBuffer>> workerOutputs(workersCount);
 	for (usize i = 0; i < workersCount; ++i) {
-		auto count = i == workersCount - 1
-			? splittedTrCount + splittedExtras
-			: splittedTrCount;
-		auto start = model.Indices().begin() + splittedTrCount * i;
-		auto end = start + count;
-
 		workerOutputs[i] = std::async(
 			// Async option
 			std::launch::async,
 			// Function
-			&Render,
+			&RenderWorker,
 			// Parameters
 			resWidth, resHeight,
-			model.Vertices(), std::span<usize>{start, end}
+			std::span<Eigen::Vector3f>{model.Vertices()}, std::span<usize>{model.Indices()},
+			std::ref(nextBatch), std::ref(workerStats[i])
 		);
 	}
 
@@ -82,10 +106,26 @@ auto main(i32 argc, char** argv) -> i32 {
 		workerResults.push_back(workerOutputs[i].get());
 	}
 
-	FrameBuffer::Merge(workerResults)
-		.and_then([&](auto& buf) {
-			buf.image.WriteTGAFile(outputPath);
-		});
+	// Per-worker timing, so that imbalance shows up as one worker taking much longer than the rest
+	f64 slowest = 0.0;
+	f64 total = 0.0;
+	for (usize i = 0; i < workersCount; ++i) {
+		auto& stats = workerStats[i];
+		std::cout << "Worker " << i << ": " << stats.batches << " batches, " << stats.triangles << " triangles, "
+			<< stats.milliseconds << " ms\n";
+		slowest = std::max(slowest, stats.milliseconds);
+		total += stats.milliseconds;
+	}
+	if (total > 0.0) {
+		std::cout << "Slowest worker took " << slowest / (total / workersCount) << "x the average\n";
+	}
+
+	auto merged = FrameBuffer::Merge(workerResults);
+	if (!merged) {
+		std::cerr << merged.error() << "\n";
+		return -1;
+	}
+	merged->image.ToTGAImage().WriteTGAFile(outputPath);
 
 	return 0;
 }
@@ -0,0 +1,59 @@
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MappedFile.hpp"
+
+using namespace SRender;
+
+auto MappedFile::Open(std::string_view path) -> tl::expected<MappedFile, std::string> {
+	// string_view is not guaranteed to be null terminated
+	auto pathStr = std::string{path};
+	i32 fd = open(pathStr.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return tl::unexpected("can't open file " + pathStr);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return tl::unexpected("can't stat file " + pathStr);
+	}
+	auto size = static_cast<usize>(st.st_size);
+	// mmap() rejects empty mappings, an empty view works just as well
+	if (size == 0) {
+		close(fd);
+		return MappedFile{};
+	}
+
+	void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping holds its own reference to the file
+	close(fd);
+	if (addr == MAP_FAILED) {
+		return tl::unexpected("can't map file " + pathStr);
+	}
+	madvise(addr, size, MADV_SEQUENTIAL);
+	return MappedFile{static_cast<const char*>(addr), size};
+}
+
+MappedFile::~MappedFile() {
+	if (data) {
+		munmap(const_cast<char*>(data), size);
+	}
+}
+
+MappedFile::MappedFile(MappedFile&& that)
+	: data{std::exchange(that.data, nullptr)}
+	, size{std::exchange(that.size, 0)} {}
+
+auto MappedFile::operator=(MappedFile&& that) -> MappedFile& {
+	if (this != &that) {
+		if (data) {
+			munmap(const_cast<char*>(data), size);
+		}
+		data = std::exchange(that.data, nullptr);
+		size = std::exchange(that.size, 0);
+	}
+	return *this;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <tl/expected.hpp>
+#include "Util.hpp"
+
+namespace SRender {
+
+// Read-only memory mapping of an entire file
+class MappedFile {
+private:
+	const char* data;
+	usize size;
+
+	MappedFile(const char* data, usize size)
+		: data{data}, size{size} {}
+
+public:
+	static auto Open(std::string_view path) -> tl::expected<MappedFile, std::string>;
+
+	MappedFile()
+		: data{nullptr}, size{0} {}
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& that);
+	MappedFile& operator=(MappedFile&& that);
+
+	auto Data() const -> const char* { return data; }
+	auto Size() const -> usize { return size; }
+	auto View() const -> std::string_view { return {data, size}; }
+};
+
+} // namespace SRender
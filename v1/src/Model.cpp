@@ -1,6 +1,10 @@
 #include <array>
-#include <tuple>
+#include <charconv>
+#include <iostream>
+#include <iterator>
+#include <string>
 #include <unordered_map>
+#include "MappedFile.hpp"
 #include "Model.hpp"
 
 using namespace SRender;
@@ -16,90 +20,193 @@ struct std::hash<Vertex> {
 	}
 };
 
+// Marks an absent vt/vn in a face corner
+static constexpr u32 NO_INDEX = 0xFFFFFFFF;
+
+// Hand-written tokenizer over the file content, no per-line allocation
+class OBJScanner {
+private:
+	const char* cur;
+	const char* end;
+
+public:
+	usize line = 1;
+	bool failed = false;
+
+	OBJScanner(std::string_view content)
+		: cur{content.data()}, end{content.data() + content.size()} {}
+
+	auto AtEnd() const -> bool { return cur == end; }
+	auto AtEndOfLine() const -> bool { return cur == end || *cur == '\n' || *cur == '#'; }
+
+	auto SkipSpaces() -> void {
+		while (cur != end && (*cur == ' ' || *cur == '\t' || *cur == '\r')) ++cur;
+	}
+
+	auto NextLine() -> void {
+		while (cur != end && *cur != '\n') ++cur;
+		if (cur != end) {
+			++cur;
+			++line;
+		}
+	}
+
+	// Consumes `keyword` if it is the next whole token on the line
+	auto Keyword(std::string_view keyword) -> bool {
+		usize len = keyword.size();
+		if (static_cast<usize>(end - cur) < len || std::string_view{cur, len} != keyword) {
+			return false;
+		}
+		const char* after = cur + len;
+		if (after != end && *after != ' ' && *after != '\t' && *after != '\r' && *after != '\n') {
+			return false;
+		}
+		cur = after;
+		return true;
+	}
+
+	auto Consume(char c) -> bool {
+		if (cur != end && *cur == c) {
+			++cur;
+			return true;
+		}
+		return false;
+	}
+
+	auto ParseFloat() -> f32 {
+		SkipSpaces();
+		// std::from_chars does not accept a leading plus sign
+		Consume('+');
+		f32 value = 0.0f;
+		auto [ptr, ec] = std::from_chars(cur, end, value);
+		if (ec != std::errc{}) failed = true;
+		cur = ptr;
+		return value;
+	}
+
+	auto ParseSignedIndex() -> i64 {
+		Consume('+');
+		i64 value = 0;
+		auto [ptr, ec] = std::from_chars(cur, end, value);
+		if (ec != std::errc{}) failed = true;
+		cur = ptr;
+		return value;
+	}
+
+	// Converts a 1-based or negative (relative to the `count` elements so far) index to 0-based
+	auto ResolveIndex(i64 value, usize count) -> u32 {
+		if (value > 0) return static_cast<u32>(value - 1);
+		if (value < 0 && static_cast<usize>(-value) <= count) return static_cast<u32>(count + value);
+		failed = true;
+		return 0;
+	}
+
+	auto ParseIndex(usize count) -> u32 {
+		return ResolveIndex(ParseSignedIndex(), count);
+	}
+
+	// ParseIndex() for vt/vn references. Some exporters write 0, or reference vt/vn without writing any
+	// records (e.g. `f 1/0/0`); either way the corner has no such attribute
+	auto ParseAttributeIndex(usize count) -> u32 {
+		auto value = ParseSignedIndex();
+		if (value == 0 || count == 0) return NO_INDEX;
+		return ResolveIndex(value, count);
+	}
+};
+
 auto Mesh::ReadOBJ(std::istream& data) -> Mesh {
+	auto content = std::string(std::istreambuf_iterator<char>(data), {});
+	return ReadOBJ(std::string_view{content});
+}
+
+auto Mesh::ReadOBJ(std::string_view fileContent) -> Mesh {
 	using Vec3fVec = std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f>>;
 	using Vec2fVec = std::vector<Eigen::Vector2f, Eigen::aligned_allocator<Eigen::Vector2f>>;
 
 	auto mesh = Mesh{};
 
-	char ctrash;
 	Vec3fVec posBuf;
 	Vec3fVec normalBuf;
 	Vec2fVec uvBuf;
 	std::unordered_map<Vertex, u32> knownVerts;
-	u32 nextID = 0;
 
-	std::string line;
-	while (std::getline(data, line)) {
-		std::istringstream iss{line};
+	// Face corners as (v, vt, vn), reused across faces
+	std::vector<std::array<u32, 3>> corners;
 
-		std::string start;
-		iss >> start;
-		if (start == "#") {
-			continue;
-		} else if (start == "v") {
+	auto fail = [](usize line) {
+		std::cerr << "malformed obj data at line " << line << "\n";
+		return Mesh{};
+	};
+
+	OBJScanner sc{fileContent};
+	while (!sc.AtEnd()) {
+		sc.SkipSpaces();
+		if (sc.Keyword("v")) {
 			Eigen::Vector3f pos;
-			for (usize i = 0; i < 3; ++i) iss >> pos[i];
-			posBuf.push_back(std::move(pos));
-		} else if (start == "vt") {
-			Eigen::Vector3f normal;
-			for (usize i = 0; i < 3; ++i) iss >> normal[i];
-			normalBuf.push_back(std::move(normal));
-		} else if (start == "vn") {
+			for (usize i = 0; i < 3; ++i) pos[i] = sc.ParseFloat();
+			posBuf.push_back(pos);
+		} else if (sc.Keyword("vt")) {
 			Eigen::Vector2f uv;
-			for (usize i = 0; i < 2; ++i) iss >> uv[i];
-			uvBuf.push_back(std::move(uv));
-		} else if (start == "f") {
-			auto tri = std::array<u32, 3>{};
-			// We only support triangular faces (with 3 vertices)
-			// Format: f pos/uv/normal pos/uv/normal pos/uv/normal
-			for (u32 iv, it, in, i = 0; i < 3; ++i) {
-				/* A vertex must have at least the position */ iss >> iv;
-				iss >> ctrash;
-				if (!uvBuf.empty()) iss >> it;
-				iss >> ctrash;
-				if (!normalBuf.empty()) iss >> in;
-
-				// .obj file index starts at 1
-				--iv;
-				--it;
-				--in;
-				auto candidate = Vertex{
-					posBuf[iv],
-					normalBuf.empty() ? Eigen::Vector3f{} : normalBuf[in],
-					uvBuf.empty() ? Eigen::Vector2f{} : uvBuf[it]
-				};
-
-				auto iter = knownVerts.find(candidate);
-				if (iter != knownVerts.end()) {
-					// The vertex already exists, reuse the known version
-					tri[i] = iter->second;
-				} else {
-					// The vertex does not exist, create it
-					knownVerts.insert({std::move(candidate), nextID});
-					tri[i] = nextID;
-					++nextID;
+			for (usize i = 0; i < 2; ++i) uv[i] = sc.ParseFloat();
+			uvBuf.push_back(uv);
+		} else if (sc.Keyword("vn")) {
+			Eigen::Vector3f normal;
+			for (usize i = 0; i < 3; ++i) normal[i] = sc.ParseFloat();
+			normalBuf.push_back(normal);
+		} else if (sc.Keyword("f")) {
+			// Format: f v v/vt v//vn v/vt/vn ...
+			corners.clear();
+			while (true) {
+				sc.SkipSpaces();
+				if (sc.AtEndOfLine() || sc.failed) break;
+
+				auto corner = std::array<u32, 3>{sc.ParseIndex(posBuf.size()), NO_INDEX, NO_INDEX};
+				if (sc.Consume('/')) {
+					if (sc.Consume('/')) {
+						corner[2] = sc.ParseAttributeIndex(normalBuf.size());
+					} else {
+						corner[1] = sc.ParseAttributeIndex(uvBuf.size());
+						if (sc.Consume('/')) corner[2] = sc.ParseAttributeIndex(normalBuf.size());
+					}
+				}
+				if (corner[0] >= posBuf.size()
+					|| (corner[1] != NO_INDEX && corner[1] >= uvBuf.size())
+					|| (corner[2] != NO_INDEX && corner[2] >= normalBuf.size())) {
+					sc.failed = true;
 				}
+				corners.push_back(corner);
 			}
-			mesh.indices.insert(mesh.indices.end(), tri.begin(), tri.end());
-		} else if (start == "g") {
-		}
-	}
+			if (sc.failed) return fail(sc.line);
 
-	mesh.vertices.reserve(knownVerts.size());
-	for (const auto& [vert, idx]: knownVerts) {
-		mesh.vertices.push_back(vert);
+			// Polygons are split into a triangle fan around the first corner
+			for (usize i = 1; i + 1 < corners.size(); ++i) {
+				for (auto& [iv, it, in] : {corners[0], corners[i], corners[i + 1]}) {
+					auto candidate = Vertex{
+						posBuf[iv],
+						in == NO_INDEX ? Eigen::Vector3f{0.0f, 0.0f, 0.0f} : normalBuf[in],
+						it == NO_INDEX ? Eigen::Vector2f{0.0f, 0.0f} : uvBuf[it]
+					};
+					auto [iter, inserted] = knownVerts.try_emplace(candidate, static_cast<u32>(mesh.vertices.size()));
+					if (inserted) {
+						// The vertex does not exist, create it
+						mesh.vertices.push_back(candidate.pos);
+					}
+					mesh.indices.push_back(iter->second);
+				}
+			}
+		}
+		if (sc.failed) return fail(sc.line);
+		sc.NextLine();
 	}
-}
 
-auto Mesh::ReadOBJ(std::string_view fileContent) -> Mesh {
-	std::istringstream iss(fileContent.data());
-	return ReadOBJ(iss);
+	return mesh;
 }
 
 auto Mesh::ReadOBJAt(std::string_view path) -> Mesh {
-	std::ifstream ifs;
-	ifs.open(path);
-	if (!ifs) return;
-	return ReadOBJ(ifs);
+	auto file = MappedFile::Open(path);
+	if (!file) {
+		std::cerr << file.error() << "\n";
+		return Mesh{};
+	}
+	return ReadOBJ(file->View());
 }
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <bit>
+#include <type_traits>
+#include <Eigen/Dense>
+#include "Util.hpp"
+
+#ifdef __F16C__
+#	include <immintrin.h>
+#endif
+
+namespace SRender {
+
+// Common representation that every format decodes to and encodes from: linear R, G, B, A, where [0, 1] is the
+// range of the normalized integer formats and the float formats may go beyond it
+using Color = Eigen::Vector4f;
+
+// IEEE 754 binary16 <-> binary32, rounding to nearest even
+inline auto F32ToF16(f32 value) -> u16 {
+#ifdef __F16C__
+	return static_cast<u16>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+	u32 bits = std::bit_cast<u32>(value);
+	u32 sign = (bits >> 16) & 0x8000;
+	u32 absBits = bits & 0x7FFFFFFF;
+	if (absBits >= 0x7F800000) {
+		// Infinity, or NaN made quiet, keeping the top of its payload
+		return static_cast<u16>(sign | 0x7C00 | (absBits > 0x7F800000 ? 0x200 | ((absBits >> 13) & 0x3FF) : 0));
+	}
+	if (absBits >= 0x477FF000) {
+		// Rounds past the largest half, 65504
+		return static_cast<u16>(sign | 0x7C00);
+	}
+	if (absBits < 0x38800000) {
+		// Below the smallest normal half, 2^-14
+		if (absBits < 0x33000000) {
+			return static_cast<u16>(sign);
+		}
+		u32 shift = 126 - (absBits >> 23);
+		u32 mantissa = (absBits & 0x7FFFFF) | 0x800000;
+		u32 result = mantissa >> shift;
+		u32 rest = mantissa & ((1u << shift) - 1);
+		u32 halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (result & 1))) {
+			++result;
+		}
+		return static_cast<u16>(sign | result);
+	}
+	// Rebias the exponent from 127 to 15; a carry out of the mantissa correctly bumps the exponent
+	u32 result = (absBits - 0x38000000) >> 13;
+	u32 rest = absBits & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (result & 1))) {
+		++result;
+	}
+	return static_cast<u16>(sign | result);
+#endif // __F16C__
+}
+
+inline auto F16ToF32(u16 half) -> f32 {
+#ifdef __F16C__
+	return _cvtsh_ss(half);
+#else
+	u32 sign = static_cast<u32>(half & 0x8000) << 16;
+	u32 exponent = (half >> 10) & 0x1F;
+	u32 mantissa = half & 0x3FF;
+	if (exponent == 0x1F) {
+		return std::bit_cast<f32>(sign | 0x7F800000 | (mantissa << 13));
+	}
+	if (exponent == 0) {
+		// Zero or subnormal, mantissa * 2^-24
+		f32 magnitude = static_cast<f32>(mantissa) * 0x1p-24f;
+		return sign ? -magnitude : magnitude;
+	}
+	return std::bit_cast<f32>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+#endif // __F16C__
+}
+
+// Clamps to [0, 1], mapping NaN to 0
+inline auto Saturate(f32 v) -> f32 {
+	return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+}
+
+inline auto EncodeUnorm8(f32 v) -> u8 {
+	return static_cast<u8>(Saturate(v) * 255.0f + 0.5f);
+}
+
+inline auto DecodeUnorm8(u8 v) -> f32 {
+	return static_cast<f32>(v) * (1.0f / 255.0f);
+}
+
+// Rec. 601 luma, the same weights TGAImage::ConvertTo() uses
+inline auto Luma8(u8 r, u8 g, u8 b) -> u8 {
+	return static_cast<u8>((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+inline auto Luma(const Color& c) -> f32 {
+	return 0.299f * c.x() + 0.587f * c.y() + 0.114f * c.z();
+}
+
+// Pixel formats, used as template arguments of Image and BasicFrameBuffer. Each one has
+// - Pixel: the stored type, which is exactly as large as the pixel's bytes
+// - TGA_BYTESPP: the TGAImage::Format whose bytes Pixel matches, or 0 if it has no TGA layout
+// - TGAFormat: the format with a TGA layout that this one is written to TGA files as
+// - Decode() and Encode(): conversions from and to Color
+//
+// The 8-bit formats store channels in TGA (B, G, R, A) order so that they copy to and from TGAImage as-is.
+
+// One 8-bit channel, treated as grayscale like TGA does
+struct R8 {
+	struct Pixel {
+		u8 r;
+
+		Pixel() = default;
+		constexpr Pixel(u8 r)
+			: r{r} {}
+	};
+
+	static constexpr i32 TGA_BYTESPP = 1;
+	using TGAFormat = R8;
+
+	static auto Decode(Pixel p) -> Color {
+		f32 v = DecodeUnorm8(p.r);
+		return {v, v, v, 1.0f};
+	}
+
+	static auto Encode(const Color& c) -> Pixel {
+		return {EncodeUnorm8(Luma(c))};
+	}
+};
+
+struct RGB8 {
+	struct Pixel {
+		u8 b;
+		u8 g;
+		u8 r;
+
+		Pixel() = default;
+		constexpr Pixel(u8 r, u8 g, u8 b)
+			: b{b}, g{g}, r{r} {}
+	};
+
+	static constexpr i32 TGA_BYTESPP = 3;
+	using TGAFormat = RGB8;
+
+	static auto Decode(Pixel p) -> Color {
+		return {DecodeUnorm8(p.r), DecodeUnorm8(p.g), DecodeUnorm8(p.b), 1.0f};
+	}
+
+	static auto Encode(const Color& c) -> Pixel {
+		return {EncodeUnorm8(c.x()), EncodeUnorm8(c.y()), EncodeUnorm8(c.z())};
+	}
+};
+
+struct RGBA8 {
+	struct Pixel {
+		u8 b;
+		u8 g;
+		u8 r;
+		u8 a;
+
+		Pixel() = default;
+		constexpr Pixel(u8 r, u8 g, u8 b, u8 a = 255)
+			: b{b}, g{g}, r{r}, a{a} {}
+	};
+
+	static constexpr i32 TGA_BYTESPP = 4;
+	using TGAFormat = RGBA8;
+
+	static auto Decode(Pixel p) -> Color {
+		return {DecodeUnorm8(p.r), DecodeUnorm8(p.g), DecodeUnorm8(p.b), DecodeUnorm8(p.a)};
+	}
+
+	static auto Encode(const Color& c) -> Pixel {
+		return {EncodeUnorm8(c.x()), EncodeUnorm8(c.y()), EncodeUnorm8(c.z()), EncodeUnorm8(c.w())};
+	}
+};
+
+// 5 bits of red in the top bits, 6 of green and 5 of blue in the bottom bits
+struct RGB565 {
+	struct Pixel {
+		u16 bits;
+
+		Pixel() = default;
+		constexpr Pixel(u16 bits)
+			: bits{bits} {}
+	};
+
+	static constexpr i32 TGA_BYTESPP = 0;
+	using TGAFormat = RGB8;
+
+	static auto Decode(Pixel p) -> Color {
+		return {
+			static_cast<f32>(p.bits >> 11) * (1.0f / 31.0f),
+			static_cast<f32>((p.bits >> 5) & 0x3F) * (1.0f / 63.0f),
+			static_cast<f32>(p.bits & 0x1F) * (1.0f / 31.0f),
+			1.0f,
+		};
+	}
+
+	static auto Encode(const Color& c) -> Pixel {
+		auto r = static_cast<u16>(Saturate(c.x()) * 31.0f + 0.5f);
+		auto g = static_cast<u16>(Saturate(c.y()) * 63.0f + 0.5f);
+		auto b = static_cast<u16>(Saturate(c.z()) * 31.0f + 0.5f);
+		return {static_cast<u16>(r << 11 | g << 5 | b)};
+	}
+};
+
+// Half floats, for HDR targets at half the size of RGBA32F
+struct RGBA16F {
+	struct Pixel {
+		// Bits of binary16 values, see F32ToF16()
+		u16 r;
+		u16 g;
+		u16 b;
+		u16 a;
+
+		Pixel() = default;
+		Pixel(f32 r, f32 g, f32 b, f32 a = 1.0f)
+			: r{F32ToF16(r)}, g{F32ToF16(g)}, b{F32ToF16(b)}, a{F32ToF16(a)} {}
+	};
+
+	static constexpr i32 TGA_BYTESPP = 0;
+	using TGAFormat = RGBA8;
+
+	static auto Decode(Pixel p) -> Color {
+		return {F16ToF32(p.r), F16ToF32(p.g), F16ToF32(p.b), F16ToF32(p.a)};
+	}
+
+	static auto Encode(const Color& c) -> Pixel {
+		return {c.x(), c.y(), c.z(), c.w()};
+	}
+};
+
+struct RGBA32F {
+	struct Pixel {
+		f32 r;
+		f32 g;
+		f32 b;
+		f32 a;
+
+		Pixel() = default;
+		constexpr Pixel(f32 r, f32 g, f32 b, f32 a = 1.0f)
+			: r{r}, g{g}, b{b}, a{a} {}
+	};
+
+	static constexpr i32 TGA_BYTESPP = 0;
+	using TGAFormat = RGBA8;
+
+	static auto Decode(Pixel p) -> Color {
+		return {p.r, p.g, p.b, p.a};
+	}
+
+	static auto Encode(const Color& c) -> Pixel {
+		return {c.x(), c.y(), c.z(), c.w()};
+	}
+};
+
+static_assert(sizeof(R8::Pixel) == 1 && sizeof(RGB8::Pixel) == 3 && sizeof(RGBA8::Pixel) == 4);
+static_assert(sizeof(RGB565::Pixel) == 2 && sizeof(RGBA16F::Pixel) == 8 && sizeof(RGBA32F::Pixel) == 16);
+
+// Converts a pixel between formats. Conversions into the normalized formats clamp, and conversions into R8 take
+// the luma; the 8-bit formats convert between each other directly instead of through Color.
+template<class TO, class FROM>
+inline auto PixelCast(typename FROM::Pixel p) -> typename TO::Pixel {
+	if constexpr (std::is_same_v<TO, FROM>) {
+		return p;
+	} else if constexpr (std::is_same_v<TO, R8> && (std::is_same_v<FROM, RGB8> || std::is_same_v<FROM, RGBA8>)) {
+		return {Luma8(p.r, p.g, p.b)};
+	} else if constexpr (std::is_same_v<FROM, R8> && (std::is_same_v<TO, RGB8> || std::is_same_v<TO, RGBA8>)) {
+		return {p.r, p.r, p.r};
+	} else if constexpr (
+		(std::is_same_v<FROM, RGB8> && std::is_same_v<TO, RGBA8>)
+		|| (std::is_same_v<FROM, RGBA8> && std::is_same_v<TO, RGB8>)
+	) {
+		// Drops alpha, or adds an opaque one
+		return {p.r, p.g, p.b};
+	} else {
+		return TO::Encode(FROM::Decode(p));
+	}
+}
+
+} // namespace SRender
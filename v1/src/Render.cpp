@@ -1,9 +1,197 @@
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <thread>
 #include "Render.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#	include <emmintrin.h>
+#	define SRENDER_SSE2
+#endif
+
 using namespace SRender;
 
-auto FrameBuffer::Merge(std::vector<FrameBuffer> layers) -> tl::expected<FrameBuffer, std::string> {
+// Cohen-Sutherland region codes
+enum OutCode : i32 {
+	OUT_INSIDE = 0,
+	OUT_LEFT = 1 << 0,
+	OUT_RIGHT = 1 << 1,
+	OUT_TOP = 1 << 2,
+	OUT_BOTTOM = 1 << 3,
+};
+
+static auto ComputeOutCode(const Eigen::Vector3f& p, const Eigen::Vector2f& max) -> i32 {
+	i32 code = OUT_INSIDE;
+	if (p.x() < 0.0f) {
+		code |= OUT_LEFT;
+	} else if (p.x() > max.x()) {
+		code |= OUT_RIGHT;
+	}
+	if (p.y() < 0.0f) {
+		code |= OUT_TOP;
+	} else if (p.y() > max.y()) {
+		code |= OUT_BOTTOM;
+	}
+	return code;
+}
+
+// Clips the segment a-b to [0, max.x] x [0, max.y], interpolating z along with it.
+// Returns false if the segment is entirely outside.
+static auto ClipLine(Eigen::Vector3f& a, Eigen::Vector3f& b, const Eigen::Vector2f& max) -> bool {
+	if (!std::isfinite(a.x() + a.y() + b.x() + b.y())) {
+		return false;
+	}
+
+	i32 codeA = ComputeOutCode(a, max);
+	i32 codeB = ComputeOutCode(b, max);
+	while (true) {
+		if (!(codeA | codeB)) {
+			return true;
+		}
+		if (codeA & codeB) {
+			return false;
+		}
+
+		i32 code = codeA ? codeA : codeB;
+		Eigen::Vector3f d = b - a;
+		Eigen::Vector3f p;
+		// Snap the clipped coordinate onto the edge so rounding can't push it back out
+		if (code & OUT_LEFT) {
+			p = a + d * ((0.0f - a.x()) / d.x());
+			p.x() = 0.0f;
+		} else if (code & OUT_RIGHT) {
+			p = a + d * ((max.x() - a.x()) / d.x());
+			p.x() = max.x();
+		} else if (code & OUT_TOP) {
+			p = a + d * ((0.0f - a.y()) / d.y());
+			p.y() = 0.0f;
+		} else {
+			p = a + d * ((max.y() - a.y()) / d.y());
+			p.y() = max.y();
+		}
+
+		if (code == codeA) {
+			a = p;
+			codeA = ComputeOutCode(a, max);
+		} else {
+			b = p;
+			codeB = ComputeOutCode(b, max);
+		}
+	}
+}
+
+static constexpr i32 DEPTH_FRAC_BITS = 32;
+static constexpr f64 DEPTH_FIXED_MAX = 1u << 30;
+
+static auto DepthToFixed(f32 z) -> i64 {
+	f64 clamped = std::clamp<f64>(z, -DEPTH_FIXED_MAX, DEPTH_FIXED_MAX);
+	return static_cast<i64>(clamped * static_cast<f64>(i64{1} << DEPTH_FRAC_BITS));
+}
+
+static auto DepthFromFixed(i64 z) -> f32 {
+	return static_cast<f32>(static_cast<f64>(z) / static_cast<f64>(i64{1} << DEPTH_FRAC_BITS));
+}
+
+#ifdef SRENDER_SSE2
+// Expands the depth test results of 16 pixels, one 32-bit lane per pixel in masks, into byte masks over their
+// 16 * BYTES bytes of color
+template<usize BYTES>
+static auto ExpandMerge16Masks(const __m128 masks[4], i32 bits, __m128i out[BYTES]) -> void {
+	__m128i m[4];
+	for (i32 k = 0; k < 4; ++k) {
+		m[k] = _mm_castps_si128(masks[k]);
+	}
+	if constexpr (BYTES == 1) {
+		// Saturating packs keep all-ones and all-zeros lanes as they are
+		out[0] = _mm_packs_epi16(_mm_packs_epi32(m[0], m[1]), _mm_packs_epi32(m[2], m[3]));
+	} else if constexpr (BYTES == 2) {
+		out[0] = _mm_packs_epi32(m[0], m[1]);
+		out[1] = _mm_packs_epi32(m[2], m[3]);
+	} else if constexpr (BYTES == 4) {
+		for (i32 k = 0; k < 4; ++k) {
+			out[k] = m[k];
+		}
+	} else if constexpr (BYTES == 8) {
+		for (i32 k = 0; k < 4; ++k) {
+			out[k * 2 + 0] = _mm_unpacklo_epi32(m[k], m[k]);
+			out[k * 2 + 1] = _mm_unpackhi_epi32(m[k], m[k]);
+		}
+	} else if constexpr (BYTES == 16) {
+		for (i32 k = 0; k < 4; ++k) {
+			out[k * 4 + 0] = _mm_shuffle_epi32(m[k], _MM_SHUFFLE(0, 0, 0, 0));
+			out[k * 4 + 1] = _mm_shuffle_epi32(m[k], _MM_SHUFFLE(1, 1, 1, 1));
+			out[k * 4 + 2] = _mm_shuffle_epi32(m[k], _MM_SHUFFLE(2, 2, 2, 2));
+			out[k * 4 + 3] = _mm_shuffle_epi32(m[k], _MM_SHUFFLE(3, 3, 3, 3));
+		}
+	} else {
+		// 3 bytes per pixel needs a byte shuffle, which SSE2 lacks, so spread the bits through memory instead
+		alignas(16) u8 bytes[16 * BYTES];
+		for (i32 p = 0; p < 16; ++p) {
+			memset(bytes + p * BYTES, (bits >> p) & 1 ? 0xFF : 0x00, BYTES);
+		}
+		for (usize k = 0; k < BYTES; ++k) {
+			out[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(bytes + k * 16));
+		}
+	}
+}
+#endif // SRENDER_SSE2
+
+// Takes each of the count layer pixels that is closer (has a greater depth) than the merged pixel so far
+template<class PIXEL>
+static auto MergeSpan(PIXEL* colors, f32* depths, const PIXEL* layerColors, const f32* layerDepths, usize count) -> void {
+	usize i = 0;
+#ifdef SRENDER_SSE2
+	constexpr usize BYTES = sizeof(PIXEL);
+	for (; i + 16 <= count; i += 16) {
+		__m128 merged[4];
+		__m128 layer[4];
+		__m128 masks[4];
+		i32 bits = 0;
+		for (i32 k = 0; k < 4; ++k) {
+			merged[k] = _mm_loadu_ps(depths + i + k * 4);
+			layer[k] = _mm_loadu_ps(layerDepths + i + k * 4);
+			masks[k] = _mm_cmplt_ps(merged[k], layer[k]);
+			bits |= _mm_movemask_ps(masks[k]) << (k * 4);
+		}
+
+		// Layers tend to cover or miss whole runs of pixels
+		if (bits == 0) {
+			continue;
+		}
+		if (bits == 0xFFFF) {
+			memcpy(colors + i, layerColors + i, 16 * BYTES);
+			memcpy(depths + i, layerDepths + i, 16 * sizeof(f32));
+			continue;
+		}
+
+		// SSE2 has no blend instruction, select with and/andnot/or instead
+		for (i32 k = 0; k < 4; ++k) {
+			__m128 z = _mm_or_ps(_mm_and_ps(masks[k], layer[k]), _mm_andnot_ps(masks[k], merged[k]));
+			_mm_storeu_ps(depths + i + k * 4, z);
+		}
+		__m128i colorMasks[BYTES];
+		ExpandMerge16Masks<BYTES>(masks, bits, colorMasks);
+		auto* dst = reinterpret_cast<u8*>(colors + i);
+		auto* src = reinterpret_cast<const u8*>(layerColors + i);
+		for (usize k = 0; k < BYTES; ++k) {
+			__m128i oldColor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + k * 16));
+			__m128i newColor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + k * 16));
+			__m128i color = _mm_or_si128(_mm_and_si128(colorMasks[k], newColor), _mm_andnot_si128(colorMasks[k], oldColor));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k * 16), color);
+		}
+	}
+#endif // SRENDER_SSE2
+	for (; i < count; ++i) {
+		if (depths[i] < layerDepths[i]) {
+			colors[i] = layerColors[i];
+			depths[i] = layerDepths[i];
+		}
+	}
+}
+
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::Merge(std::span<const BasicFrameBuffer> layers, u32 threadCount) -> tl::expected<BasicFrameBuffer, std::string> {
 #ifdef SRENDER_BOUNDS_SAFETY_CHECK
 	if (layers.size() == 0) {
 		return tl::unexpected("Must provide 1 or more layers to merge");
@@ -20,54 +208,79 @@ auto FrameBuffer::Merge(std::vector<FrameBuffer> layers) -> tl::expected<FrameBu
 	}
 #endif // SRENDER_BOUNDS_SAFETY_CHECK
 
-	auto result = FrameBuffer{width, height};
-	for (auto& layer : layers) {
-		for (u32 y = 0; y < layer.image.GetHeight(); ++y) {
-			for (u32 x = 0; x < layer.image.GetWidth(); ++x) {
-				auto depth = layer.GetDepth(x, y);
-				if (result.GetDepth(x, y) < depth) {
-					result.Set(x, y, layer.Get(x, y));
-					result.SetDepth(x, y, depth);
-				}
+	auto result = BasicFrameBuffer{width, height};
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threadCount = std::max(1u, std::min(threadCount, height));
+	u32 rowsPerThread = (height + threadCount - 1) / threadCount;
+
+	// Every layer is merged into one block of the result at a time, so that the block stays in cache
+	auto mergeRows = [&](u32 y0, u32 y1) {
+		const usize BLOCK_PIXELS = 4096;
+		usize end = static_cast<usize>(y1) * width;
+		for (usize begin = static_cast<usize>(y0) * width; begin < end; begin += BLOCK_PIXELS) {
+			usize count = std::min(BLOCK_PIXELS, end - begin);
+			for (auto& layer : layers) {
+				MergeSpan(
+					result.image.Pixels() + begin, result.depthBuffer.data() + begin,
+					layer.image.Pixels() + begin, layer.depthBuffer.data() + begin,
+					count
+				);
 			}
 		}
+	};
+
+	std::vector<std::future<void>> workers;
+	for (u32 y = rowsPerThread; y < height; y += rowsPerThread) {
+		workers.push_back(std::async(std::launch::async, mergeRows, y, std::min(height, y + rowsPerThread)));
+	}
+	mergeRows(0, std::min(height, rowsPerThread));
+	for (auto& worker : workers) {
+		worker.get();
 	}
 	return result;
 }
 
-FrameBuffer::FrameBuffer(u32 width, u32 height)
-	: image{TGAImage{width, height, TGAImage::RGB}}
+template<class FORMAT>
+BasicFrameBuffer<FORMAT>::BasicFrameBuffer(u32 width, u32 height)
+	: image{width, height}
 	, depthBuffer(width * height) {}
 
-auto FrameBuffer::Get(u32 x, u32 y) const -> TGAColor {
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::Get(u32 x, u32 y) const -> Pixel {
 	return image.Get(x, y);
 }
 
-auto FrameBuffer::Set(u32 x, u32 y, TGAColor color) -> bool {
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::Set(u32 x, u32 y, Pixel color) -> bool {
 	return image.Set(x, y, color);
 }
 
-auto FrameBuffer::GetDepth(u32 x, u32 y) const -> f32 {
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::GetDepth(u32 x, u32 y) const -> f32 {
 	return depthBuffer[x + y * image.GetWidth()];
 }
 
-auto FrameBuffer::SetDepth(u32 x, u32 y, f32 z) -> void {
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::SetDepth(u32 x, u32 y, f32 z) -> void {
 	depthBuffer[x + y * image.GetWidth()] = z;
 }
 
-auto FrameBuffer::RenderTriangle(
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::RenderTriangle(
 	const Eigen::Vector3f& v1,
 	const Eigen::Vector3f& v2,
 	const Eigen::Vector3f& v3,
-	const std::function<auto(const Eigen::Vector2f&) -> TGAColor>& frag
+	const std::function<auto(const Eigen::Vector2f&) -> Pixel>& frag
 ) -> void {
 	Eigen::Vector2i bbv1 {
 		std::max(0.0f, std::min({v1.x(), v2.x(), v3.x()})),
 		std::max(0.0f, std::min({v1.y(), v2.y(), v3.y()}))
 	};
 	Eigen::Vector2i bbv2 {
-		std::min(static_cast<f32>(GetWidth()), std::max({v1.x(), v2.x(), v3.x()})),
-		std::min(static_cast<f32>(GetHeight()), std::max({v1.y(), v2.y(), v3.y()}))
+		std::min(static_cast<f32>(GetWidth()) - 1.0f, std::max({v1.x(), v2.x(), v3.x()})),
+		std::min(static_cast<f32>(GetHeight()) - 1.0f, std::max({v1.y(), v2.y(), v3.y()}))
 	};
 
 	for(i32 y = bbv1.y(); y <= bbv2.y(); ++y) {
@@ -87,17 +300,21 @@ auto FrameBuffer::RenderTriangle(
 					v1.z() * bc.x() +
 					v2.z() * bc.y() +
 					v3.z() * bc.z();
-				this->Set(x, y, frag({bcX, bcY}));
-				this->SetDepth(x, y, bcZ);
+				// Same test as Merge(), so that the result doesn't depend on which layer drew which triangle
+				if (this->GetDepth(x, y) < bcZ) {
+					this->Set(x, y, frag({bcX, bcY}));
+					this->SetDepth(x, y, bcZ);
+				}
 			}
 		}
 	}
 }
 
-auto FrameBuffer::RenderTriangles(
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::RenderTriangles(
 	std::span<Eigen::Vector3f> vertices,
 	std::span<usize> indices,
-	const std::function<auto(const Eigen::Vector2f&) -> TGAColor>& frag
+	const std::function<auto(const Eigen::Vector2f&) -> Pixel>& frag
 ) -> void {
 #ifdef SRENDER_BOUNDS_SAFETY_CHECK
 	if (indices.size() % 3 != 0) {
@@ -108,63 +325,90 @@ auto FrameBuffer::RenderTriangles(
 
 	for (usize i = 0; i < indices.size(); i += 3) {
 		this->RenderTriangle(
-			vertices[i],
-			vertices[i + 1],
-			vertices[i + 2],
+			vertices[indices[i]],
+			vertices[indices[i + 1]],
+			vertices[indices[i + 2]],
 			frag
 		);
 	}
 }
 
-auto FrameBuffer::RenderLine(
+template<class FORMAT>
+auto BasicFrameBuffer<FORMAT>::RenderLine(
 	const Eigen::Vector3f& aIn,
 	const Eigen::Vector3f& bIn,
-	TGAColor color
+	Pixel color
 ) -> void {
-	// Copy the vectors for swapping
+	i32 width = GetWidth();
+	i32 height = GetHeight();
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	// Copy the vectors for clipping
 	auto a = aIn;
 	auto b = bIn;
-
-	bool steep = false;
-	if (std::abs(a.x() - b.x()) < std::abs(a.y() - b.y())) {
-		std::swap(a.x(), a.y());
-		std::swap(b.x(), b.y());
-		steep = true;
-	}
-	if(a.x() > b.x()) {
-		std::swap(a, b);
+	if (!ClipLine(a, b, {static_cast<f32>(width - 1), static_cast<f32>(height - 1)})) {
+		return;
 	}
 
-	for(u32 x = a.x(); x <= b.x(); ++x) {
-		f32 t = (x - a.x()) / static_cast<f32>(b.x() - a.x());
-		u32 y = a.y() * (1.0f - t) + b.y() * t;
-		f32 z = a.z() * (1.0f - t) + b.z() * t;
-		if(steep) {
-			this->Set(y, x, color);
-			this->SetDepth(y, x, z);
-		} else {
-			this->Set(x, y, color);
-			this->SetDepth(x, y, z);
+	// Clipped endpoints are non-negative, so truncation is the same as flooring
+	i32 x0 = std::min(static_cast<i32>(a.x()), width - 1);
+	i32 y0 = std::min(static_cast<i32>(a.y()), height - 1);
+	i32 x1 = std::min(static_cast<i32>(b.x()), width - 1);
+	i32 y1 = std::min(static_cast<i32>(b.y()), height - 1);
+
+	i32 dx = std::abs(x1 - x0);
+	i32 dy = std::abs(y1 - y0);
+	i32 stepX = x0 < x1 ? 1 : -1;
+	i32 stepY = y0 < y1 ? width : -width;
+
+	bool steep = dx < dy;
+	i32 majorLen = steep ? dy : dx;
+	i32 minorLen = steep ? dx : dy;
+	i32 majorStep = steep ? stepY : stepX;
+	i32 minorStep = steep ? stepX : stepY;
+
+	// Depth is stepped in 32.32 fixed point
+	i64 z = DepthToFixed(a.z());
+	i64 zStep = majorLen > 0 ? (DepthToFixed(b.z()) - z) / majorLen : 0;
+
+	Pixel* pixels = image.Pixels();
+	i32 idx = x0 + y0 * width;
+	i32 err = 2 * minorLen - majorLen;
+	for (i32 i = 0; i <= majorLen; ++i) {
+		pixels[idx] = color;
+		depthBuffer[idx] = DepthFromFixed(z);
+
+		if (err > 0) {
+			idx += minorStep;
+			err -= 2 * majorLen;
 		}
+		err += 2 * minorLen;
+		idx += majorStep;
+		z += zStep;
 	}
 }
 
-RenderBuffer::RenderBuffer(u32 width, u32 height)
-	: FrameBuffer(width, height) {}
+template<class FORMAT>
+BasicRenderBuffer<FORMAT>::BasicRenderBuffer(u32 width, u32 height)
+	: BasicFrameBuffer<FORMAT>(width, height) {}
 
-auto RenderBuffer::Set(u32 x, u32 y, f32 z, TGAColor color) -> void {
+template<class FORMAT>
+auto BasicRenderBuffer<FORMAT>::Set(u32 x, u32 y, f32 z, Pixel color) -> void {
+	auto& depthBuffer = this->depthBuffer;
 	if (depthTest) {
-		auto i = x + y * image.GetWidth();
+		auto i = x + y * this->image.GetWidth();
 		if (depthBuffer[i] < z) {
-			FrameBuffer::Set(x, y, color);
+			BasicFrameBuffer<FORMAT>::Set(x, y, color);
 			if (depthMask) {
 				depthBuffer[i] = z;
 			}
 		}
 	} else {
-		FrameBuffer::Set(x, y, color);
+		BasicFrameBuffer<FORMAT>::Set(x, y, color);
 		if (depthMask) {
-			depthBuffer[x + y * image.GetWidth()] = z;
+			depthBuffer[x + y * this->image.GetWidth()] = z;
 		}
 	}
 }
@@ -202,3 +446,16 @@ auto SRender::Barycentric(
 ) -> Eigen::Vector3f {
 	return AnyBarycentric<f32, 2>(pt, v1, v2, v3);
 }
+
+template class SRender::BasicFrameBuffer<R8>;
+template class SRender::BasicFrameBuffer<RGB8>;
+template class SRender::BasicFrameBuffer<RGBA8>;
+template class SRender::BasicFrameBuffer<RGB565>;
+template class SRender::BasicFrameBuffer<RGBA16F>;
+template class SRender::BasicFrameBuffer<RGBA32F>;
+template class SRender::BasicRenderBuffer<R8>;
+template class SRender::BasicRenderBuffer<RGB8>;
+template class SRender::BasicRenderBuffer<RGBA8>;
+template class SRender::BasicRenderBuffer<RGB565>;
+template class SRender::BasicRenderBuffer<RGBA16F>;
+template class SRender::BasicRenderBuffer<RGBA32F>;
@@ -6,26 +6,35 @@
 #include <Eigen/Dense>
 #include <tl/expected.hpp>
 #include "Util.hpp"
-#include "TGAImage.hpp"
+#include "PixelFormat.hpp"
+#include "Image.hpp"
 
 namespace SRender {
 
-class FrameBuffer {
+// Color and depth targets, with the color format fixed at compile time. Instantiated in Render.cpp for every
+// format in PixelFormat.hpp; the float formats make HDR targets.
+template<class FORMAT>
+class BasicFrameBuffer {
 public:
-	TGAImage image;
+	using Pixel = typename FORMAT::Pixel;
+
+	Image<FORMAT> image;
 	std::vector<f32> depthBuffer;
 
 public:
-	static auto Merge(std::vector<FrameBuffer> layers) -> tl::expected<FrameBuffer, std::string>;
+	// Keeps the closest (greatest depth) pixel of all layers, the first layer's on ties. The result starts out
+	// cleared at depth 0, so pixels at or behind it are never taken. Rows are split across threadCount threads
+	// (0 for one per core).
+	static auto Merge(std::span<const BasicFrameBuffer> layers, u32 threadCount = 0) -> tl::expected<BasicFrameBuffer, std::string>;
 
-	FrameBuffer(u32 width, u32 height);
-	FrameBuffer(const FrameBuffer&) = default;
-	FrameBuffer& operator=(const FrameBuffer&) = default;
-	FrameBuffer(FrameBuffer&&) = default;
-	FrameBuffer& operator=(FrameBuffer&&) = default;
+	BasicFrameBuffer(u32 width, u32 height);
+	BasicFrameBuffer(const BasicFrameBuffer&) = default;
+	BasicFrameBuffer& operator=(const BasicFrameBuffer&) = default;
+	BasicFrameBuffer(BasicFrameBuffer&&) = default;
+	BasicFrameBuffer& operator=(BasicFrameBuffer&&) = default;
 
-	auto Get(u32 x, u32 y) const -> TGAColor;
-	auto Set(u32 x, u32 y, TGAColor color) -> bool;
+	auto Get(u32 x, u32 y) const -> Pixel;
+	auto Set(u32 x, u32 y, Pixel color) -> bool;
 	auto GetDepth(u32 x, u32 y) const -> f32;
 	auto SetDepth(u32 x, u32 y, f32 z) -> void;
 	
@@ -33,40 +42,47 @@ public:
 		const Eigen::Vector3f& p1,
 		const Eigen::Vector3f& p2,
 		const Eigen::Vector3f& p3,
-		const std::function<auto(const Eigen::Vector2f&) -> TGAColor>& frag
+		const std::function<auto(const Eigen::Vector2f&) -> Pixel>& frag
 	) -> void;
 
 	auto RenderTriangles(
 		std::span<Eigen::Vector3f> vertices,
 		std::span<usize> indices,
-		const std::function<auto(const Eigen::Vector2f&) -> TGAColor>& frag
+		const std::function<auto(const Eigen::Vector2f&) -> Pixel>& frag
 	) -> void;
 
 	auto RenderLine(
 		const Eigen::Vector3f& a,
 		const Eigen::Vector3f& b,
-		TGAColor color
+		Pixel color
 	) -> void;
 
 	auto GetWidth() const -> u32 { return image.GetWidth(); }
 	auto GetHeight() const -> u32 { return image.GetHeight(); }
 };
 
-class RenderBuffer : public FrameBuffer {
+template<class FORMAT>
+class BasicRenderBuffer : public BasicFrameBuffer<FORMAT> {
 public:
+	using Pixel = typename FORMAT::Pixel;
+
 	bool depthTest;
 	bool depthMask;
 
 public:
-	RenderBuffer(u32 width, u32 height);
-	RenderBuffer(const RenderBuffer&) = default;
-	RenderBuffer& operator=(const RenderBuffer&) = default;
-	RenderBuffer(RenderBuffer&&) = default;
-	RenderBuffer& operator=(RenderBuffer&&) = default;
+	BasicRenderBuffer(u32 width, u32 height);
+	BasicRenderBuffer(const BasicRenderBuffer&) = default;
+	BasicRenderBuffer& operator=(const BasicRenderBuffer&) = default;
+	BasicRenderBuffer(BasicRenderBuffer&&) = default;
+	BasicRenderBuffer& operator=(BasicRenderBuffer&&) = default;
 
-	auto Set(u32 x, u32 y, f32 z, TGAColor color) -> void;
+	auto Set(u32 x, u32 y, f32 z, Pixel color) -> void;
 };
 
+// 8-bit RGB, what the renderer writes out as TGA
+using FrameBuffer = BasicFrameBuffer<RGB8>;
+using RenderBuffer = BasicRenderBuffer<RGB8>;
+
 auto Barycentric(
 	const Eigen::Vector3f& pt,
 	const Eigen::Vector3f& v1,
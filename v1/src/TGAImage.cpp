@@ -1,8 +1,20 @@
 #include <iostream>
+#include <algorithm>
+#include <bit>
 #include <cmath>
 #include <cstring>
 #include <ctime>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
 #include "TGAImage.hpp"
+#include "MappedFile.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#	include <emmintrin.h>
+#	define SRENDER_SSE2
+#endif
 
 using namespace SRender;
 
@@ -64,128 +76,219 @@ auto TGAImage::operator=(TGAImage&& img) -> TGAImage& {
 	return *this;
 }
 
+// Sets count pixels starting at dst to the pixel at px
+template<i32 BYTESPP>
+static auto FillPixels(u8* dst, const u8* px, usize count) -> void {
+	if constexpr (BYTESPP == 1) {
+		memset(dst, *px, count);
+	} else {
+		usize i = 0;
+#ifdef SRENDER_SSE2
+		if constexpr (BYTESPP == 4) {
+			u32 val;
+			memcpy(&val, px, 4);
+			__m128i v = _mm_set1_epi32(static_cast<i32>(val));
+			for (; i + 4 <= count; i += 4) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), v);
+			}
+		}
+#endif // SRENDER_SSE2
+		if (i == 0 && count > 0) {
+			memcpy(dst, px, BYTESPP);
+			i = 1;
+		}
+		// Doubling copies from the already filled part
+		while (i < count) {
+			usize n = std::min(i, count - i);
+			memcpy(dst + i * BYTESPP, dst, n * BYTESPP);
+			i += n;
+		}
+	}
+}
+
+// Copies count pixels from src to dst in reverse order
+template<i32 BYTESPP>
+static auto CopyPixelsReversed(u8* dst, const u8* src, usize count) -> void {
+	for (usize i = 0; i < count; ++i) {
+		memcpy(dst + (count - 1 - i) * BYTESPP, src + i * BYTESPP, BYTESPP);
+	}
+}
+
+// Destination of a stream of decoded pixels, which places rows and pixels within rows as the image descriptor
+// says, so that the decoded image always has a top-left origin without a separate flip pass
+class PixelSink {
+private:
+	u8* data;
+	u32 width;
+	u32 height;
+	bool flipX;
+	bool flipY;
+	u32 row = 0;
+	u32 x = 0;
+
+public:
+	PixelSink(u8* data, u32 width, u32 height, bool flipX, bool flipY)
+		: data{data}, width{width}, height{height}, flipX{flipX}, flipY{flipY} {}
+
+	auto Remaining() const -> u64 {
+		return static_cast<u64>(height - row) * width - x;
+	}
+
+	// Calls fn(dst, offset, count, reversed) for each part of the next count pixels that lies within a row
+	template<i32 BYTESPP, class Fn>
+	auto Emit(usize count, Fn&& fn) -> void {
+		usize offset = 0;
+		while (count > 0) {
+			usize n = std::min<usize>(count, width - x);
+			u32 dstRow = flipY ? height - 1 - row : row;
+			u32 dstX = flipX ? width - x - n : x;
+			fn(data + (static_cast<usize>(dstRow) * width + dstX) * BYTESPP, offset, n, flipX);
+			offset += n;
+			count -= n;
+			x += n;
+			if (x == width) {
+				x = 0;
+				++row;
+			}
+		}
+	}
+};
+
+template<i32 BYTESPP>
+static auto DecodeRaw(const u8* in, PixelSink& sink) -> void {
+	sink.Emit<BYTESPP>(sink.Remaining(), [&](u8* dst, usize offset, usize n, bool reversed) {
+		if (reversed) {
+			CopyPixelsReversed<BYTESPP>(dst, in + offset * BYTESPP, n);
+		} else {
+			memcpy(dst, in + offset * BYTESPP, n * BYTESPP);
+		}
+	});
+}
+
+template<i32 BYTESPP>
+static auto DecodeRLE(const u8* in, const u8* end, PixelSink& sink) -> bool {
+	while (sink.Remaining() > 0) {
+		if (in == end) {
+			std::cerr << "an error occured while reading the data\n";
+			return false;
+		}
+		u8 chunkheader = *in++;
+		usize count = (chunkheader & 0x7F) + 1;
+		if (count > sink.Remaining()) {
+			std::cerr << "Too many pixels read\n";
+			return false;
+		}
+		if (chunkheader < 128) {
+			if (static_cast<usize>(end - in) < count * BYTESPP) {
+				std::cerr << "an error occured while reading the data\n";
+				return false;
+			}
+			const u8* src = in;
+			sink.Emit<BYTESPP>(count, [&](u8* dst, usize offset, usize n, bool reversed) {
+				if (reversed) {
+					CopyPixelsReversed<BYTESPP>(dst, src + offset * BYTESPP, n);
+				} else {
+					memcpy(dst, src + offset * BYTESPP, n * BYTESPP);
+				}
+			});
+			in += count * BYTESPP;
+		} else {
+			if (static_cast<usize>(end - in) < BYTESPP) {
+				std::cerr << "an error occured while reading the data\n";
+				return false;
+			}
+			const u8* px = in;
+			sink.Emit<BYTESPP>(count, [&](u8* dst, usize, usize n, bool) {
+				FillPixels<BYTESPP>(dst, px, n);
+			});
+			in += BYTESPP;
+		}
+	}
+	return true;
+}
+
 auto TGAImage::ReadTGAFile(std::string_view filename) -> bool {
 	if (data) {
 		delete[] data;
 	}
-
 	data = nullptr;
-	std::ifstream in;
-	in.open(filename.data(), std::ios::binary);
-	if (!in.is_open()) {
-		std::cerr << "can't open file " << filename << "\n";
-		in.close();
+
+	auto file = MappedFile::Open(filename);
+	if (!file) {
+		std::cerr << file.error() << "\n";
 		return false;
 	}
+	auto in = reinterpret_cast<const u8*>(file->Data());
+	auto end = in + file->Size();
+
 	TGAHeader header;
-	in.read(reinterpret_cast<char*>(&header), sizeof(header));
-	if (!in.good()) {
-		in.close();
+	if (file->Size() < sizeof(header)) {
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
+	memcpy(&header, in, sizeof(header));
+	// The image ID field, then an optional color map precede the pixels
+	in += sizeof(header) + header.idlength;
+	if (header.colormaptype) {
+		in += static_cast<usize>(header.colormaplength) * ((header.colormapdepth + 7) >> 3);
+	}
 	width = header.width;
 	height = header.height;
 	bytespp = header.bitsperpixel >> 3;
-	if (width <= 0 || height <= 0 ||
+	if (header.width <= 0 || header.height <= 0 ||
 		(bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
-		in.close();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
+	if (in > end) {
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
 
-	u64 nbytes = bytespp * width * height;
+	u64 nbytes = static_cast<u64>(bytespp) * width * height;
 	data = new u8[nbytes];
+	// Pixels are stored bottom-up unless bit 5 is set, and right-to-left if bit 4 is set
+	bool flipY = !(header.imagedescriptor & 0x20);
+	bool flipX = header.imagedescriptor & 0x10;
+	auto sink = PixelSink{data, width, height, flipX, flipY};
 	if (3 == header.datatypecode || 2 == header.datatypecode) {
-		in.read(reinterpret_cast<char*>(data), nbytes);
-		if (!in.good()) {
-			in.close();
+		if (static_cast<u64>(end - in) < nbytes) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
+		switch (bytespp) {
+			case GRAYSCALE: DecodeRaw<GRAYSCALE>(in, sink); break;
+			case RGB: DecodeRaw<RGB>(in, sink); break;
+			case RGBA: DecodeRaw<RGBA>(in, sink); break;
+		}
 	} else if (10 == header.datatypecode || 11 == header.datatypecode) {
-		if (!LoadRLEData(in)) {
-			in.close();
+		if (!LoadRLEData(in, end, flipX, flipY)) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
 	} else {
-		in.close();
 		std::cerr << "unknown file format " << static_cast<i32>(header.datatypecode) << "\n";
 		return false;
 	}
-	if (!(header.imagedescriptor & 0x20)) {
-		FlipVertically();
-	}
-	if (header.imagedescriptor & 0x10) {
-		FlipHorizontally();
-	}
 	std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
-	in.close();
 	return true;
 }
 
-auto TGAImage::LoadRLEData(std::ifstream& in) -> bool {
-	u64 pixelcount = width * height;
-	u64 currentpixel = 0;
-	u64 currentbyte = 0;
-	TGAColor colorbuffer;
-	do {
-		u8 chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
-		if (chunkheader < 128) {
-			chunkheader++;
-			for (i32 i = 0; i < chunkheader; i++) {
-				in.read(reinterpret_cast<char*>(colorbuffer.raw), bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (i32 t = 0; t < bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel > pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		} else {
-			chunkheader -= 127;
-			in.read(reinterpret_cast<char*>(colorbuffer.raw), bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
-				return false;
-			}
-			for (i32 i = 0; i < chunkheader; i++) {
-				for (i32 t = 0; t < bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel > pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		}
-	} while (currentpixel < pixelcount);
-	return true;
+auto TGAImage::LoadRLEData(const u8* in, const u8* end, bool flipX, bool flipY) -> bool {
+	auto sink = PixelSink{data, width, height, flipX, flipY};
+	switch (bytespp) {
+		case GRAYSCALE: return DecodeRLE<GRAYSCALE>(in, end, sink);
+		case RGB: return DecodeRLE<RGB>(in, end, sink);
+		case RGBA: return DecodeRLE<RGBA>(in, end, sink);
+	}
+	return false;
 }
 
 auto TGAImage::WriteTGAFile(std::string_view filename, bool rle) -> bool {
-	u8 developerAreaRef[4] = {0, 0, 0, 0};
-	u8 extensionAreaRef[4] = {0, 0, 0, 0};
-	u8 footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O',
+	const u8 developerAreaRef[4] = {0, 0, 0, 0};
+	const u8 extensionAreaRef[4] = {0, 0, 0, 0};
+	const u8 footer[18] = {'T', 'R', 'U', 'E', 'V', 'I', 'S', 'I', 'O',
 		'N', '-', 'X', 'F', 'I', 'L', 'E', '.', '\0'};
-	std::ofstream out;
-	out.open(filename.data(), std::ios::binary);
-	if (!out.is_open()) {
-		std::cerr << "can't open file " << filename << "\n";
-		out.close();
-		return false;
-	}
 	TGAHeader header;
 	memset(reinterpret_cast<void*>(&header), 0, sizeof(header));
 	header.bitsperpixel = bytespp << 3;
@@ -193,89 +296,159 @@ auto TGAImage::WriteTGAFile(std::string_view filename, bool rle) -> bool {
 	header.height = height;
 	header.datatypecode = bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2);
 	header.imagedescriptor = 0x20; // top-left origin
-	out.write(reinterpret_cast<char*>(&header), sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
-	}
-	if (!rle) {
-		out.write(reinterpret_cast<char*>(data), width * height * bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
-		}
+
+	// The whole file is assembled in memory and written with a single call
+	u64 rawBytes = static_cast<u64>(width) * height * bytespp;
+	u64 bodyCapacity = rle ? static_cast<u64>(height) * MaxRLERowBytes() : rawBytes;
+	u64 capacity = sizeof(header) + bodyCapacity + sizeof(developerAreaRef) + sizeof(extensionAreaRef) + sizeof(footer);
+	auto file = std::unique_ptr<u8[]>(new u8[capacity]);
+
+	u8* cur = file.get();
+	memcpy(cur, &header, sizeof(header));
+	cur += sizeof(header);
+	if (rle) {
+		cur += UnloadRLEData(cur);
 	} else {
-		if (!UnloadRLEData(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
-		}
-	}
-	out.write(reinterpret_cast<char*>(developerAreaRef), sizeof(developerAreaRef));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+		memcpy(cur, data, rawBytes);
+		cur += rawBytes;
 	}
-	out.write(reinterpret_cast<char*>(extensionAreaRef), sizeof(extensionAreaRef));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
+	memcpy(cur, developerAreaRef, sizeof(developerAreaRef));
+	cur += sizeof(developerAreaRef);
+	memcpy(cur, extensionAreaRef, sizeof(extensionAreaRef));
+	cur += sizeof(extensionAreaRef);
+	memcpy(cur, footer, sizeof(footer));
+	cur += sizeof(footer);
+
+	std::ofstream out;
+	out.open(filename.data(), std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
 		return false;
 	}
-	out.write(reinterpret_cast<char*>(footer), sizeof(footer));
+	out.write(reinterpret_cast<const char*>(file.get()), cur - file.get());
+	out.close();
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
 		return false;
 	}
-	out.close();
 	return true;
 }
 
-auto TGAImage::UnloadRLEData(std::ofstream &out) -> bool {
-	const u8 max_chunk_length = 128;
-	u64 npixels = width * height;
-	u64 curpix = 0;
-	while (curpix < npixels) {
-		u64 chunkstart = curpix * bytespp;
-		u64 curbyte = curpix * bytespp;
-		u8 run_length = 1;
-		auto raw = true;
-		while (curpix + run_length < npixels && run_length < max_chunk_length) {
-			auto succ_eq = true;
-			for (u32 t = 0; succ_eq && t < bytespp; t++) {
-				succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-			}
-			curbyte += bytespp;
-			if (1 == run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
+// Pixels of 1, 3 or 4 bytes, loaded as a single integer so that comparing them is one instruction
+template<i32 BYTESPP>
+static auto LoadPixel(const u8* p) -> u32 {
+	u32 val = 0;
+	memcpy(&val, p, BYTESPP);
+	return val;
+}
+
+// Returns the first i in [0, n) for which (pixel i == pixel i + 1) is EQUAL, or n if there is none. Pixels are only
+// read up to index `limit` (exclusive, the end of the row), an i whose successor lies beyond it never matches.
+template<i32 BYTESPP, bool EQUAL>
+static auto FindSuccessor(const u8* p, usize n, usize limit) -> usize {
+	usize i = 0;
+#ifdef SRENDER_SSE2
+	// Compare 16 bytes against the same 16 bytes one pixel later; a pixel matches when all of its bytes do
+	constexpr usize LANES = 16 / BYTESPP;
+	constexpr u32 PIXEL_BITS = BYTESPP == 4 ? 0x1111 : BYTESPP == 3 ? 0x1249 : 0xFFFF;
+	for (; i + LANES <= n && (i + 1) * BYTESPP + 16 <= limit * BYTESPP; i += LANES) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * BYTESPP));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + (i + 1) * BYTESPP));
+		u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if constexpr (BYTESPP == 4) {
+			mask &= mask >> 1;
+			mask &= mask >> 2;
+		} else if constexpr (BYTESPP == 3) {
+			mask &= (mask >> 1) & (mask >> 2);
 		}
-		curpix += run_length;
-		out.put(raw ? run_length - 1 : run_length + 127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+		mask &= PIXEL_BITS;
+		if constexpr (!EQUAL) {
+			mask ^= PIXEL_BITS;
 		}
-		out.write(reinterpret_cast<char*>(data + chunkstart),
-							(raw ? run_length * bytespp : bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+		if (mask != 0) {
+			return i + std::countr_zero(mask) / BYTESPP;
 		}
 	}
-	return true;
+#endif // SRENDER_SSE2
+	for (; i < n; ++i) {
+		if (i + 1 >= limit) {
+			return n;
+		}
+		bool equal = LoadPixel<BYTESPP>(p + i * BYTESPP) == LoadPixel<BYTESPP>(p + (i + 1) * BYTESPP);
+		if (equal == EQUAL) {
+			return i;
+		}
+	}
+	return n;
+}
+
+// Encodes one row of pixels; packets never cross rows, as recommended by the TGA 2.0 spec. Returns the number of
+// bytes written to out, at most MaxRLERowBytes().
+template<i32 BYTESPP>
+static auto EncodeRLERow(const u8* row, u32 width, u8* out) -> usize {
+	const usize MAX_PACKET_LENGTH = 128;
+	u8* begin = out;
+	usize x = 0;
+	while (x < width) {
+		const u8* p = row + x * BYTESPP;
+		usize n = std::min<usize>(MAX_PACKET_LENGTH, width - x);
+		// Pixels [0, run) are all equal
+		usize run = std::min(FindSuccessor<BYTESPP, false>(p, n, width - x) + 1, n);
+		if (run >= 2) {
+			*out++ = static_cast<u8>(run - 1 + 128);
+			memcpy(out, p, BYTESPP);
+			out += BYTESPP;
+			x += run;
+		} else {
+			// Stop right before the next repeated run; at least 1 since the first pixel differs from its successor
+			usize raw = std::max<usize>(FindSuccessor<BYTESPP, true>(p, n, width - x), 1);
+			*out++ = static_cast<u8>(raw - 1);
+			memcpy(out, p, raw * BYTESPP);
+			out += raw * BYTESPP;
+			x += raw;
+		}
+	}
+	return out - begin;
+}
+
+auto TGAImage::MaxRLERowBytes() const -> usize {
+	// Every packet covers at least one pixel and costs at most one header byte on top of its pixels
+	return static_cast<usize>(width) * (bytespp + 1);
+}
+
+auto TGAImage::UnloadRLEData(u8* out) const -> usize {
+	const u32 MIN_ROWS_PER_TASK = 32;
+	usize rowCapacity = MaxRLERowBytes();
+	usize rowBytes = static_cast<usize>(width) * bytespp;
+	std::vector<usize> rowSizes(height);
+
+	// Rows are encoded in parallel, each at its worst-case offset...
+	auto encodeRows = [&](u32 begin, u32 end) {
+		auto encodeRow = bytespp == GRAYSCALE ? &EncodeRLERow<GRAYSCALE>
+			: bytespp == RGB ? &EncodeRLERow<RGB>
+			: &EncodeRLERow<RGBA>;
+		for (u32 y = begin; y < end; ++y) {
+			rowSizes[y] = encodeRow(data + y * rowBytes, width, out + y * rowCapacity);
+		}
+	};
+	u32 taskCount = std::clamp<u32>(height / MIN_ROWS_PER_TASK, 1, std::max(1u, std::thread::hardware_concurrency()));
+	u32 rowsPerTask = (height + taskCount - 1) / taskCount;
+	std::vector<std::future<void>> tasks;
+	for (u32 begin = rowsPerTask; begin < height; begin += rowsPerTask) {
+		tasks.push_back(std::async(std::launch::async, encodeRows, begin, std::min(begin + rowsPerTask, height)));
+	}
+	encodeRows(0, std::min(rowsPerTask, height));
+	for (auto& task : tasks) {
+		task.get();
+	}
+
+	// ...then packed together
+	usize size = 0;
+	for (u32 y = 0; y < height; ++y) {
+		memmove(out + size, out + y * rowCapacity, rowSizes[y]);
+		size += rowSizes[y];
+	}
+	return size;
 }
 
 auto TGAImage::Get(u32 x, u32 y) const -> TGAColor {
@@ -293,18 +466,56 @@ auto TGAImage::Set(u32 x, u32 y, TGAColor c) -> bool {
 	return true;
 }
 
+#ifdef SRENDER_SSE2
+// Reverses the order of the 16 bytes
+static auto ReverseBytes(__m128i v) -> __m128i {
+	v = _mm_shuffle_epi32(v, 0x1B);
+	v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif // SRENDER_SSE2
+
+// Reverses the order of the count pixels at row in place
+template<i32 BYTESPP>
+static auto ReversePixels(u8* row, usize count) -> void {
+	// [l, r) is the part not reversed yet
+	usize l = 0;
+	usize r = count;
+#ifdef SRENDER_SSE2
+	// Swaps 16 byte blocks from both ends, reversing each
+	if constexpr (BYTESPP == 4) {
+		for (; r - l >= 8; l += 4, r -= 4) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + l * 4));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (r - 4) * 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(row + l * 4), _mm_shuffle_epi32(b, 0x1B));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(row + (r - 4) * 4), _mm_shuffle_epi32(a, 0x1B));
+		}
+	} else if constexpr (BYTESPP == 1) {
+		for (; r - l >= 32; l += 16, r -= 16) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + l));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + r - 16));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(row + l), ReverseBytes(b));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(row + r - 16), ReverseBytes(a));
+		}
+	}
+#endif // SRENDER_SSE2
+	for (; r - l >= 2; ++l, --r) {
+		u8 tmp[BYTESPP];
+		memcpy(tmp, row + l * BYTESPP, BYTESPP);
+		memcpy(row + l * BYTESPP, row + (r - 1) * BYTESPP, BYTESPP);
+		memcpy(row + (r - 1) * BYTESPP, tmp, BYTESPP);
+	}
+}
+
 auto TGAImage::FlipHorizontally() -> bool {
 	if (!data) {
 		return false;
 	}
-	i32 half = width >> 1;
-	for (i32 i = 0; i < half; i++) {
-		for (i32 j = 0; j < height; j++) {
-			auto c1 = Get(i, j);
-			auto c2 = Get(width - 1 - i, j);
-			Set(i, j, c2);
-			Set(width - 1 - i, j, c1);
-		}
+	auto reverse = bytespp == GRAYSCALE ? &ReversePixels<GRAYSCALE>
+		: bytespp == RGB ? &ReversePixels<RGB>
+		: &ReversePixels<RGBA>;
+	for (u32 y = 0; y < height; ++y) {
+		reverse(data + static_cast<usize>(y) * width * bytespp, width);
 	}
 	return true;
 }
@@ -327,38 +538,230 @@ auto TGAImage::FlipVertically() -> bool {
 	return true;
 }
 
-auto TGAImage::Scale(i32 w, i32 h) -> bool {
-	if (w <= 0 || h <= 0 || !data) {
-		return false;
+// Source pixel and 8-bit weight of the next one, for sampling at the center of a destination pixel
+struct BilinearTap {
+	u32 index;
+	u32 weight;
+};
+
+static auto ComputeBilinearTaps(u32 srcSize, u32 dstSize) -> std::vector<BilinearTap> {
+	std::vector<BilinearTap> taps(dstSize);
+	for (u32 i = 0; i < dstSize; ++i) {
+		// (i + 0.5) * srcSize / dstSize - 0.5, in 16.16 fixed point
+		i64 pos = ((2 * static_cast<i64>(i) + 1) * srcSize << 16) / (2 * static_cast<i64>(dstSize)) - (1 << 15);
+		pos = std::max<i64>(pos, 0);
+		auto index = static_cast<u32>(pos >> 16);
+		auto weight = static_cast<u32>((pos & 0xFFFF) >> 8);
+		if (index >= srcSize - 1) {
+			index = srcSize - 1;
+			weight = 0;
+		}
+		taps[i] = {index, weight};
+	}
+	return taps;
+}
+
+// Horizontal bilinear pass of one row, keeping 8 bits of fraction in the 16-bit results
+template<i32 BYTESPP>
+static auto ResampleRowBilinear(const u8* src, u32 srcWidth, const std::vector<BilinearTap>& taps, u16* out) -> void {
+	for (usize x = 0; x < taps.size(); ++x) {
+		const u8* p0 = src + taps[x].index * BYTESPP;
+		const u8* p1 = src + std::min(taps[x].index + 1, srcWidth - 1) * BYTESPP;
+		u32 w1 = taps[x].weight;
+		u32 w0 = 256 - w1;
+		for (i32 c = 0; c < BYTESPP; ++c) {
+			out[x * BYTESPP + c] = static_cast<u16>(p0[c] * w0 + p1[c] * w1);
+		}
+	}
+}
+
+// Vertical bilinear pass: blends two horizontally resampled rows with an 8-bit weight of the second one
+static auto BlendRows(const u16* a, const u16* b, u32 weight, u8* out, usize count) -> void {
+	usize i = 0;
+	if (weight == 0) {
+		for (; i < count; ++i) {
+			out[i] = static_cast<u8>((a[i] + 128) >> 8);
+		}
+		return;
 	}
-	u8* tdata = new u8[w * h * bytespp];
-	i32 nscanline = 0;
-	i32 oscanline = 0;
-	i32 erry = 0;
-	u64 nlinebytes = w * bytespp;
-	u64 olinebytes = width * bytespp;
-	for (i32 j = 0; j < height; j++) {
-		i32 errx = width - w;
-		i32 nx = -bytespp;
-		i32 ox = -bytespp;
-		for (i32 i = 0; i < width; i++) {
-			ox += bytespp;
-			errx += w;
-			while (errx >= static_cast<i32>(width)) {
-				errx -= width;
-				nx += bytespp;
-				memcpy(tdata + nscanline + nx, data + oscanline + ox, bytespp);
+
+	// The products keep their top 16 bits, i.e. a * (256 - weight) / 256, so everything stays in 16 bits
+	u32 wa = (256 - weight) << 8;
+	u32 wb = weight << 8;
+#ifdef SRENDER_SSE2
+	__m128i wideWa = _mm_set1_epi16(static_cast<i16>(wa));
+	__m128i wideWb = _mm_set1_epi16(static_cast<i16>(wb));
+	__m128i half = _mm_set1_epi16(128);
+	for (; i + 16 <= count; i += 16) {
+		__m128i lo = _mm_add_epi16(
+			_mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), wideWa),
+			_mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)), wideWb));
+		__m128i hi = _mm_add_epi16(
+			_mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 8)), wideWa),
+			_mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 8)), wideWb));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+	}
+#endif // SRENDER_SSE2
+	for (; i < count; ++i) {
+		u32 sum = ((a[i] * wa) >> 16) + ((b[i] * wb) >> 16);
+		out[i] = static_cast<u8>((sum + 128) >> 8);
+	}
+}
+
+template<i32 BYTESPP>
+static auto ScaleBilinear(const u8* src, u32 srcWidth, u32 srcHeight, u8* dst, u32 dstWidth, u32 dstHeight) -> void {
+	auto xTaps = ComputeBilinearTaps(srcWidth, dstWidth);
+	auto yTaps = ComputeBilinearTaps(srcHeight, dstHeight);
+	usize srcRowBytes = static_cast<usize>(srcWidth) * BYTESPP;
+	usize dstRowBytes = static_cast<usize>(dstWidth) * BYTESPP;
+
+	// Horizontally resampled source rows y and y + 1, reused while consecutive destination rows share them
+	std::vector<u16> rows[2] = {std::vector<u16>(dstRowBytes), std::vector<u16>(dstRowBytes)};
+	i64 cached[2] = {-1, -1};
+	auto getRow = [&](u32 y, i32 slot) -> const u16* {
+		if (cached[slot] != y) {
+			if (cached[slot ^ 1] == y) {
+				std::swap(rows[0], rows[1]);
+				std::swap(cached[0], cached[1]);
+			} else {
+				ResampleRowBilinear<BYTESPP>(src + y * srcRowBytes, srcWidth, xTaps, rows[slot].data());
+				cached[slot] = y;
 			}
 		}
-		erry += h;
-		oscanline += olinebytes;
-		while (erry >= static_cast<i32>(height)) {
-			if (erry >= static_cast<i32>(height) << 1) // it means we jump over a scanline
-				memcpy(tdata + nscanline + nlinebytes, tdata + nscanline, nlinebytes);
-			erry -= height;
-			nscanline += nlinebytes;
+		return rows[slot].data();
+	};
+
+	for (u32 y = 0; y < dstHeight; ++y) {
+		u32 y0 = yTaps[y].index;
+		u32 y1 = std::min(y0 + 1, srcHeight - 1);
+		const u16* a = getRow(y0, 0);
+		const u16* b = yTaps[y].weight > 0 ? getRow(y1, 1) : a;
+		BlendRows(a, b, yTaps[y].weight, dst + y * dstRowBytes, dstRowBytes);
+	}
+}
+
+// Adds count bytes from src to the 32-bit sums
+static auto AccumulateRow(const u8* src, u32* sums, usize count) -> void {
+	usize i = 0;
+#ifdef SRENDER_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		__m128i parts[4] = {
+			_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+			_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero),
+		};
+		for (i32 k = 0; k < 4; ++k) {
+			auto p = reinterpret_cast<__m128i*>(sums + i + k * 4);
+			_mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), parts[k]));
 		}
 	}
+#endif // SRENDER_SSE2
+	for (; i < count; ++i) {
+		sums[i] += src[i];
+	}
+}
+
+// Source range [begin, end) covered by each destination pixel, at least one pixel wide
+static auto ComputeBoxSpans(u32 srcSize, u32 dstSize) -> std::vector<std::pair<u32, u32>> {
+	std::vector<std::pair<u32, u32>> spans(dstSize);
+	for (u32 i = 0; i < dstSize; ++i) {
+		auto begin = static_cast<u32>(static_cast<u64>(i) * srcSize / dstSize);
+		auto end = static_cast<u32>(static_cast<u64>(i + 1) * srcSize / dstSize);
+		spans[i] = {begin, std::max(end, begin + 1)};
+	}
+	return spans;
+}
+
+template<i32 BYTESPP>
+static auto ScaleBox(const u8* src, u32 srcWidth, u32 srcHeight, u8* dst, u32 dstWidth, u32 dstHeight) -> void {
+	auto xSpans = ComputeBoxSpans(srcWidth, dstWidth);
+	auto ySpans = ComputeBoxSpans(srcHeight, dstHeight);
+	usize srcRowBytes = static_cast<usize>(srcWidth) * BYTESPP;
+	std::vector<u32> columnSums(srcRowBytes);
+
+	// Rounded division by each pixel's area, as a multiplication by ceil(2^32 / area). That is exact while
+	// sum * (reciprocal * area - 2^32) < 2^32, which holds for sums of up to 256 * area if area < 4096.
+	const u32 MAX_RECIPROCAL_AREA = 4096;
+	std::vector<u64> reciprocals(dstWidth);
+	u32 reciprocalsHeight = 0;
+
+	for (u32 y = 0; y < dstHeight; ++y) {
+		// Vertical sums of the covered rows first, which is contiguous and vectorizes...
+		std::fill(columnSums.begin(), columnSums.end(), 0);
+		auto [y0, y1] = ySpans[y];
+		for (u32 sy = y0; sy < y1; ++sy) {
+			AccumulateRow(src + sy * srcRowBytes, columnSums.data(), srcRowBytes);
+		}
+
+		// Spans only come in two sizes per axis, so this rarely recomputes
+		if (reciprocalsHeight != y1 - y0) {
+			reciprocalsHeight = y1 - y0;
+			for (u32 x = 0; x < dstWidth; ++x) {
+				u64 area = static_cast<u64>(xSpans[x].second - xSpans[x].first) * reciprocalsHeight;
+				reciprocals[x] = area < MAX_RECIPROCAL_AREA ? ((u64{1} << 32) + area - 1) / area : 0;
+			}
+		}
+
+		// ...then horizontal sums of the covered columns
+		u8* out = dst + static_cast<usize>(y) * dstWidth * BYTESPP;
+		for (u32 x = 0; x < dstWidth; ++x) {
+			auto [x0, x1] = xSpans[x];
+			u64 area = static_cast<u64>(x1 - x0) * (y1 - y0);
+			for (i32 c = 0; c < BYTESPP; ++c) {
+				u64 sum = area / 2;
+				for (u32 sx = x0; sx < x1; ++sx) {
+					sum += columnSums[sx * BYTESPP + c];
+				}
+				out[x * BYTESPP + c] = static_cast<u8>(reciprocals[x] ? (sum * reciprocals[x]) >> 32 : sum / area);
+			}
+		}
+	}
+}
+
+template<i32 BYTESPP>
+static auto ScaleNearest(const u8* src, u32 srcWidth, u32 srcHeight, u8* dst, u32 dstWidth, u32 dstHeight) -> void {
+	std::vector<u32> srcX(dstWidth);
+	for (u32 x = 0; x < dstWidth; ++x) {
+		srcX[x] = static_cast<u32>((2 * static_cast<u64>(x) + 1) * srcWidth / (2 * static_cast<u64>(dstWidth))) * BYTESPP;
+	}
+	usize srcRowBytes = static_cast<usize>(srcWidth) * BYTESPP;
+	usize dstRowBytes = static_cast<usize>(dstWidth) * BYTESPP;
+	i64 prevY = -1;
+	for (u32 y = 0; y < dstHeight; ++y) {
+		auto sy = static_cast<u32>((2 * static_cast<u64>(y) + 1) * srcHeight / (2 * static_cast<u64>(dstHeight)));
+		u8* out = dst + y * dstRowBytes;
+		if (sy == prevY) {
+			// Upscaling repeats rows, which only need to be gathered once
+			memcpy(out, out - dstRowBytes, dstRowBytes);
+			continue;
+		}
+		const u8* row = src + sy * srcRowBytes;
+		for (u32 x = 0; x < dstWidth; ++x) {
+			memcpy(out + x * BYTESPP, row + srcX[x], BYTESPP);
+		}
+		prevY = sy;
+	}
+}
+
+auto TGAImage::Scale(i32 w, i32 h, ScaleFilter filter) -> bool {
+	if (w <= 0 || h <= 0 || !data) {
+		return false;
+	}
+	using ScaleFunc = auto (*)(const u8*, u32, u32, u8*, u32, u32) -> void;
+	ScaleFunc funcs[3][3] = {
+		{&ScaleNearest<GRAYSCALE>, &ScaleBilinear<GRAYSCALE>, &ScaleBox<GRAYSCALE>},
+		{&ScaleNearest<RGB>, &ScaleBilinear<RGB>, &ScaleBox<RGB>},
+		{&ScaleNearest<RGBA>, &ScaleBilinear<RGBA>, &ScaleBox<RGBA>},
+	};
+	i32 formatIndex = bytespp == GRAYSCALE ? 0 : bytespp == RGB ? 1 : 2;
+
+	u8* tdata = new u8[static_cast<usize>(w) * h * bytespp];
+	funcs[formatIndex][filter](data, width, height, tdata, w, h);
 	delete[] data;
 	data = tdata;
 	width = w;
@@ -369,3 +772,160 @@ auto TGAImage::Scale(i32 w, i32 h) -> bool {
 auto TGAImage::Clear() -> void {
 	memset(reinterpret_cast<void*>(data), 0, width * height * bytespp);
 }
+
+// Rec. 601 luma with 8 fractional bits, from pixels in TGA (B, G, R) order
+static auto LumaOf(const u8* p) -> u8 {
+	return static_cast<u8>((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+}
+
+// Converts count pixels between formats, both in TGA (B, G, R, A) channel order
+template<i32 SRC, i32 DST>
+static auto ConvertPixels(const u8* src, u8* dst, usize count) -> void {
+	usize i = 0;
+	if constexpr (SRC == DST) {
+		memcpy(dst, src, count * SRC);
+		return;
+	} else if constexpr (SRC == 1) {
+#ifdef SRENDER_SSE2
+		if constexpr (DST == 4) {
+			__m128i opaque = _mm_set1_epi8(static_cast<char>(0xFF));
+			for (; i + 16 <= count; i += 16) {
+				__m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				// (g, g) and (g, 255) pairs interleave into (g, g, g, 255)
+				__m128i gg[2] = {_mm_unpacklo_epi8(g, g), _mm_unpackhi_epi8(g, g)};
+				__m128i ga[2] = {_mm_unpacklo_epi8(g, opaque), _mm_unpackhi_epi8(g, opaque)};
+				for (i32 k = 0; k < 2; ++k) {
+					auto out = reinterpret_cast<__m128i*>(dst + (i + k * 8) * 4);
+					_mm_storeu_si128(out, _mm_unpacklo_epi16(gg[k], ga[k]));
+					_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg[k], ga[k]));
+				}
+			}
+		}
+#endif // SRENDER_SSE2
+		for (; i < count; ++i) {
+			memset(dst + i * DST, src[i], 3);
+			if constexpr (DST == 4) {
+				dst[i * DST + 3] = 0xFF;
+			}
+		}
+	} else if constexpr (DST == 1) {
+#ifdef SRENDER_SSE2
+		if constexpr (SRC == 4) {
+			__m128i mask = _mm_set1_epi32(0xFF);
+			auto channel = [&](__m128i a, __m128i b, i32 shift) {
+				return _mm_packs_epi32(
+					_mm_and_si128(_mm_srl_epi32(a, _mm_cvtsi32_si128(shift)), mask),
+					_mm_and_si128(_mm_srl_epi32(b, _mm_cvtsi32_si128(shift)), mask));
+			};
+			for (; i + 16 <= count; i += 16) {
+				__m128i luma[2];
+				for (i32 k = 0; k < 2; ++k) {
+					auto in = reinterpret_cast<const __m128i*>(src + (i + k * 8) * 4);
+					__m128i a = _mm_loadu_si128(in);
+					__m128i b = _mm_loadu_si128(in + 1);
+					// The sum can exceed 32767 but not 65535, so wrap around and shift logically
+					__m128i sum = _mm_add_epi16(
+						_mm_add_epi16(_mm_mullo_epi16(channel(a, b, 0), _mm_set1_epi16(29)), _mm_mullo_epi16(channel(a, b, 8), _mm_set1_epi16(150))),
+						_mm_add_epi16(_mm_mullo_epi16(channel(a, b, 16), _mm_set1_epi16(77)), _mm_set1_epi16(128)));
+					luma[k] = _mm_srli_epi16(sum, 8);
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(luma[0], luma[1]));
+			}
+		}
+#endif // SRENDER_SSE2
+		for (; i < count; ++i) {
+			dst[i] = LumaOf(src + i * SRC);
+		}
+	} else {
+		// RGB <-> RGBA
+		for (; i < count; ++i) {
+			memcpy(dst + i * DST, src + i * SRC, 3);
+			if constexpr (DST == 4) {
+				dst[i * DST + 3] = 0xFF;
+			}
+		}
+	}
+}
+
+// Swaps the first and third channel of count pixels in place, i.e. B, G, R(, A) <-> R, G, B(, A)
+template<i32 BYTESPP>
+static auto SwapRedBlue(u8* p, usize count) -> void {
+	usize i = 0;
+#ifdef SRENDER_SSE2
+	if constexpr (BYTESPP == 4) {
+		__m128i keep = _mm_set1_epi32(static_cast<i32>(0xFF00FF00));
+		__m128i low = _mm_set1_epi32(0xFF);
+		for (; i + 4 <= count; i += 4) {
+			auto q = reinterpret_cast<__m128i*>(p + i * 4);
+			__m128i v = _mm_loadu_si128(q);
+			__m128i swapped = _mm_or_si128(
+				_mm_and_si128(v, keep),
+				_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low), _mm_slli_epi32(_mm_and_si128(v, low), 16)));
+			_mm_storeu_si128(q, swapped);
+		}
+	}
+#endif // SRENDER_SSE2
+	for (; i < count; ++i) {
+		std::swap(p[i * BYTESPP], p[i * BYTESPP + 2]);
+	}
+}
+
+// Converts an image row by row, so that the optional channel swap of each row happens while it is still in cache
+template<i32 SRC, i32 DST, bool SWAP_SRC, bool SWAP_DST>
+static auto ConvertImage(const u8* src, u8* dst, u32 width, u32 height) -> void {
+	std::vector<u8> swapped;
+	if constexpr (SWAP_SRC) {
+		swapped.resize(static_cast<usize>(width) * SRC);
+	}
+	for (u32 y = 0; y < height; ++y) {
+		const u8* in = src + static_cast<usize>(y) * width * SRC;
+		u8* out = dst + static_cast<usize>(y) * width * DST;
+		if constexpr (SWAP_SRC) {
+			memcpy(swapped.data(), in, swapped.size());
+			SwapRedBlue<SRC>(swapped.data(), width);
+			in = swapped.data();
+		}
+		ConvertPixels<SRC, DST>(in, out, width);
+		if constexpr (SWAP_DST) {
+			SwapRedBlue<DST>(out, width);
+		}
+	}
+}
+
+using ConvertFunc = auto (*)(const u8*, u8*, u32, u32) -> void;
+
+template<i32 SRC, bool SWAP_SRC>
+static auto GetConverter(i32 dst) -> ConvertFunc {
+	return dst == TGAImage::GRAYSCALE ? &ConvertImage<SRC, TGAImage::GRAYSCALE, SWAP_SRC, false>
+		: dst == TGAImage::RGB ? &ConvertImage<SRC, TGAImage::RGB, SWAP_SRC, false>
+		: &ConvertImage<SRC, TGAImage::RGBA, SWAP_SRC, false>;
+}
+
+auto TGAImage::ConvertTo(Format format) const -> TGAImage {
+	auto result = TGAImage{width, height, format};
+	if (!data) {
+		return result;
+	}
+	auto convert = bytespp == GRAYSCALE ? GetConverter<GRAYSCALE, false>(format)
+		: bytespp == RGB ? GetConverter<RGB, false>(format)
+		: GetConverter<RGBA, false>(format);
+	convert(data, result.data, width, height);
+	return result;
+}
+
+auto TGAImage::CopyToRGBA(u8* out) const -> void {
+	if (!data) {
+		return;
+	}
+	auto convert = bytespp == GRAYSCALE ? &ConvertImage<GRAYSCALE, RGBA, false, false>
+		: bytespp == RGB ? &ConvertImage<RGB, RGBA, false, true>
+		: &ConvertImage<RGBA, RGBA, false, true>;
+	convert(data, out, width, height);
+}
+
+auto TGAImage::FromRGBA(const u8* rgba, u32 w, u32 h, Format format) -> TGAImage {
+	auto result = TGAImage{w, h, format};
+	// Grayscale is computed from the swapped pixels, so that luma weighs the right channels
+	GetConverter<RGBA, true>(format)(rgba, result.data, w, h);
+	return result;
+}
@@ -22,6 +22,8 @@ struct TGAHeader {
 };
 #pragma pack(pop)
 
+// Pixel of a TGAImage, whose format is only known at runtime. Code that knows the format at compile time should
+// use Image and the pixel formats from PixelFormat.hpp instead.
 struct TGAColor {
 	union {
 		struct {
@@ -33,20 +35,20 @@ struct TGAColor {
 		u8 raw[4];
 		u32 val;
 	};
-	i32 bytespp;
 
 	TGAColor()
-		: val{0}, bytespp{1} {}
+		: val{0} {}
 	
 	TGAColor(u8 r, u8 g, u8 b, u8 a)
-		: r{r}, g{g}, b{b}, a{a} {}
+		: b{b}, g{g}, r{r}, a{a} {}
 	
-	TGAColor(u32 val, i32 bytespp)
-		: val{val}, bytespp{bytespp} {}
+	explicit TGAColor(u32 val)
+		: val{val} {}
 
+	// Reads the first bytespp bytes of raw from p, leaving the rest zeroed
 	TGAColor(const u8* p, i32 bytespp)
-		: val{0}, bytespp{bytespp} {
-		for (usize i = 0; i < bytespp; ++i) {
+		: val{0} {
+		for (i32 i = 0; i < bytespp; ++i) {
 			raw[i] = p[i];
 		}
 	}
@@ -57,6 +59,8 @@ struct TGAColor {
 	TGAColor& operator=(TGAColor&&) = default;
 };
 
+static_assert(sizeof(TGAColor) == 4);
+
 class TGAImage {
 protected:
 	u8* data;
@@ -64,14 +68,28 @@ protected:
 	u32 height;
 	i32 bytespp;
 	
-	auto LoadRLEData(std::ifstream& in) -> bool;
-	auto UnloadRLEData(std::ofstream& out) -> bool;
+	// Decodes RLE packets from [in, end) into data, placing pixels as the flips from the image descriptor say
+	auto LoadRLEData(const u8* in, const u8* end, bool flipX, bool flipY) -> bool;
+	// Worst-case size of an RLE encoded row
+	auto MaxRLERowBytes() const -> usize;
+	// Writes the RLE encoded pixels to out, which must hold height * MaxRLERowBytes() bytes, and returns the
+	// number of bytes used
+	auto UnloadRLEData(u8* out) const -> usize;
 public:
 	enum Format {
 		GRAYSCALE = 1,
 		RGB = 3,
 		RGBA = 4
 	};
+
+	enum ScaleFilter {
+		// Picks the source pixel under each destination pixel's center
+		NEAREST,
+		// Blends the 2x2 source pixels around each destination pixel's center, for upscaling
+		BILINEAR,
+		// Averages every source pixel covered by a destination pixel, for downscaling
+		BOX
+	};
 	
 	TGAImage();
 	TGAImage(u32 w, u32 h, i32 bpp);
@@ -88,9 +106,16 @@ public:
 	auto Set(u32 x, u32 y, TGAColor c) -> bool;
 	auto FlipHorizontally() -> bool;
 	auto FlipVertically() -> bool;
-	auto Scale(i32 w, i32 h) -> bool;
+	auto Scale(i32 w, i32 h, ScaleFilter filter = NEAREST) -> bool;
 	auto Clear() -> void;
 
+	// Color to grayscale uses Rec. 601 luma, grayscale to color replicates the value, and added alpha is opaque
+	auto ConvertTo(Format format) const -> TGAImage;
+	// Writes width * height pixels in R, G, B, A byte order (the layout of v2's RgbaColor) to out
+	auto CopyToRGBA(u8* out) const -> void;
+	// Inverse of CopyToRGBA()
+	static auto FromRGBA(const u8* rgba, u32 w, u32 h, Format format) -> TGAImage;
+
 	auto GetWidth() const -> u32 { return width; }
 	auto GetHeight() const-> u32 { return height; }
 	auto GetBytesPP() const -> i32 { return bytespp; }
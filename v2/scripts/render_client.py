@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Client for the v2 render server (soft-renderer-v2 --serve).
+
+Sends requests, one JSON object per line, and prints each response line. With --save-dir, images returned inline
+are decoded into files instead of being printed.
+
+    # Start a server and render through its socket
+    soft-renderer-v2 --serve /tmp/srender.sock &
+    render_client.py --socket /tmp/srender.sock --mesh head.obj --output head.png --width 256 --height 256
+    render_client.py --socket /tmp/srender.sock requests.jsonl
+    render_client.py --socket /tmp/srender.sock --stats
+    render_client.py --socket /tmp/srender.sock --shutdown
+
+    # Or run a private server over stdin/stdout for the duration of the script
+    render_client.py --spawn ./soft-renderer-v2 requests.jsonl
+"""
+
+import argparse
+import base64
+import json
+import os
+import socket
+import subprocess
+import sys
+import threading
+
+
+def build_requests(args):
+    if args.stats:
+        return [{"cmd": "stats"}]
+    if args.shutdown:
+        return [{"cmd": "shutdown"}]
+    if args.mesh:
+        request = {"id": 0, "mesh": args.mesh, "width": args.width, "height": args.height, "angle": args.angle}
+        if args.output:
+            request["output"] = args.output
+        return [request]
+
+    source = sys.stdin if args.requests in (None, "-") else open(args.requests)
+    with source:
+        return [json.loads(line) for line in source if line.strip()]
+
+
+def open_server(args):
+    """Returns (writer, reader, close) file objects for the server's input and output."""
+    if args.socket:
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        conn.connect(args.socket)
+        writer = conn.makefile("w", encoding="utf-8")
+        reader = conn.makefile("r", encoding="utf-8")
+
+        def close():
+            writer.close()
+            conn.shutdown(socket.SHUT_WR)
+            reader.close()
+            conn.close()
+
+        return writer, reader, close
+
+    process = subprocess.Popen(
+        [args.spawn, "--serve", "-", "--cache-mb", str(args.cache_mb)],
+        stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True, encoding="utf-8")
+
+    def close():
+        process.stdin.close()
+        process.wait()
+
+    return process.stdin, process.stdout, close
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--socket", help="Unix domain socket of a running server")
+    target.add_argument("--spawn", help="server binary to run over stdin/stdout")
+    parser.add_argument("requests", nargs="?", help="file of JSON requests, one per line (- for stdin)")
+    parser.add_argument("--mesh", help="render a single mesh instead of reading requests")
+    parser.add_argument("--output", help="with --mesh, image path to write; the image is returned inline otherwise")
+    parser.add_argument("--width", type=int, default=1024)
+    parser.add_argument("--height", type=int, default=768)
+    parser.add_argument("--angle", type=float, default=0.0, help="turntable angle in radians")
+    parser.add_argument("--stats", action="store_true", help="print the server's mesh cache counters")
+    parser.add_argument("--shutdown", action="store_true", help="stop the server")
+    parser.add_argument("--save-dir", help="write images returned inline to <id>.<format> in this directory")
+    parser.add_argument("--cache-mb", type=int, default=1024, help="with --spawn, the server's mesh cache budget")
+    args = parser.parse_args()
+
+    requests = build_requests(args)
+    writer, reader, close = open_server(args)
+
+    # Written from a thread of its own, so that a long batch can't fill both directions of the pipe and stall
+    def send():
+        for request in requests:
+            writer.write(json.dumps(request) + "\n")
+            writer.flush()
+
+    sender = threading.Thread(target=send)
+    sender.start()
+
+    failed = 0
+    for index in range(len(requests)):
+        line = reader.readline()
+        if not line:
+            print("error: server closed the connection", file=sys.stderr)
+            failed += len(requests) - index
+            break
+        response = json.loads(line)
+        if not response.get("ok"):
+            failed += 1
+        if args.save_dir and "image" in response:
+            name = f"{response.get('id', index)}.{response['format']}"
+            with open(os.path.join(args.save_dir, name), "wb") as f:
+                f.write(base64.b64decode(response.pop("image")))
+            response["saved"] = name
+        print(json.dumps(response))
+
+    sender.join()
+    close()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,197 @@
+#include "JobSystem.hpp"
+
+#include <utility>
+
+namespace {
+// Pool and queue of the current thread, if it is a worker
+thread_local JobSystem* gCurrentSystem = nullptr;
+thread_local size_t gCurrentQueue = 0;
+} // namespace
+
+JobSystem::JobSystem(int workerCount) {
+    if (workerCount <= 0) {
+        workerCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+
+    for (int i = 0; i <= workerCount; ++i) {
+        mQueues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int i = 1; i <= workerCount; ++i) {
+        mWorkers.emplace_back([this, i]() { WorkerMain(i); });
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mStopping = true;
+    }
+    mWake.notify_all();
+    for (auto& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+JobSystem& JobSystem::Global() {
+    static JobSystem system;
+    return system;
+}
+
+JobSystem::JobHandle JobSystem::Schedule(std::function<void()> func, const std::vector<JobHandle>& dependencies) {
+    auto job = std::make_shared<Job>();
+    job->mFunc = std::move(func);
+
+    for (auto& dependency : dependencies) {
+        if (!dependency) continue;
+
+        std::lock_guard<std::mutex> lock(dependency->mMutex);
+        if (dependency->IsFinished()) {
+            if (dependency->mError) {
+                std::lock_guard<std::mutex> jobLock(job->mMutex);
+                if (!job->mError) job->mError = dependency->mError;
+            }
+        } else {
+            job->mPendingDependencies.fetch_add(1, std::memory_order_relaxed);
+            dependency->mContinuations.push_back(job);
+        }
+    }
+
+    // Drop the reference held while scheduling; the last dependency to finish queues the job otherwise
+    if (job->mPendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        Enqueue(job);
+    }
+    return job;
+}
+
+void JobSystem::Wait(const JobHandle& job) {
+    if (!job) return;
+
+    while (!job->IsFinished()) {
+        if (auto next = TryPop()) {
+            Execute(next);
+            continue;
+        }
+
+        // Must match what TryPop() may return, or this would spin
+        auto& available = gCurrentSystem == this ? mQueuedJobs : mSharedQueuedJobs;
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        mBlockedWaiters.fetch_add(1);
+        mWake.wait(lock, [&]() { return job->mFinished.load() || available.load() > 0; });
+        mBlockedWaiters.fetch_sub(1);
+    }
+
+    if (job->mError) {
+        std::rethrow_exception(job->mError);
+    }
+}
+
+void JobSystem::WorkerMain(size_t index) {
+    gCurrentSystem = this;
+    gCurrentQueue = index;
+
+    while (true) {
+        if (auto job = TryPop()) {
+            Execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        mWake.wait(lock, [&]() { return mStopping || mQueuedJobs.load() > 0; });
+        if (mStopping && mQueuedJobs.load() == 0) break;
+    }
+}
+
+void JobSystem::Enqueue(JobHandle job) {
+    size_t own = gCurrentSystem == this ? gCurrentQueue : 0;
+    {
+        auto& queue = *mQueues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+    if (own == 0) mSharedQueuedJobs.fetch_add(1);
+    mQueuedJobs.fetch_add(1);
+
+    // Taking the lock orders this against a sleeper's check of mQueuedJobs, so the notification isn't lost.
+    // A single notification could go to a waiter outside the pool that can't take this job.
+    { std::lock_guard<std::mutex> lock(mWakeMutex); }
+    if (mBlockedWaiters.load() > 0) {
+        mWake.notify_all();
+    } else {
+        mWake.notify_one();
+    }
+}
+
+JobSystem::JobHandle JobSystem::TryPop() {
+    bool isWorker = gCurrentSystem == this;
+    if ((isWorker ? mQueuedJobs : mSharedQueuedJobs).load(std::memory_order_relaxed) == 0) return nullptr;
+
+    // Newest of the own jobs first, as its data is most likely still in cache...
+    size_t own = isWorker ? gCurrentQueue : 0;
+    {
+        auto& queue = *mQueues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            auto job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            if (own == 0) mSharedQueuedJobs.fetch_sub(1);
+            mQueuedJobs.fetch_sub(1);
+            return job;
+        }
+    }
+    if (!isWorker) return nullptr;
+
+    // ...then the oldest jobs of the others, which tend to be the largest pieces of work
+    for (size_t i = 1; i < mQueues.size(); ++i) {
+        auto& queue = *mQueues[(own + i) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            auto job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            if (&queue == mQueues[0].get()) mSharedQueuedJobs.fetch_sub(1);
+            mQueuedJobs.fetch_sub(1);
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::Execute(const JobHandle& job) {
+    // Set before the job was queued if a dependency failed
+    if (!job->mError) {
+        try {
+            job->mFunc();
+        } catch (...) {
+            job->mError = std::current_exception();
+        }
+    }
+    Finish(job);
+}
+
+void JobSystem::Finish(const JobHandle& job) {
+    // Release whatever the function captured before anyone sees the job finished
+    job->mFunc = nullptr;
+
+    std::vector<JobHandle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job->mMutex);
+        job->mFinished.store(true);
+        continuations.swap(job->mContinuations);
+    }
+
+    for (auto& continuation : continuations) {
+        if (job->mError) {
+            std::lock_guard<std::mutex> lock(continuation->mMutex);
+            if (!continuation->mError) continuation->mError = job->mError;
+        }
+        if (continuation->mPendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Enqueue(std::move(continuation));
+        }
+    }
+
+    // Both this and the check in Wait() are sequentially consistent, so either the waiter sees the job
+    // finished or this sees the waiter
+    if (mBlockedWaiters.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mWakeMutex); }
+        mWake.notify_all();
+    }
+}
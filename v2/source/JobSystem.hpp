@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Persistent pool of worker threads with one job deque per worker. Workers run their own jobs newest first
+/// and steal the oldest jobs of other workers when they run out. Threads that wait for a job run other jobs in
+/// the meantime, so jobs may schedule and wait for more jobs without deadlocking the pool.
+///
+/// Threads outside the pool share a queue of their own, and while waiting only run jobs from it, never the
+/// workers' jobs. That keeps a waiting thread (e.g. a UI thread) from picking up some unrelated long job.
+class JobSystem {
+public:
+    class Job {
+    private:
+        friend class JobSystem;
+
+        std::function<void()> mFunc;
+        std::mutex mMutex;
+        // Jobs waiting for this one to finish
+        std::vector<std::shared_ptr<Job>> mContinuations;
+        std::exception_ptr mError;
+        // Dependencies not finished yet, plus one while the job is being scheduled
+        std::atomic<size_t> mPendingDependencies = 1;
+        std::atomic<bool> mFinished = false;
+
+    public:
+        bool IsFinished() const { return mFinished.load(std::memory_order_acquire); }
+    };
+    using JobHandle = std::shared_ptr<Job>;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    // One per worker; index 0 is shared by threads outside the pool
+    std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+    std::vector<std::thread> mWorkers;
+
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;
+    // Jobs in any queue, so that idle workers know when to look again
+    std::atomic<size_t> mQueuedJobs = 0;
+    // Jobs in queue 0, the only ones threads outside the pool look at
+    std::atomic<size_t> mSharedQueuedJobs = 0;
+    // Threads sleeping in Wait(), which need a notification whenever a job finishes
+    std::atomic<int> mBlockedWaiters = 0;
+    bool mStopping = false;
+
+public:
+    /// `workerCount` of 0 uses one worker per core besides the calling thread (at least one).
+    explicit JobSystem(int workerCount = 0);
+    /// Runs every job still queued, then stops the workers.
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    /// Pool shared by the loader, the rasterizer and the image writers, created on first use.
+    static JobSystem& Global();
+
+    /// Threads that run jobs when a thread outside the pool waits: the workers plus the waiting thread.
+    int GetConcurrency() const { return static_cast<int>(mWorkers.size()) + 1; }
+
+    /// Runs `func` once every job in `dependencies` has finished. If any dependency threw, `func` is skipped
+    /// and the job fails with the same exception.
+    JobHandle Schedule(std::function<void()> func, const std::vector<JobHandle>& dependencies = {});
+    /// Runs other jobs until `job` has finished, then rethrows its exception if it threw.
+    void Wait(const JobHandle& job);
+
+    /// Runs `func(i)` for every i in [0, count) on up to `maxConcurrency` threads (0 for GetConcurrency()),
+    /// the calling thread included. If any calls throw, the exception of the lowest i is rethrown, so that
+    /// errors are the same regardless of scheduling.
+    template <class TFunc>
+    void ParallelFor(size_t count, int maxConcurrency, TFunc&& func);
+
+private:
+    void WorkerMain(size_t index);
+    void Enqueue(JobHandle job);
+    JobHandle TryPop();
+    void Execute(const JobHandle& job);
+    void Finish(const JobHandle& job);
+};
+
+template <class TFunc>
+void JobSystem::ParallelFor(size_t count, int maxConcurrency, TFunc&& func) {
+    if (maxConcurrency <= 0) {
+        maxConcurrency = GetConcurrency();
+    }
+
+    std::vector<std::exception_ptr> errors(count);
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+            try {
+                func(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    // Helpers that start after the work ran out return right away, so it's fine to ask for more than are idle
+    std::vector<JobHandle> helpers;
+    size_t helperCount = std::min<size_t>({ static_cast<size_t>(maxConcurrency), count, mWorkers.size() + 1 });
+    for (size_t t = 1; t < helperCount; ++t) {
+        helpers.push_back(Schedule(worker));
+    }
+    worker();
+    for (auto& helper : helpers) {
+        Wait(helper);
+    }
+
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+/// JobSystem::Global().ParallelFor(), see there.
+template <class TFunc>
+void ParallelFor(size_t count, int maxConcurrency, TFunc&& func) {
+    JobSystem::Global().ParallelFor(count, maxConcurrency, std::forward<TFunc>(func));
+}
@@ -0,0 +1,121 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+MappedFile::MappedFile(const char* path, Access access) {
+    DWORD flags = access == Access::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open " + std::string(path));
+    }
+    mFile = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        Close();
+        throw std::runtime_error("Failed to query size of " + std::string(path));
+    }
+    mSize = static_cast<size_t>(size.QuadPart);
+    // Mapping an empty file is an error on Windows, but an empty view is perfectly usable
+    if (mSize == 0) return;
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        Close();
+        throw std::runtime_error("Failed to map " + std::string(path));
+    }
+    mMapping = mapping;
+
+    mData = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!mData) {
+        Close();
+        throw std::runtime_error("Failed to map " + std::string(path));
+    }
+}
+
+void MappedFile::Close() noexcept {
+    if (mData) UnmapViewOfFile(mData);
+    if (mMapping) CloseHandle(mMapping);
+    if (mFile) CloseHandle(mFile);
+    mData = nullptr;
+    mSize = 0;
+    mMapping = nullptr;
+    mFile = nullptr;
+}
+#else
+MappedFile::MappedFile(const char* path, Access access) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to open " + std::string(path));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw std::runtime_error("Failed to query size of " + std::string(path));
+    }
+    mSize = static_cast<size_t>(st.st_size);
+    // mmap() rejects zero-length mappings, but an empty view is perfectly usable
+    if (mSize == 0) {
+        close(fd);
+        return;
+    }
+
+    void* addr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (addr == MAP_FAILED) {
+        mSize = 0;
+        throw std::runtime_error("Failed to map " + std::string(path));
+    }
+    mData = static_cast<const char*>(addr);
+    madvise(addr, mSize, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+
+void MappedFile::Close() noexcept {
+    if (mData) munmap(const_cast<char*>(mData), mSize);
+    mData = nullptr;
+    mSize = 0;
+}
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& that) noexcept
+    : mData{ std::exchange(that.mData, nullptr) }
+    , mSize{ std::exchange(that.mSize, 0) }
+#if defined(_WIN32)
+    , mFile{ std::exchange(that.mFile, nullptr) }
+    , mMapping{ std::exchange(that.mMapping, nullptr) }
+#endif
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& that) noexcept {
+    if (this != &that) {
+        Close();
+        mData = std::exchange(that.mData, nullptr);
+        mSize = std::exchange(that.mSize, 0);
+#if defined(_WIN32)
+        mFile = std::exchange(that.mFile, nullptr);
+        mMapping = std::exchange(that.mMapping, nullptr);
+#endif
+    }
+    return *this;
+}
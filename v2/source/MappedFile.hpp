@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+/// Read-only memory mapping of an entire file.
+class MappedFile {
+private:
+    const char* mData = nullptr;
+    size_t mSize = 0;
+#if defined(_WIN32)
+    void* mFile = nullptr;
+    void* mMapping = nullptr;
+#endif
+
+public:
+    /// Hint for the OS paging policy.
+    enum class Access {
+        Sequential,
+        Random,
+    };
+
+    MappedFile() = default;
+    /// Throws std::runtime_error if the file cannot be opened or mapped.
+    explicit MappedFile(const char* path, Access access = Access::Sequential);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& that) noexcept;
+    MappedFile& operator=(MappedFile&& that) noexcept;
+
+    const char* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+    std::string_view AsStringView() const { return { mData, mSize }; }
+
+private:
+    void Close() noexcept;
+};
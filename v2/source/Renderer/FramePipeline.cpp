@@ -0,0 +1,46 @@
+#include "FramePipeline.hpp"
+
+#include "JobSystem.hpp"
+#include "Renderer/Scene.hpp"
+#include "ScopeGuard.hpp"
+
+FramePipeline::FramePipeline(Rasterizer& rasterizer)
+    : mRasterizer{ &rasterizer } {
+}
+
+void FramePipeline::Render(const Mesh& mesh, Size2<int> dimensions, int frameCount, const CameraFunc& cameraOf, const BeginFrameFunc& beginFrame, const EndFrameFunc& endFrame, const ShadowMap* shadowMap) {
+    if (frameCount <= 0) return;
+
+    auto& jobs = JobSystem::Global();
+    const Camera* lightCamera = shadowMap ? &shadowMap->lightCamera : nullptr;
+    auto prepare = [&](int frame) {
+        Rasterizer::PrepareMesh(cameraOf(frame), mesh, dimensions, lightCamera, mPrepared[frame % 2]);
+    };
+
+    // Nothing to overlap the first frame's geometry with
+    prepare(0);
+
+    JobSystem::JobHandle next;
+    // The job refers to this frame's locals, it must finish before they go away
+    DEFER {
+        try {
+            jobs.Wait(next);
+        } catch (...) {
+        }
+    };
+
+    for (int i = 0; i < frameCount; ++i) {
+        jobs.Wait(next);
+        next = nullptr;
+
+        // mPrepared[(i + 1) % 2] was last drawn by frame i - 1, which is done
+        if (i + 1 < frameCount) {
+            next = jobs.Schedule([&prepare, i]() { prepare(i + 1); });
+        }
+
+        auto& fb = beginFrame(i);
+        mRasterizer->SetTarget(&fb);
+        mRasterizer->DrawPrepared(mPrepared[i % 2], shadowMap);
+        endFrame(i, fb);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Renderer/Rasterizer.hpp"
+#include "Size.hpp"
+#include "all_fwd.hpp"
+
+#include <functional>
+
+/// Renders a sequence of frames of one mesh, preparing the geometry of frame N+1 (see Rasterizer::PrepareMesh())
+/// on JobSystem::Global() while frame N is rasterized. The transformed positions and triangle bins are double
+/// buffered, so neither stage waits for the other unless one of them is slower.
+class FramePipeline {
+public:
+    /// Camera of a frame. Called on job system threads, possibly while the previous frame is being drawn.
+    using CameraFunc = std::function<Camera(int frame)>;
+    /// Framebuffer to draw a frame into, already cleared and of the dimensions given to Render().
+    using BeginFrameFunc = std::function<FrameBuffer&(int frame)>;
+    /// Called once a frame has been drawn into the framebuffer returned by BeginFrameFunc.
+    using EndFrameFunc = std::function<void(int frame, FrameBuffer& fb)>;
+
+private:
+    Rasterizer* mRasterizer;
+    PreparedMesh mPrepared[2];
+
+public:
+    explicit FramePipeline(Rasterizer& rasterizer);
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    /// Draws frames [0, frameCount) in order, each like Rasterizer::DrawMesh() with the frame's camera. The begin
+    /// and end callbacks run on the calling thread. If anything throws, the frame being prepared is waited for
+    /// and the first error is rethrown.
+    void Render(const Mesh& mesh, Size2<int> dimensions, int frameCount, const CameraFunc& cameraOf, const BeginFrameFunc& beginFrame, const EndFrameFunc& endFrame, const ShadowMap* shadowMap = nullptr);
+};
@@ -0,0 +1,296 @@
+#include "FrameStream.hpp"
+
+#include "Color.hpp"
+#include "Renderer/Rasterizer.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#    include <fcntl.h>
+#    include <io.h>
+#else
+#    include <csignal>
+#    include <fcntl.h>
+#    include <sys/stat.h>
+#    include <sys/uio.h>
+#    include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#    include <emmintrin.h>
+#    define SRENDER_SSE2 1
+#endif
+
+namespace {
+// Pipes default to 64 KiB on Linux, i.e. dozens of context switches per frame
+constexpr int kPipeBufferSize = 1 << 20;
+
+// BT.601 limited range RGB -> YCbCr, with 8 fractional bits. The SIMD paths below compute exactly the same values.
+int LumaOf(int r, int g, int b) {
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+int BlueDifferenceOf(int r, int g, int b) {
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+int RedDifferenceOf(int r, int g, int b) {
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+#if SRENDER_SSE2
+/// Channel at byte `shift / 8` of 8 pixels, as 16-bit lanes.
+__m128i ExtractChannel(__m128i pixels0123, __m128i pixels4567, int shift) {
+    __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i lo = _mm_and_si128(_mm_srl_epi32(pixels0123, _mm_cvtsi32_si128(shift)), mask);
+    __m128i hi = _mm_and_si128(_mm_srl_epi32(pixels4567, _mm_cvtsi32_si128(shift)), mask);
+    return _mm_packs_epi32(lo, hi);
+}
+
+__m128i Load(const RgbaColor* pixels) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+}
+
+/// 2x2 sums of one channel for 8 chroma samples, i.e. 16 pixels of `row0` and `row1` each.
+__m128i SumQuads(const RgbaColor* row0, const RgbaColor* row1, int shift) {
+    __m128i ones = _mm_set1_epi16(1);
+    __m128i pairs[2];
+    for (int half = 0; half < 2; ++half) {
+        const RgbaColor* p0 = row0 + half * 8;
+        const RgbaColor* p1 = row1 + half * 8;
+        __m128i vertical = _mm_add_epi16(
+            ExtractChannel(Load(p0), Load(p0 + 4), shift),
+            ExtractChannel(Load(p1), Load(p1 + 4), shift));
+        // Adds horizontally neighboring lanes
+        pairs[half] = _mm_madd_epi16(vertical, ones);
+    }
+    return _mm_packs_epi32(pairs[0], pairs[1]);
+}
+
+/// Signed (c0 * r + c1 * g + c2 * b + 128) >> 8, plus 128. Every intermediate fits into 16 bits.
+__m128i ChromaOf(__m128i r, __m128i g, __m128i b, int c0, int c1, int c2) {
+    __m128i sum = _mm_add_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(c0)), _mm_mullo_epi16(g, _mm_set1_epi16(c1))),
+        _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(c2)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+#endif
+
+void ConvertLumaRow(const RgbaColor* src, int width, uint8_t* dst) {
+    int x = 0;
+#if SRENDER_SSE2
+    for (; x + 8 <= width; x += 8) {
+        __m128i p0 = Load(src + x);
+        __m128i p1 = Load(src + x + 4);
+        __m128i r = ExtractChannel(p0, p1, 0);
+        __m128i g = ExtractChannel(p0, p1, 8);
+        __m128i b = ExtractChannel(p0, p1, 16);
+        // 66r + 129g + 25b + 128 can exceed 32767, but not 65535, so wrap around and shift logically
+        __m128i sum = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+            _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+        __m128i y = _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(y, y));
+    }
+#endif
+    for (; x < width; ++x) {
+        dst[x] = static_cast<uint8_t>(LumaOf(src[x].r, src[x].g, src[x].b));
+    }
+}
+
+/// Averages each 2x2 block of `row0` and `row1` (the same row for an odd last row) into one chroma sample. An
+/// odd last column is averaged with itself.
+void ConvertChromaRow(const RgbaColor* row0, const RgbaColor* row1, int width, uint8_t* dstU, uint8_t* dstV) {
+    int chromaWidth = (width + 1) / 2;
+    int cx = 0;
+#if SRENDER_SSE2
+    for (; cx * 2 + 16 <= width; cx += 8) {
+        int x = cx * 2;
+        __m128i two = _mm_set1_epi16(2);
+        __m128i r = _mm_srli_epi16(_mm_add_epi16(SumQuads(row0 + x, row1 + x, 0), two), 2);
+        __m128i g = _mm_srli_epi16(_mm_add_epi16(SumQuads(row0 + x, row1 + x, 8), two), 2);
+        __m128i b = _mm_srli_epi16(_mm_add_epi16(SumQuads(row0 + x, row1 + x, 16), two), 2);
+        __m128i u = ChromaOf(r, g, b, -38, -74, 112);
+        __m128i v = ChromaOf(r, g, b, 112, -94, -18);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dstU + cx), _mm_packus_epi16(u, u));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dstV + cx), _mm_packus_epi16(v, v));
+    }
+#endif
+    for (; cx < chromaWidth; ++cx) {
+        int x0 = cx * 2;
+        int x1 = std::min(x0 + 1, width - 1);
+        int r = (row0[x0].r + row0[x1].r + row1[x0].r + row1[x1].r + 2) >> 2;
+        int g = (row0[x0].g + row0[x1].g + row1[x0].g + row1[x1].g + 2) >> 2;
+        int b = (row0[x0].b + row0[x1].b + row1[x0].b + row1[x1].b + 2) >> 2;
+        dstU[cx] = static_cast<uint8_t>(BlueDifferenceOf(r, g, b));
+        dstV[cx] = static_cast<uint8_t>(RedDifferenceOf(r, g, b));
+    }
+}
+
+std::runtime_error MakeSystemError(const char* what) {
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+} // namespace
+
+FrameStream::FrameStream(const char* path, Format format, Size2<int> dimensions, int frameRate)
+    : mDimensions{ dimensions }
+    , mFormat{ format } {
+    if (dimensions.width <= 0 || dimensions.height <= 0) {
+        throw std::runtime_error("Cannot stream empty frames");
+    }
+
+    if (path == kStdout) {
+        // Anything already printed must come before the stream
+        fflush(stdout);
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+        mFd = _fileno(stdout);
+#else
+        mFd = STDOUT_FILENO;
+#endif
+    } else {
+#if defined(_WIN32)
+        mFd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+        mFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (mFd == -1) {
+            throw MakeSystemError(("Failed to open " + std::string(path)).c_str());
+        }
+        mOwnsFd = true;
+    }
+
+#if !defined(_WIN32)
+    // A reader that goes away should surface as an EPIPE error from WriteFrame(), rather than killing the process
+    std::signal(SIGPIPE, SIG_IGN);
+#    if defined(F_SETPIPE_SZ)
+    struct stat st;
+    if (fstat(mFd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        // Best effort, the system limit may be lower
+        fcntl(mFd, F_SETPIPE_SZ, kPipeBufferSize);
+    }
+#    endif
+#endif
+
+    if (format == Format::Y4m) {
+        int chromaSize = ((dimensions.width + 1) / 2) * ((dimensions.height + 1) / 2);
+        mPlanes.resize(static_cast<size_t>(dimensions.Area()) + chromaSize * 2);
+
+        char header[128];
+        int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", dimensions.width, dimensions.height, frameRate);
+        Buffer buffer{ header, static_cast<size_t>(length) };
+        WriteAll(&buffer, 1);
+    }
+}
+
+FrameStream::~FrameStream() {
+    if (mOwnsFd) {
+#if defined(_WIN32)
+        _close(mFd);
+#else
+        close(mFd);
+#endif
+    }
+}
+
+FrameStream::Format FrameStream::ParseFormat(std::string_view name) {
+    std::string lower;
+    for (char c : name) {
+        lower.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    }
+    if (lower == "raw") return Format::RawRgba;
+    if (lower == "y4m") return Format::Y4m;
+    throw std::runtime_error("Unknown stream format " + std::string(name));
+}
+
+void FrameStream::WriteFrame(const FrameBuffer& fb) {
+    if (fb.dimensions.width != mDimensions.width || fb.dimensions.height != mDimensions.height) {
+        throw std::runtime_error("Frame dimensions do not match the stream");
+    }
+
+    switch (mFormat) {
+        case Format::RawRgba: {
+            // Straight out of the framebuffer, without a copy
+            Buffer buffer{ fb.pixels.data(), fb.pixels.size() * sizeof(RgbaColor) };
+            WriteAll(&buffer, 1);
+        } break;
+
+        case Format::Y4m: {
+            int width = mDimensions.width;
+            int height = mDimensions.height;
+            int chromaWidth = (width + 1) / 2;
+            int chromaHeight = (height + 1) / 2;
+            uint8_t* planeY = mPlanes.data();
+            uint8_t* planeU = planeY + static_cast<size_t>(width) * height;
+            uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * chromaHeight;
+
+            const RgbaColor* pixels = fb.pixels.data();
+            for (int y = 0; y < height; ++y) {
+                ConvertLumaRow(pixels + static_cast<size_t>(y) * width, width, planeY + static_cast<size_t>(y) * width);
+            }
+            for (int cy = 0; cy < chromaHeight; ++cy) {
+                const RgbaColor* row0 = pixels + static_cast<size_t>(cy * 2) * width;
+                const RgbaColor* row1 = cy * 2 + 1 < height ? row0 + width : row0;
+                size_t offset = static_cast<size_t>(cy) * chromaWidth;
+                ConvertChromaRow(row0, row1, width, planeU + offset, planeV + offset);
+            }
+
+            static constexpr char kFrameHeader[] = "FRAME\n";
+            Buffer buffers[] = {
+                { kFrameHeader, sizeof(kFrameHeader) - 1 },
+                { mPlanes.data(), mPlanes.size() },
+            };
+            WriteAll(buffers, std::size(buffers));
+        } break;
+    }
+}
+
+void FrameStream::WriteAll(const Buffer* buffers, size_t count) {
+#if defined(_WIN32)
+    for (size_t i = 0; i < count; ++i) {
+        auto data = static_cast<const char*>(buffers[i].data);
+        size_t remaining = buffers[i].size;
+        while (remaining > 0) {
+            unsigned chunk = static_cast<unsigned>(std::min<size_t>(remaining, 1u << 30));
+            int written = _write(mFd, data, chunk);
+            if (written < 0) throw MakeSystemError("Failed to write frame");
+            data += written;
+            remaining -= written;
+        }
+    }
+#else
+    // One writev() per frame; partial writes (common on pipes) resume where they stopped
+    constexpr size_t kMaxBuffers = 4;
+    iovec iov[kMaxBuffers];
+    size_t iovCount = std::min(count, kMaxBuffers);
+    for (size_t i = 0; i < iovCount; ++i) {
+        iov[i].iov_base = const_cast<void*>(buffers[i].data);
+        iov[i].iov_len = buffers[i].size;
+    }
+
+    iovec* next = iov;
+    while (iovCount > 0) {
+        ssize_t written = writev(mFd, next, static_cast<int>(iovCount));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw MakeSystemError("Failed to write frame");
+        }
+        auto advance = static_cast<size_t>(written);
+        while (iovCount > 0 && advance >= next->iov_len) {
+            advance -= next->iov_len;
+            ++next;
+            --iovCount;
+        }
+        if (iovCount > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + advance;
+            next->iov_len -= advance;
+        }
+    }
+#endif
+}
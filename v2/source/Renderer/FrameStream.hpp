@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Size.hpp"
+#include "all_fwd.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/// Writes a sequence of uncompressed frames into a single stream (stdout, a named pipe or a file), for
+/// piping straight into an external video encoder.
+class FrameStream {
+public:
+    enum class Format {
+        /// Bare RGBA8 frames back to back, e.g. for `ffmpeg -f rawvideo -pix_fmt rgba -s WxH -i -`.
+        RawRgba,
+        /// YUV4MPEG2 with 4:2:0 chroma (BT.601, limited range), which most encoders read without options.
+        Y4m,
+    };
+
+    // Path that selects standard output
+    static constexpr std::string_view kStdout = "-";
+
+private:
+    std::vector<uint8_t> mPlanes;
+    Size2<int> mDimensions;
+    Format mFormat;
+    int mFd = -1;
+    bool mOwnsFd = false;
+
+public:
+    /// Opens `path` (or stdout for kStdout) and writes the stream header. Throws std::runtime_error on failure.
+    FrameStream(const char* path, Format format, Size2<int> dimensions, int frameRate = 30);
+    ~FrameStream();
+
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    /// Picks the format from the name (case-insensitive) "raw" or "y4m". Throws std::runtime_error otherwise.
+    static Format ParseFormat(std::string_view name);
+
+    /// `fb` must have the dimensions given to the constructor. Throws std::runtime_error if the reader is gone
+    /// or the write fails.
+    void WriteFrame(const FrameBuffer& fb);
+
+private:
+    struct Buffer {
+        const void* data;
+        size_t size;
+    };
+    void WriteAll(const Buffer* buffers, size_t count);
+};
@@ -0,0 +1,64 @@
+#include "FrameWriter.hpp"
+
+#include "Renderer/ImageWriter.hpp"
+
+#include <algorithm>
+#include <utility>
+
+FrameWriter::FrameWriter(int ringSize, int encoderThreads)
+    : mSlots(std::max(ringSize, 1))
+    , mEncoderThreads{ encoderThreads } {
+}
+
+FrameWriter::~FrameWriter() {
+    // Write jobs never throw, errors are kept in mError instead
+    JobSystem::Global().Wait(mLastJob);
+}
+
+FrameBuffer& FrameWriter::AcquireFrame() {
+    auto& slot = mSlots[mHead];
+    if (slot.job) {
+        // Runs other jobs meanwhile, possibly this very write
+        JobSystem::Global().Wait(slot.job);
+        slot.job = nullptr;
+    }
+    RethrowError();
+    return slot.frame;
+}
+
+void FrameWriter::SubmitFrame(std::string path) {
+    RethrowError();
+    auto& slot = mSlots[mHead];
+    slot.path = std::move(path);
+    slot.job = JobSystem::Global().Schedule([this, &slot]() { WriteSlot(slot); }, { mLastJob });
+    mLastJob = slot.job;
+    mHead = (mHead + 1) % mSlots.size();
+}
+
+void FrameWriter::Flush() {
+    JobSystem::Global().Wait(mLastJob);
+    RethrowError();
+}
+
+void FrameWriter::WriteSlot(Slot& slot) {
+    {
+        // Skip the rest once something failed
+        std::lock_guard<std::mutex> lock(mErrorMutex);
+        if (mError) return;
+    }
+
+    try {
+        ImageWriter::WriteFile(slot.frame, slot.path.c_str(), slot.encoded, mEncoderThreads);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mErrorMutex);
+        if (!mError) mError = std::current_exception();
+    }
+}
+
+void FrameWriter::RethrowError() {
+    std::lock_guard<std::mutex> lock(mErrorMutex);
+    if (mError) {
+        // Report each failure once
+        std::rethrow_exception(std::exchange(mError, nullptr));
+    }
+}
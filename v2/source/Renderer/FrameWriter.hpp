@@ -0,0 +1,66 @@
+#pragma once
+
+#include "JobSystem.hpp"
+#include "Renderer/Rasterizer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Encodes and writes frames as jobs on JobSystem::Global(), so that frame N goes to disk while frame N+1
+/// renders. Each write job continues the previous one, so frames are written one at a time and in order.
+///
+/// Frames live in a fixed ring of framebuffers. AcquireFrame() blocks while every buffer is still waiting to
+/// be written, which keeps memory bounded when the disk is slower than the renderer.
+class FrameWriter {
+public:
+    // One frame rendering while the previous one is written
+    static constexpr int kDefaultRingSize = 2;
+
+private:
+    struct Slot {
+        FrameBuffer frame;
+        std::string path;
+        // Encoded file contents, kept around to reuse the allocation
+        std::vector<uint8_t> encoded;
+        // Pending write of this slot, if any
+        JobSystem::JobHandle job;
+    };
+
+    std::vector<Slot> mSlots;
+    int mEncoderThreads;
+    // Slot handed out by AcquireFrame() next
+    size_t mHead = 0;
+    // Most recently submitted write
+    JobSystem::JobHandle mLastJob;
+
+    std::mutex mErrorMutex;
+    // First failure of a write job, rethrown on the rendering thread
+    std::exception_ptr mError;
+
+public:
+    /// `encoderThreads` is passed on to ImageWriter::Encode(), 0 for all threads of the job system.
+    explicit FrameWriter(int ringSize = kDefaultRingSize, int encoderThreads = 0);
+    /// Finishes writing every submitted frame. Errors are dropped here, call Flush() first to see them.
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    /// Returns a framebuffer to render the next frame into, waiting for one to be written if the ring is full.
+    /// The framebuffer keeps whatever it held last, so it must be cleared before use.
+    FrameBuffer& AcquireFrame();
+    /// Queues the framebuffer returned by the last AcquireFrame() to be written to `path`, in the format given
+    /// by its extension (see ImageWriter::FormatFromPath()).
+    void SubmitFrame(std::string path);
+    /// Waits for every submitted frame to be written. If writing any of them failed, the first error is
+    /// rethrown.
+    void Flush();
+
+private:
+    void WriteSlot(Slot& slot);
+    void RethrowError();
+};
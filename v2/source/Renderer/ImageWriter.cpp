@@ -0,0 +1,711 @@
+#include "ImageWriter.hpp"
+
+#include "Color.hpp"
+#include "JobSystem.hpp"
+#include "Renderer/Rasterizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#    include <emmintrin.h>
+#    define SRENDER_SSE2 1
+#endif
+
+namespace {
+void AppendU32BE(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint8_t* PutU32BE(uint8_t* p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+    return p + 4;
+}
+
+void CheckDimensions(const FrameBuffer& fb) {
+    if (fb.dimensions.width <= 0 || fb.dimensions.height <= 0) {
+        throw std::runtime_error("Cannot encode an empty framebuffer");
+    }
+}
+
+// QOI, see https://qoiformat.org/qoi-specification.pdf
+
+constexpr uint8_t kQoiOpIndex = 0x00;
+constexpr uint8_t kQoiOpDiff = 0x40;
+constexpr uint8_t kQoiOpLuma = 0x80;
+constexpr uint8_t kQoiOpRun = 0xC0;
+constexpr uint8_t kQoiOpRgb = 0xFE;
+constexpr uint8_t kQoiOpRgba = 0xFF;
+constexpr int kQoiMaxRun = 62;
+constexpr size_t kQoiHeaderSize = 14;
+constexpr uint8_t kQoiEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+uint32_t PackPixel(RgbaColor color) {
+    uint32_t packed;
+    std::memcpy(&packed, &color, sizeof(packed));
+    return packed;
+}
+
+int QoiHash(RgbaColor c) {
+    return (c.r * 3 + c.g * 5 + c.b * 7 + c.a * 11) % 64;
+}
+
+// PNG
+
+constexpr uint8_t kPngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+constexpr size_t kPngBytesPerPixel = 4;
+// Leaves headroom under the 2^31-1 limit of the chunk length field
+constexpr size_t kMaxChunkBytes = 1 << 30;
+// Strips smaller than this lose too much compression to the dictionary reset at every strip boundary
+constexpr size_t kMinStripBytes = 256 * 1024;
+
+const std::array<uint32_t, 256>& CrcTable() {
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> result;
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            result[n] = c;
+        }
+        return result;
+    }();
+    return table;
+}
+
+uint32_t Crc32(const uint8_t* data, size_t size) {
+    auto& table = CrcTable();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+constexpr uint32_t kAdlerBase = 65521;
+
+uint32_t Adler32(const uint8_t* data, size_t size) {
+    // Largest n such that 255n(n+1)/2 + (n+1)(kAdlerBase-1) fits in 32 bits, i.e. how long the modulo can wait
+    constexpr size_t kMaxDeferred = 5552;
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (size > 0) {
+        size_t n = std::min(size, kMaxDeferred);
+        for (size_t i = 0; i < n; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= kAdlerBase;
+        b %= kAdlerBase;
+        data += n;
+        size -= n;
+    }
+    return (b << 16) | a;
+}
+
+/// Checksum of the concatenation of two buffers, given the checksums of each and the size of the second.
+uint32_t Adler32Combine(uint32_t first, uint32_t second, size_t secondSize) {
+    uint32_t rem = static_cast<uint32_t>(secondSize % kAdlerBase);
+    uint32_t a = first & 0xFFFF;
+    uint32_t b = static_cast<uint32_t>((static_cast<uint64_t>(rem) * a) % kAdlerBase);
+    a += (second & 0xFFFF) + kAdlerBase - 1;
+    b += (first >> 16) + (second >> 16) + kAdlerBase - rem;
+    if (a >= kAdlerBase) a -= kAdlerBase;
+    if (a >= kAdlerBase) a -= kAdlerBase;
+    if (b >= kAdlerBase * 2) b -= kAdlerBase * 2;
+    if (b >= kAdlerBase) b -= kAdlerBase;
+    return (b << 16) | a;
+}
+
+/// Appends bits least significant first, as deflate wants them.
+class BitWriter {
+private:
+    std::vector<uint8_t>& mOut;
+    uint64_t mBits = 0;
+    int mCount = 0;
+
+public:
+    explicit BitWriter(std::vector<uint8_t>& out)
+        : mOut{ out } {
+    }
+
+    void Put(uint32_t bits, int count) {
+        mBits |= static_cast<uint64_t>(bits) << mCount;
+        mCount += count;
+        while (mCount >= 8) {
+            mOut.push_back(static_cast<uint8_t>(mBits));
+            mBits >>= 8;
+            mCount -= 8;
+        }
+    }
+
+    void AlignToByte() {
+        if (mCount > 0) Put(0, 8 - mCount);
+    }
+};
+
+/// The fixed Huffman codes of deflate (RFC 1951 3.2.6), bit-reversed so they can go through BitWriter as-is.
+struct FixedCodes {
+    uint16_t literal[288];
+    uint8_t literalBits[288];
+    uint8_t distance[30];
+
+    // Length 3..258 -> symbol, and the number and value of its extra bits
+    uint16_t lengthSymbol[259];
+    uint8_t lengthExtraBits[259];
+    uint8_t lengthExtra[259];
+
+    static uint32_t Reverse(uint32_t code, int bits) {
+        uint32_t result = 0;
+        for (int i = 0; i < bits; ++i) {
+            result = (result << 1) | ((code >> i) & 1);
+        }
+        return result;
+    }
+
+    FixedCodes() {
+        for (int sym = 0; sym < 288; ++sym) {
+            uint32_t code;
+            int bits;
+            if (sym < 144) {
+                code = 0x30 + sym, bits = 8;
+            } else if (sym < 256) {
+                code = 0x190 + (sym - 144), bits = 9;
+            } else if (sym < 280) {
+                code = sym - 256, bits = 7;
+            } else {
+                code = 0xC0 + (sym - 280), bits = 8;
+            }
+            literal[sym] = static_cast<uint16_t>(Reverse(code, bits));
+            literalBits[sym] = static_cast<uint8_t>(bits);
+        }
+        for (int sym = 0; sym < 30; ++sym) {
+            distance[sym] = static_cast<uint8_t>(Reverse(sym, 5));
+        }
+
+        for (int len = 3; len <= 258; ++len) {
+            int v = len - 3;
+            if (len == 258) {
+                lengthSymbol[len] = 285, lengthExtraBits[len] = 0, lengthExtra[len] = 0;
+            } else if (v < 8) {
+                lengthSymbol[len] = static_cast<uint16_t>(257 + v), lengthExtraBits[len] = 0, lengthExtra[len] = 0;
+            } else {
+                // Every group of 4 symbols doubles the span, starting at 8 with 1 extra bit
+                int msb = std::bit_width(static_cast<unsigned>(v)) - 1;
+                int extraBits = msb - 2;
+                int step = (v >> extraBits) & 3;
+                lengthSymbol[len] = static_cast<uint16_t>(257 + 4 * (msb - 1) + step);
+                lengthExtraBits[len] = static_cast<uint8_t>(extraBits);
+                lengthExtra[len] = static_cast<uint8_t>(v - ((4 + step) << extraBits));
+            }
+        }
+    }
+};
+
+const FixedCodes& GetFixedCodes() {
+    static const FixedCodes codes;
+    return codes;
+}
+
+constexpr size_t kWindowSize = 32768;
+constexpr size_t kMinMatch = 3;
+constexpr size_t kMaxMatch = 258;
+constexpr int kHashBits = 15;
+// How many earlier occurrences to try per position; the usual trade between speed and ratio
+constexpr int kMaxChainLength = 16;
+
+uint32_t Hash3(const uint8_t* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+size_t MatchLength(const uint8_t* a, const uint8_t* b, size_t limit) {
+    size_t len = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        while (len + 8 <= limit) {
+            uint64_t x, y;
+            std::memcpy(&x, a + len, 8);
+            std::memcpy(&y, b + len, 8);
+            if (uint64_t diff = x ^ y) return len + std::countr_zero(diff) / 8;
+            len += 8;
+        }
+    }
+    while (len < limit && a[len] == b[len]) {
+        ++len;
+    }
+    return len;
+}
+
+constexpr size_t kMaxStoredBlock = 65535;
+
+/// Writes `data` as uncompressed deflate blocks, which start and end byte aligned.
+void StoreStrip(const uint8_t* data, size_t size, bool last, std::vector<uint8_t>& out) {
+    do {
+        size_t n = std::min(size, kMaxStoredBlock);
+        size -= n;
+        // BFINAL and BTYPE = stored, padded to a byte
+        out.push_back(last && size == 0 ? 1 : 0);
+        out.push_back(static_cast<uint8_t>(n));
+        out.push_back(static_cast<uint8_t>(n >> 8));
+        out.push_back(static_cast<uint8_t>(~n));
+        out.push_back(static_cast<uint8_t>(~n >> 8));
+        out.insert(out.end(), data, data + n);
+        data += n;
+    } while (size > 0);
+}
+
+/// Compresses `data` into a single fixed-Huffman deflate block, with LZ77 matches found through hash chains.
+/// Unless `last` is set, the block is followed by an empty stored block (a "sync flush"), which leaves the
+/// stream byte aligned, so independently compressed strips can be concatenated into one valid stream. Falls back
+/// to stored blocks when compressing would not help.
+void DeflateStrip(const uint8_t* data, size_t size, bool last, std::vector<uint8_t>& out) {
+    auto& codes = GetFixedCodes();
+    size_t start = out.size();
+    BitWriter bits(out);
+    bits.Put(last ? 1 : 0, 1); // BFINAL
+    bits.Put(1, 2); // BTYPE = fixed Huffman
+
+    std::vector<int32_t> head(size_t(1) << kHashBits, -1);
+    std::vector<int32_t> prev(kWindowSize);
+    auto insert = [&](size_t pos) {
+        uint32_t h = Hash3(data + pos);
+        prev[pos & (kWindowSize - 1)] = head[h];
+        head[h] = static_cast<int32_t>(pos);
+    };
+
+    size_t i = 0;
+    while (i + kMinMatch <= size) {
+        size_t limit = std::min(kMaxMatch, size - i);
+        size_t bestLen = 0;
+        size_t bestDist = 0;
+        int32_t candidate = head[Hash3(data + i)];
+        for (int chain = kMaxChainLength; candidate >= 0 && chain > 0; --chain) {
+            size_t dist = i - static_cast<size_t>(candidate);
+            if (dist > kWindowSize) break;
+            // Cheap rejection: a longer match must at least agree at the current best length
+            if (data[candidate + bestLen] == data[i + bestLen]) {
+                size_t len = MatchLength(data + candidate, data + i, limit);
+                if (len > bestLen) {
+                    bestLen = len;
+                    bestDist = dist;
+                    if (len == limit) break;
+                }
+            }
+            candidate = prev[candidate & (kWindowSize - 1)];
+        }
+
+        if (bestLen >= kMinMatch) {
+            uint16_t sym = codes.lengthSymbol[bestLen];
+            bits.Put(codes.literal[sym], codes.literalBits[sym]);
+            bits.Put(codes.lengthExtra[bestLen], codes.lengthExtraBits[bestLen]);
+
+            uint32_t v = static_cast<uint32_t>(bestDist - 1);
+            if (v < 4) {
+                bits.Put(codes.distance[v], 5);
+            } else {
+                // Same doubling scheme as the lengths, 2 symbols per power of two
+                int msb = std::bit_width(v) - 1;
+                int extraBits = msb - 1;
+                uint32_t step = (v >> extraBits) & 1;
+                bits.Put(codes.distance[2 * msb + step], 5);
+                bits.Put(v - ((2 + step) << extraBits), extraBits);
+            }
+
+            size_t end = i + bestLen;
+            for (; i < end; ++i) {
+                if (i + kMinMatch <= size) insert(i);
+            }
+        } else {
+            insert(i);
+            bits.Put(codes.literal[data[i]], codes.literalBits[data[i]]);
+            ++i;
+        }
+    }
+    for (; i < size; ++i) {
+        bits.Put(codes.literal[data[i]], codes.literalBits[data[i]]);
+    }
+    bits.Put(codes.literal[256], codes.literalBits[256]); // End of block
+
+    if (!last) {
+        bits.Put(0, 3); // Non-final stored block
+        bits.AlignToByte();
+        const uint8_t kEmptyStored[4] = { 0x00, 0x00, 0xFF, 0xFF };
+        out.insert(out.end(), std::begin(kEmptyStored), std::end(kEmptyStored));
+    } else {
+        bits.AlignToByte();
+    }
+
+    // Noise-like data grows under the fixed codes (literals above 143 take 9 bits), store it instead
+    size_t storedBlocks = std::max<size_t>(1, (size + kMaxStoredBlock - 1) / kMaxStoredBlock);
+    if (out.size() - start > size + storedBlocks * 5) {
+        out.resize(start);
+        StoreStrip(data, size, last, out);
+    }
+}
+
+uint8_t Paeth(int a, int b, int c) {
+    // |p - a|, |p - b| and |p - c| for p = a + b - c
+    int pa = std::abs(b - c);
+    int pb = std::abs(a - c);
+    int pc = std::abs(a + b - 2 * c);
+    return static_cast<uint8_t>((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c));
+}
+
+#if SRENDER_SSE2
+__m128i Abs16(__m128i v) {
+    return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// SSE2 has no blend instruction, select with and/andnot/or instead
+__m128i Select(__m128i mask, __m128i ifSet, __m128i ifClear) {
+    return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+}
+
+/// Same as Paeth(), on 8 lanes of 16 bits.
+__m128i Paeth16(__m128i a, __m128i b, __m128i c) {
+    __m128i pa = Abs16(_mm_sub_epi16(b, c));
+    __m128i pb = Abs16(_mm_sub_epi16(a, c));
+    __m128i pc = Abs16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+    __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    __m128i notB = _mm_cmpgt_epi16(pb, pc);
+    return Select(notA, Select(notB, c, b), a);
+}
+
+/// Sums of the absolute values of the bytes as signed integers, in the two 64-bit halves.
+__m128i SumAbsSigned(__m128i v) {
+    __m128i zero = _mm_setzero_si128();
+    // As unsigned bytes, |v| is min(v, -v) (including -128, which stays 128)
+    return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+uint32_t HorizontalSum(__m128i v) {
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v) + _mm_cvtsi128_si32(_mm_srli_si128(v, 8)));
+}
+#endif
+
+/// Writes the filter type byte and the filtered row to `out`, picking the filter with the smallest sum of
+/// absolute (signed) differences, as recommended by the PNG specification. `scratch` holds 4 rows.
+void FilterRow(const uint8_t* row, const uint8_t* prior, size_t rowBytes, uint8_t* scratch, uint8_t* out) {
+    constexpr size_t bpp = kPngBytesPerPixel;
+    uint8_t* sub = scratch;
+    uint8_t* up = scratch + rowBytes;
+    uint8_t* average = scratch + rowBytes * 2;
+    uint8_t* paeth = scratch + rowBytes * 3;
+    uint32_t sums[5] = {};
+
+    auto filterByte = [&](size_t i, int a, int c) {
+        int x = row[i];
+        int b = prior[i];
+        sub[i] = static_cast<uint8_t>(x - a);
+        up[i] = static_cast<uint8_t>(x - b);
+        average[i] = static_cast<uint8_t>(x - ((a + b) >> 1));
+        paeth[i] = static_cast<uint8_t>(x - Paeth(a, b, c));
+        sums[0] += std::abs(static_cast<int8_t>(row[i]));
+        sums[1] += std::abs(static_cast<int8_t>(sub[i]));
+        sums[2] += std::abs(static_cast<int8_t>(up[i]));
+        sums[3] += std::abs(static_cast<int8_t>(average[i]));
+        sums[4] += std::abs(static_cast<int8_t>(paeth[i]));
+    };
+
+    // The first pixel has no left neighbour, which the filters treat as 0
+    size_t i = 0;
+    for (; i < std::min(bpp, rowBytes); ++i) {
+        filterByte(i, 0, 0);
+    }
+
+#if SRENDER_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+    __m128i acc[5] = { zero, zero, zero, zero, zero };
+    for (; i + 16 <= rowBytes; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bpp));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i - bpp));
+
+        // _mm_avg_epu8 rounds up, while the filter wants floor((a + b) / 2)
+        __m128i mean = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        __m128i predictorLo = Paeth16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+        __m128i predictorHi = Paeth16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+        __m128i filtered[5] = {
+            x,
+            _mm_sub_epi8(x, a),
+            _mm_sub_epi8(x, b),
+            _mm_sub_epi8(x, mean),
+            _mm_sub_epi8(x, _mm_packus_epi16(predictorLo, predictorHi)),
+        };
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sub + i), filtered[1]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(up + i), filtered[2]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(average + i), filtered[3]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(paeth + i), filtered[4]);
+        for (int f = 0; f < 5; ++f) {
+            acc[f] = _mm_add_epi64(acc[f], SumAbsSigned(filtered[f]));
+        }
+    }
+    for (int f = 0; f < 5; ++f) {
+        sums[f] += HorizontalSum(acc[f]);
+    }
+#endif
+
+    for (; i < rowBytes; ++i) {
+        filterByte(i, row[i - bpp], prior[i - bpp]);
+    }
+
+    const uint8_t* candidates[5] = { row, sub, up, average, paeth };
+    int best = static_cast<int>(std::min_element(std::begin(sums), std::end(sums)) - std::begin(sums));
+    out[0] = static_cast<uint8_t>(best);
+    std::memcpy(out + 1, candidates[best], rowBytes);
+}
+
+struct PngStrip {
+    std::vector<uint8_t> deflated;
+    uint32_t adler;
+    size_t filteredSize;
+};
+
+class PngChunkWriter {
+private:
+    std::vector<uint8_t>& mOut;
+    size_t mStart = 0;
+
+public:
+    explicit PngChunkWriter(std::vector<uint8_t>& out)
+        : mOut{ out } {
+    }
+
+    size_t CurrentSize() const { return mOut.size() - mStart - 8; }
+
+    void Begin(const char type[4]) {
+        mStart = mOut.size();
+        AppendU32BE(mOut, 0);
+        mOut.insert(mOut.end(), type, type + 4);
+    }
+
+    void End() {
+        PutU32BE(mOut.data() + mStart, static_cast<uint32_t>(CurrentSize()));
+        // The CRC covers the type and data, but not the length
+        AppendU32BE(mOut, Crc32(mOut.data() + mStart + 4, mOut.size() - mStart - 4));
+    }
+};
+} // namespace
+
+ImageWriter::Format ImageWriter::FormatFromPath(const char* path) {
+    std::string_view view(path);
+    auto dot = view.find_last_of('.');
+    std::string ext;
+    if (dot != std::string_view::npos) {
+        for (char c : view.substr(dot + 1)) {
+            ext.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+    }
+
+    if (ext == "qoi") return Format::Qoi;
+    if (ext == "png") return Format::Png;
+    throw std::runtime_error("Unknown image format for " + std::string(path));
+}
+
+void ImageWriter::EncodeQoi(const FrameBuffer& fb, std::vector<uint8_t>& out) {
+    CheckDimensions(fb);
+    size_t pixelCount = fb.pixels.size();
+
+    // Worst case is a full RGBA op for every pixel
+    out.resize(kQoiHeaderSize + pixelCount * 5 + sizeof(kQoiEndMarker));
+    uint8_t* p = out.data();
+    std::memcpy(p, "qoif", 4);
+    p = PutU32BE(p + 4, static_cast<uint32_t>(fb.dimensions.width));
+    p = PutU32BE(p, static_cast<uint32_t>(fb.dimensions.height));
+    *p++ = 4; // Channels
+    *p++ = 0; // sRGB with linear alpha
+
+    RgbaColor index[64];
+    std::fill(std::begin(index), std::end(index), RgbaColor(0, 0, 0, 0));
+    RgbaColor prev(0, 0, 0, 255);
+    int run = 0;
+
+    const RgbaColor* pixels = fb.pixels.data();
+    for (size_t i = 0; i < pixelCount; ++i) {
+        RgbaColor px = pixels[i];
+        if (PackPixel(px) == PackPixel(prev)) {
+            if (++run == kQoiMaxRun) {
+                *p++ = static_cast<uint8_t>(kQoiOpRun | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            *p++ = static_cast<uint8_t>(kQoiOpRun | (run - 1));
+            run = 0;
+        }
+
+        int hash = QoiHash(px);
+        if (PackPixel(index[hash]) == PackPixel(px)) {
+            *p++ = static_cast<uint8_t>(kQoiOpIndex | hash);
+        } else {
+            index[hash] = px;
+            if (px.a == prev.a) {
+                // Differences wrap around, so compute them in 8 bits
+                auto vr = static_cast<int8_t>(px.r - prev.r);
+                auto vg = static_cast<int8_t>(px.g - prev.g);
+                auto vb = static_cast<int8_t>(px.b - prev.b);
+                int vgr = vr - vg;
+                int vgb = vb - vg;
+                if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+                    *p++ = static_cast<uint8_t>(kQoiOpDiff | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                } else if (vg >= -32 && vg <= 31 && vgr >= -8 && vgr <= 7 && vgb >= -8 && vgb <= 7) {
+                    *p++ = static_cast<uint8_t>(kQoiOpLuma | (vg + 32));
+                    *p++ = static_cast<uint8_t>((vgr + 8) << 4 | (vgb + 8));
+                } else {
+                    *p++ = kQoiOpRgb;
+                    *p++ = px.r;
+                    *p++ = px.g;
+                    *p++ = px.b;
+                }
+            } else {
+                *p++ = kQoiOpRgba;
+                *p++ = px.r;
+                *p++ = px.g;
+                *p++ = px.b;
+                *p++ = px.a;
+            }
+        }
+        prev = px;
+    }
+    if (run > 0) {
+        *p++ = static_cast<uint8_t>(kQoiOpRun | (run - 1));
+    }
+
+    std::memcpy(p, kQoiEndMarker, sizeof(kQoiEndMarker));
+    p += sizeof(kQoiEndMarker);
+    out.resize(p - out.data());
+}
+
+void ImageWriter::EncodePng(const FrameBuffer& fb, std::vector<uint8_t>& out, int threadCount) {
+    CheckDimensions(fb);
+    if (threadCount <= 0) {
+        threadCount = JobSystem::Global().GetConcurrency();
+    }
+
+    size_t width = fb.dimensions.width;
+    size_t height = fb.dimensions.height;
+    size_t rowBytes = width * kPngBytesPerPixel;
+    auto pixelBytes = reinterpret_cast<const uint8_t*>(fb.pixels.data());
+
+    // Each strip is filtered and deflated on its own; filtering still looks at the row above the strip, so
+    // only the LZ77 window is reset at strip boundaries
+    size_t rowsPerStrip = std::max((height + threadCount * 4 - 1) / (threadCount * 4), kMinStripBytes / rowBytes);
+    rowsPerStrip = std::clamp<size_t>(rowsPerStrip, 1, height);
+    size_t stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+
+    std::vector<PngStrip> strips(stripCount);
+    const std::vector<uint8_t> zeroRow(rowBytes, 0);
+    ParallelFor(stripCount, threadCount, [&](size_t s) {
+        size_t y0 = s * rowsPerStrip;
+        size_t y1 = std::min(height, y0 + rowsPerStrip);
+
+        std::vector<uint8_t> filtered((y1 - y0) * (rowBytes + 1));
+        std::vector<uint8_t> scratch(rowBytes * 4);
+        for (size_t y = y0; y < y1; ++y) {
+            const uint8_t* row = pixelBytes + y * rowBytes;
+            const uint8_t* prior = y > 0 ? row - rowBytes : zeroRow.data();
+            FilterRow(row, prior, rowBytes, scratch.data(), filtered.data() + (y - y0) * (rowBytes + 1));
+        }
+
+        auto& strip = strips[s];
+        strip.deflated.reserve(filtered.size() / 2);
+        DeflateStrip(filtered.data(), filtered.size(), s + 1 == stripCount, strip.deflated);
+        strip.adler = Adler32(filtered.data(), filtered.size());
+        strip.filteredSize = filtered.size();
+    });
+
+    size_t deflatedSize = 0;
+    for (auto& strip : strips) {
+        deflatedSize += strip.deflated.size();
+    }
+
+    out.clear();
+    // Signature, IHDR, zlib header and checksum, IEND, plus a header for every IDAT
+    out.reserve(8 + 25 + 6 + 12 + deflatedSize + (deflatedSize / kMaxChunkBytes + 1) * 12);
+    out.insert(out.end(), std::begin(kPngSignature), std::end(kPngSignature));
+
+    PngChunkWriter chunk(out);
+    chunk.Begin("IHDR");
+    AppendU32BE(out, static_cast<uint32_t>(width));
+    AppendU32BE(out, static_cast<uint32_t>(height));
+    out.push_back(8); // Bit depth
+    out.push_back(6); // Color type: RGBA
+    out.push_back(0); // Compression: deflate
+    out.push_back(0); // Filter method: adaptive
+    out.push_back(0); // No interlacing
+    chunk.End();
+
+    // The zlib stream may be split across IDAT chunks at arbitrary byte positions
+    chunk.Begin("IDAT");
+    auto appendData = [&](const uint8_t* data, size_t size) {
+        while (size > 0) {
+            if (chunk.CurrentSize() == kMaxChunkBytes) {
+                chunk.End();
+                chunk.Begin("IDAT");
+            }
+            size_t n = std::min(size, kMaxChunkBytes - chunk.CurrentSize());
+            out.insert(out.end(), data, data + n);
+            data += n;
+            size -= n;
+        }
+    };
+
+    // CMF: deflate with a 32K window; FLG: no dictionary, fastest level, check bits making the pair divisible by 31
+    const uint8_t kZlibHeader[2] = { 0x78, 0x01 };
+    appendData(kZlibHeader, sizeof(kZlibHeader));
+    uint32_t adler = 1;
+    for (auto& strip : strips) {
+        appendData(strip.deflated.data(), strip.deflated.size());
+        adler = Adler32Combine(adler, strip.adler, strip.filteredSize);
+    }
+    uint8_t adlerBytes[4];
+    PutU32BE(adlerBytes, adler);
+    appendData(adlerBytes, sizeof(adlerBytes));
+    chunk.End();
+
+    chunk.Begin("IEND");
+    chunk.End();
+}
+
+void ImageWriter::Encode(const FrameBuffer& fb, Format format, std::vector<uint8_t>& out, int threadCount) {
+    switch (format) {
+        case Format::Qoi: EncodeQoi(fb, out); break;
+        case Format::Png: EncodePng(fb, out, threadCount); break;
+    }
+}
+
+void ImageWriter::WriteFile(const FrameBuffer& fb, const char* path, int threadCount) {
+    std::vector<uint8_t> encoded;
+    WriteFile(fb, path, encoded, threadCount);
+}
+
+void ImageWriter::WriteFile(const FrameBuffer& fb, const char* path, std::vector<uint8_t>& scratch, int threadCount) {
+    Encode(fb, FormatFromPath(path), scratch, threadCount);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + std::string(path) + " for writing");
+    }
+    file.write(reinterpret_cast<const char*>(scratch.data()), static_cast<std::streamsize>(scratch.size()));
+    if (!file) {
+        throw std::runtime_error("Failed to write " + std::string(path));
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "all_fwd.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/// Encoders that read straight from FrameBuffer::pixels (row-major RGBA8, top row first), without
+/// converting into an intermediate image first.
+namespace ImageWriter {
+enum class Format {
+    /// "Quite OK Image" format, a single fast pass; good for intermediate frames.
+    Qoi,
+    /// Compressed in independent strips on multiple threads; the output is an ordinary PNG.
+    Png,
+};
+
+/// Picks the format from the extension of `path` (case-insensitive). Throws std::runtime_error for unknown
+/// extensions.
+Format FormatFromPath(const char* path);
+
+/// Replaces the contents of `out` with the encoded image, reusing its capacity.
+void EncodeQoi(const FrameBuffer& fb, std::vector<uint8_t>& out);
+/// Runs on up to `threadCount` threads of JobSystem::Global(), 0 for all of them.
+void EncodePng(const FrameBuffer& fb, std::vector<uint8_t>& out, int threadCount = 0);
+void Encode(const FrameBuffer& fb, Format format, std::vector<uint8_t>& out, int threadCount = 0);
+
+/// Encodes in the format implied by the extension of `path` and writes the file. Throws std::runtime_error
+/// on failure.
+void WriteFile(const FrameBuffer& fb, const char* path, int threadCount = 0);
+/// Same as above, encoding into `scratch` so that its capacity can be reused across frames.
+void WriteFile(const FrameBuffer& fb, const char* path, std::vector<uint8_t>& scratch, int threadCount = 0);
+} // namespace ImageWriter
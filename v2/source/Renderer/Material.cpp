@@ -0,0 +1,148 @@
+#include "Material.hpp"
+
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+namespace fs = std::filesystem;
+
+Texture Texture::Load(const char* path) {
+    int width, height, channels;
+    stbi_uc* data = stbi_load(path, &width, &height, &channels, 4);
+    if (!data) {
+        throw std::runtime_error("Failed to decode texture " + std::string(path) + ": " + stbi_failure_reason());
+    }
+
+    Texture texture;
+    texture.dimensions = { width, height };
+    texture.pixels.resize(static_cast<size_t>(width) * height);
+    static_assert(sizeof(RgbaColor) == 4);
+    std::memcpy(texture.pixels.data(), data, texture.pixels.size() * sizeof(RgbaColor));
+    stbi_image_free(data);
+    return texture;
+}
+
+namespace {
+const Texture* LoadLazily(const std::string& path, std::shared_ptr<const Texture>& slot) {
+    if (path.empty()) {
+        return nullptr;
+    }
+    if (!slot) {
+        slot = std::make_shared<Texture>(Texture::Load(path.c_str()));
+    }
+    return slot.get();
+}
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+std::string_view Trim(std::string_view str) {
+    while (!str.empty() && IsSpace(str.front())) str.remove_prefix(1);
+    while (!str.empty() && IsSpace(str.back())) str.remove_suffix(1);
+    return str;
+}
+
+/// Splits off the first whitespace-separated token of `line`.
+std::string_view NextToken(std::string_view& line) {
+    line = Trim(line);
+    size_t end = 0;
+    while (end < line.size() && !IsSpace(line[end])) ++end;
+    auto token = line.substr(0, end);
+    line.remove_prefix(end);
+    return token;
+}
+
+float ParseFloat(std::string_view& line, float fallback) {
+    auto token = NextToken(line);
+    float value;
+    auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    return ec == std::errc() ? value : fallback;
+}
+
+glm::vec3 ParseColor(std::string_view& line) {
+    float r = ParseFloat(line, 0.0f);
+    // A single value means grey
+    float g = ParseFloat(line, r);
+    float b = ParseFloat(line, g);
+    return { r, g, b };
+}
+
+/// The file name of a texture statement is its last token; everything before it is options (-bm 1, -clamp on, ...).
+std::string ResolveMapPath(std::string_view args, const fs::path& directory) {
+    args = Trim(args);
+    size_t start = args.size();
+    while (start > 0 && !IsSpace(args[start - 1])) --start;
+    if (start == args.size()) {
+        return {};
+    }
+    return (directory / fs::path(args.substr(start))).lexically_normal().string();
+}
+} // namespace
+
+const Texture* Material::GetDiffuseMap() const {
+    return LoadLazily(diffuseMapPath, diffuseMap);
+}
+
+const Texture* Material::GetSpecularMap() const {
+    return LoadLazily(specularMapPath, specularMap);
+}
+
+const Texture* Material::GetBumpMap() const {
+    return LoadLazily(bumpMapPath, bumpMap);
+}
+
+void Material::ReadMtlAt(const char* path, std::vector<Material>& out) {
+    MappedFile file(path);
+    auto directory = fs::path(path).parent_path();
+
+    Material* current = nullptr;
+    std::string_view rest = file.AsStringView();
+    while (!rest.empty()) {
+        size_t lineEnd = rest.find('\n');
+        auto line = rest.substr(0, lineEnd);
+        rest.remove_prefix(lineEnd == std::string_view::npos ? rest.size() : lineEnd + 1);
+
+        if (auto comment = line.find('#'); comment != std::string_view::npos) {
+            line = line.substr(0, comment);
+        }
+        auto keyword = NextToken(line);
+        if (keyword == "newmtl") {
+            auto name = Trim(line);
+            auto iter = std::find_if(out.begin(), out.end(), [&](const Material& m) { return m.name == name; });
+            if (iter == out.end()) {
+                current = &out.emplace_back();
+                current->name = std::string(name);
+            } else {
+                current = &*iter;
+            }
+        } else if (!current) {
+            // Statements before the first newmtl have nothing to apply to
+        } else if (keyword == "Ka") {
+            current->ambient = ParseColor(line);
+        } else if (keyword == "Kd") {
+            current->diffuse = ParseColor(line);
+        } else if (keyword == "Ks") {
+            current->specular = ParseColor(line);
+        } else if (keyword == "Ns") {
+            current->shininess = ParseFloat(line, 0.0f);
+        } else if (keyword == "d") {
+            current->opacity = ParseFloat(line, 1.0f);
+        } else if (keyword == "Tr") {
+            current->opacity = 1.0f - ParseFloat(line, 0.0f);
+        } else if (keyword == "map_Kd") {
+            current->diffuseMapPath = ResolveMapPath(line, directory);
+        } else if (keyword == "map_Ks") {
+            current->specularMapPath = ResolveMapPath(line, directory);
+        } else if (keyword == "map_bump" || keyword == "map_Bump" || keyword == "bump") {
+            current->bumpMapPath = ResolveMapPath(line, directory);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Color.hpp"
+#include "Size.hpp"
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Texture {
+public:
+    Size2<int> dimensions;
+    std::vector<RgbaColor> pixels;
+
+public:
+    /// Decodes any format supported by stb_image. Throws std::runtime_error on failure.
+    static Texture Load(const char* path);
+};
+
+/// A material from an .mtl library. Texture maps are kept as paths (resolved relative to the library) and only
+/// decoded the first time they are requested.
+class Material {
+public:
+    std::string name;
+    glm::vec3 ambient{ 0.0f };
+    glm::vec3 diffuse{ 1.0f };
+    glm::vec3 specular{ 0.0f };
+    float shininess = 0.0f;
+    float opacity = 1.0f;
+    // Empty if the material has no such map
+    std::string diffuseMapPath;
+    std::string specularMapPath;
+    std::string bumpMapPath;
+
+private:
+    mutable std::shared_ptr<const Texture> diffuseMap;
+    mutable std::shared_ptr<const Texture> specularMap;
+    mutable std::shared_ptr<const Texture> bumpMap;
+
+public:
+    // Return nullptr if there is no such map, and throw std::runtime_error if it fails to decode.
+    // Note: decoding on first call is not thread safe
+    const Texture* GetDiffuseMap() const;
+    const Texture* GetSpecularMap() const;
+    const Texture* GetBumpMap() const;
+
+    /// Reads the materials of an .mtl file into `out`, updating those whose name is already present and
+    /// appending the others. Unknown statements are ignored. Throws std::runtime_error if the file cannot be read.
+    static void ReadMtlAt(const char* path, std::vector<Material>& out);
+};
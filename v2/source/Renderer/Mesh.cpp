@@ -1,94 +1,930 @@
 #include "Mesh.hpp"
 
 #include "Color.hpp"
+#include "JobSystem.hpp"
+#include "MappedFile.hpp"
+#include "ScopeGuard.hpp"
+#include "Renderer/VertexMap.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
-void Mesh::ReadObj(std::istream& data) {
-    char ctrash;
-    std::vector<glm::vec3> posBuf;
-    std::vector<glm::vec3> normalBuf;
-    std::vector<glm::vec2> uvBuf;
-    std::unordered_map<Vertex, uint32_t> knownVerts;
-    uint32_t nextID = 0;
-
-    std::string line;
-    while (!data.eof()) {
-        std::string start;
-        data >> start;
-        if (start == "#") {
-            continue;
-        } else if (start == "v") {
-            glm::vec3 pos;
-            for (int i = 0; i < 3; ++i) {
-                data >> pos[i];
+namespace {
+// Marks an absent vt/vn in a face corner
+constexpr uint32_t kNoIndex = 0xFFFFFFFF;
+
+struct ObjCorner {
+    // 0-based, with negative (relative) indices already resolved
+    uint32_t v;
+    uint32_t vt;
+    uint32_t vn;
+};
+
+struct ObjCounts {
+    size_t positions = 0;
+    size_t uvs = 0;
+    size_t normals = 0;
+    size_t faces = 0;
+    size_t lines = 0;
+};
+
+struct ObjStatement {
+    enum Kind {
+        Group,
+        UseMaterial,
+        MaterialLibrary,
+    } kind;
+    std::string_view argument;
+    // Number of faces of the chunk before the statement, turned into a number of triangles by TriangulateChunk()
+    size_t position;
+};
+
+/// Consecutive triangles sharing a group and material, the first being the `first` triangle of the file.
+struct ObjTriangleRun {
+    size_t first;
+    std::string_view group;
+    std::string_view material;
+};
+
+/// A range of whole lines of the file, parsed independently of the other chunks.
+struct ObjChunk {
+    std::string_view text;
+    // Records in this chunk, and in all chunks before it
+    ObjCounts counts;
+    ObjCounts base;
+
+    std::vector<ObjCorner> corners;
+    // Number of corners of each face, in the order they appear in `corners`
+    std::vector<uint32_t> faceSizes;
+    // Statements that change the state of the following faces, in file order
+    std::vector<ObjStatement> statements;
+    // Triangulated corners, 3 per triangle
+    std::vector<ObjCorner> triangles;
+    // Index of this chunk's first triangle corner among those of the whole file
+    size_t triangleBase = 0;
+};
+
+struct ObjData {
+    // Attributes of the whole file; chunks write theirs at their base offset
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjChunk> chunks;
+};
+
+/// Hand-written tokenizer over an in-memory .obj file; never allocates.
+class ObjScanner {
+private:
+    const char* cur;
+    const char* end;
+    size_t line = 1;
+
+public:
+    explicit ObjScanner(std::string_view source, size_t firstLine = 1)
+        : cur{ source.data() }
+        , end{ source.data() + source.size() }
+        , line{ firstLine } {
+    }
+
+    bool AtEnd() const { return cur == end; }
+
+    bool AtEndOfLine() const {
+        return cur == end || *cur == '\n' || *cur == '#';
+    }
+
+    void SkipSpaces() {
+        while (cur != end && (*cur == ' ' || *cur == '\t' || *cur == '\r')) {
+            ++cur;
+        }
+    }
+
+    /// Moves to the beginning of the next line, ignoring anything left on the current one.
+    void NextLine() {
+        while (cur != end && *cur != '\n') {
+            ++cur;
+        }
+        if (cur != end) {
+            ++cur;
+            ++line;
+        }
+    }
+
+    /// Consumes `keyword` if it is the next token (i.e. followed by whitespace or end of line).
+    bool Keyword(std::string_view keyword) {
+        size_t len = keyword.size();
+        if (static_cast<size_t>(end - cur) < len || std::string_view(cur, len) != keyword) {
+            return false;
+        }
+        const char* after = cur + len;
+        if (after != end && *after != ' ' && *after != '\t' && *after != '\r' && *after != '\n') {
+            return false;
+        }
+        cur = after;
+        return true;
+    }
+
+    /// Returns the rest of the line, without surrounding whitespace or a comment.
+    std::string_view RestOfLine() {
+        SkipSpaces();
+        const char* begin = cur;
+        while (cur != end && *cur != '\n' && *cur != '#') {
+            ++cur;
+        }
+        const char* last = cur;
+        while (last != begin && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r')) {
+            --last;
+        }
+        return { begin, static_cast<size_t>(last - begin) };
+    }
+
+    float ParseFloat() {
+        SkipSpaces();
+        // std::from_chars does not accept a leading plus sign
+        if (cur != end && *cur == '+') ++cur;
+        float value;
+        auto [ptr, ec] = std::from_chars(cur, end, value);
+        if (ec != std::errc()) Fail("expected a number");
+        cur = ptr;
+        return value;
+    }
+
+    int64_t ParseInt() {
+        if (cur != end && *cur == '+') ++cur;
+        int64_t value;
+        auto [ptr, ec] = std::from_chars(cur, end, value);
+        if (ec != std::errc()) Fail("expected an index");
+        cur = ptr;
+        return value;
+    }
+
+    bool Consume(char c) {
+        if (cur != end && *cur == c) {
+            ++cur;
+            return true;
+        }
+        return false;
+    }
+
+    [[noreturn]] void Fail(const char* reason) const {
+        throw std::runtime_error("OBJ parse error at line " + std::to_string(line) + ": " + reason);
+    }
+};
+
+/// Converts a 1-based (or negative, relative to the `count` elements read so far) OBJ index to 0-based.
+uint32_t ResolveIndex(const ObjScanner& scanner, int64_t index, size_t count) {
+    if (index > 0) return static_cast<uint32_t>(index - 1);
+    if (index < 0 && static_cast<size_t>(-index) <= count) return static_cast<uint32_t>(count + index);
+    scanner.Fail("index out of range");
+}
+
+/// ResolveIndex() for vt/vn references, where some exporters write 0 (e.g. `f 1/0/0`) for "no such attribute".
+uint32_t ResolveAttributeIndex(const ObjScanner& scanner, int64_t index, size_t count) {
+    return index == 0 ? kNoIndex : ResolveIndex(scanner, index, count);
+}
+
+/// Whether every attribute `corner` references exists, given the number of each in the whole file. References
+/// to vt/vn in a file without any such records are dropped rather than rejected, as some exporters write them.
+bool ValidateCorner(ObjCorner& corner, size_t positions, size_t uvs, size_t normals) {
+    if (uvs == 0) corner.vt = kNoIndex;
+    if (normals == 0) corner.vn = kNoIndex;
+    return corner.v < positions &&
+        (corner.vt == kNoIndex || corner.vt < uvs) &&
+        (corner.vn == kNoIndex || corner.vn < normals);
+}
+
+// Chunks are only worth their setup past this size
+constexpr size_t kMinChunkBytes = 1 << 20;
+
+/// Splits `source` into about `count` pieces, each ending right after a newline (or at the end of the file).
+std::vector<ObjChunk> SplitIntoChunks(std::string_view source, size_t count) {
+    std::vector<ObjChunk> chunks;
+    size_t begin = 0;
+    for (size_t i = 1; i <= count && begin < source.size(); ++i) {
+        size_t end = i == count ? source.size() : std::max(begin, source.size() / count * i);
+        if (end < source.size()) {
+            end = source.find('\n', end);
+            end = end == std::string_view::npos ? source.size() : end + 1;
+        }
+        if (end > begin) {
+            auto& chunk = chunks.emplace_back();
+            chunk.text = source.substr(begin, end - begin);
+        }
+        begin = end;
+    }
+    return chunks;
+}
+
+/// First pass: count the records of each kind, so every chunk knows where its attributes go in the whole
+/// file (and what negative indices refer to) before any of them are parsed.
+void CountChunk(ObjChunk& chunk) {
+    ObjScanner scanner(chunk.text);
+    auto& counts = chunk.counts;
+    while (!scanner.AtEnd()) {
+        scanner.SkipSpaces();
+        if (scanner.Keyword("v")) {
+            ++counts.positions;
+        } else if (scanner.Keyword("vt")) {
+            ++counts.uvs;
+        } else if (scanner.Keyword("vn")) {
+            ++counts.normals;
+        } else if (scanner.Keyword("f")) {
+            ++counts.faces;
+        }
+        scanner.NextLine();
+        ++counts.lines;
+    }
+}
+
+/// Parses the corners of an `f` record (after the keyword) and appends them to `out`. The counts are the
+/// number of attributes read so far, for resolving negative indices.
+void ParseFace(ObjScanner& scanner, size_t positions, size_t uvs, size_t normals, std::vector<ObjCorner>& out) {
+    // Format: f v v/vt v//vn v/vt/vn ..., with any number of corners
+    while (true) {
+        scanner.SkipSpaces();
+        if (scanner.AtEndOfLine()) break;
+
+        ObjCorner corner{ kNoIndex, kNoIndex, kNoIndex };
+        corner.v = ResolveIndex(scanner, scanner.ParseInt(), positions);
+        if (scanner.Consume('/')) {
+            if (scanner.Consume('/')) {
+                corner.vn = ResolveAttributeIndex(scanner, scanner.ParseInt(), normals);
+            } else {
+                corner.vt = ResolveAttributeIndex(scanner, scanner.ParseInt(), uvs);
+                if (scanner.Consume('/')) {
+                    corner.vn = ResolveAttributeIndex(scanner, scanner.ParseInt(), normals);
+                }
+            }
+        }
+        out.push_back(corner);
+    }
+}
+
+void ParseChunk(ObjChunk& chunk, ObjData& out) {
+    ObjScanner scanner(chunk.text, chunk.base.lines + 1);
+    // Number of attributes read so far in the whole file, for resolving negative indices
+    size_t positions = chunk.base.positions;
+    size_t uvs = chunk.base.uvs;
+    size_t normals = chunk.base.normals;
+
+    chunk.faceSizes.reserve(chunk.counts.faces);
+    chunk.corners.reserve(chunk.counts.faces * 3);
+    while (!scanner.AtEnd()) {
+        scanner.SkipSpaces();
+        if (scanner.Keyword("v")) {
+            float x = scanner.ParseFloat();
+            float y = scanner.ParseFloat();
+            float z = scanner.ParseFloat();
+            out.positions[positions++] = glm::vec3(x, y, z);
+        } else if (scanner.Keyword("vt")) {
+            float u = scanner.ParseFloat();
+            float v = scanner.ParseFloat();
+            out.uvs[uvs++] = glm::vec2(u, v);
+        } else if (scanner.Keyword("vn")) {
+            float x = scanner.ParseFloat();
+            float y = scanner.ParseFloat();
+            float z = scanner.ParseFloat();
+            out.normals[normals++] = glm::vec3(x, y, z);
+        } else if (scanner.Keyword("f")) {
+            size_t cornersBefore = chunk.corners.size();
+            ParseFace(scanner, positions, uvs, normals, chunk.corners);
+            chunk.faceSizes.push_back(static_cast<uint32_t>(chunk.corners.size() - cornersBefore));
+        } else if (scanner.Keyword("g")) {
+            chunk.statements.push_back({ ObjStatement::Group, scanner.RestOfLine(), chunk.faceSizes.size() });
+        } else if (scanner.Keyword("usemtl")) {
+            chunk.statements.push_back({ ObjStatement::UseMaterial, scanner.RestOfLine(), chunk.faceSizes.size() });
+        } else if (scanner.Keyword("mtllib")) {
+            chunk.statements.push_back({ ObjStatement::MaterialLibrary, scanner.RestOfLine(), chunk.faceSizes.size() });
+        }
+        // Everything else (comments, extra vertex components, o/s) is skipped here
+        scanner.NextLine();
+    }
+}
+
+/// Appends the triangulation of a polygon to `out`, 3 corners per triangle with the winding of the polygon. Convex
+/// polygons (by far the most common) become a fan around their first corner; concave ones are ear-clipped in the
+/// plane of the polygon. All corners must reference valid positions.
+void TriangulateFace(std::span<const ObjCorner> face, std::span<const glm::vec3> positions, std::vector<ObjCorner>& out) {
+    size_t n = face.size();
+    auto emitFan = [&](std::span<const uint32_t> order) {
+        for (size_t i = 1; i + 1 < order.size(); ++i) {
+            out.push_back(face[order[0]]);
+            out.push_back(face[order[i]]);
+            out.push_back(face[order[i + 1]]);
+        }
+    };
+    if (n <= 3) {
+        if (n == 3) {
+            out.insert(out.end(), face.begin(), face.end());
+        }
+        return;
+    }
+
+    // Project onto the coordinate plane the polygon is most parallel to, using Newell's normal, and flip it so
+    // that the polygon winds counterclockwise there
+    glm::vec3 normal(0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        glm::vec3 a = positions[face[i].v];
+        glm::vec3 b = positions[face[(i + 1) % n].v];
+        normal += glm::vec3((a.y - b.y) * (a.z + b.z), (a.z - b.z) * (a.x + b.x), (a.x - b.x) * (a.y + b.y));
+    }
+    glm::vec3 absNormal = glm::abs(normal);
+    int axis = absNormal.x > absNormal.y ? (absNormal.x > absNormal.z ? 0 : 2) : (absNormal.y > absNormal.z ? 1 : 2);
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    float flip = normal[axis] < 0.0f ? -1.0f : 1.0f;
+
+    // Reused from face to face (chunks are triangulated in parallel), so that quads don't allocate
+    thread_local std::vector<glm::vec2> points;
+    thread_local std::vector<uint32_t> remaining;
+    points.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        glm::vec3 p = positions[face[i].v];
+        points[i] = glm::vec2(p[u], p[v] * flip);
+    }
+    auto cross = [&](uint32_t a, uint32_t b, uint32_t c) {
+        glm::vec2 ab = points[b] - points[a];
+        glm::vec2 ac = points[c] - points[a];
+        return ab.x * ac.y - ab.y * ac.x;
+    };
+
+    remaining.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        remaining[i] = static_cast<uint32_t>(i);
+    }
+
+    bool convex = true;
+    for (size_t i = 0; i < n && convex; ++i) {
+        convex = cross(remaining[i], remaining[(i + 1) % n], remaining[(i + 2) % n]) >= 0.0f;
+    }
+    if (convex) {
+        emitFan(remaining);
+        return;
+    }
+
+    while (remaining.size() > 3) {
+        size_t count = remaining.size();
+        bool clipped = false;
+        for (size_t i = 0; i < count && !clipped; ++i) {
+            uint32_t prev = remaining[(i + count - 1) % count];
+            uint32_t curr = remaining[i];
+            uint32_t next = remaining[(i + 1) % count];
+            if (cross(prev, curr, next) <= 0.0f) continue;
+
+            // An ear contains none of the other remaining corners
+            bool ear = true;
+            for (uint32_t other : remaining) {
+                if (other == prev || other == curr || other == next) continue;
+                if (cross(prev, curr, other) >= 0.0f && cross(curr, next, other) >= 0.0f && cross(next, prev, other) >= 0.0f) {
+                    ear = false;
+                    break;
+                }
             }
-            posBuf.push_back(pos);
-        } else if (start == "vt") {
-            glm::vec3 normal;
-            for (int i = 0; i < 3; ++i) {
-                data >> normal[i];
+            if (ear) {
+                out.push_back(face[prev]);
+                out.push_back(face[curr]);
+                out.push_back(face[next]);
+                remaining.erase(remaining.begin() + i);
+                clipped = true;
             }
-            normalBuf.push_back(normal);
-        } else if (start == "vn") {
-            glm::vec2 uv;
-            for (int i = 0; i < 2; ++i) {
-                data >> uv[i];
+        }
+        // Self-intersecting or degenerate polygon: give up on being exact
+        if (!clipped) break;
+    }
+    emitFan(remaining);
+}
+
+void TriangulateChunk(ObjChunk& chunk, const ObjData& obj) {
+
+    size_t faceStart = 0;
+    size_t statement = 0;
+    for (size_t f = 0; f < chunk.faceSizes.size(); ++f) {
+        for (; statement < chunk.statements.size() && chunk.statements[statement].position == f; ++statement) {
+            chunk.statements[statement].position = chunk.triangles.size() / 3;
+        }
+
+        std::span<ObjCorner> face(chunk.corners.data() + faceStart, chunk.faceSizes[f]);
+        faceStart += face.size();
+        for (auto& c : face) {
+            if (!ValidateCorner(c, obj.positions.size(), obj.uvs.size(), obj.normals.size())) {
+                throw std::runtime_error("OBJ face references a nonexistent vertex attribute");
             }
-            uvBuf.push_back(uv);
-        } else if (start == "f") {
-            uint32_t tri[3] = {};
-            // We only support triangular faces (with 3 vertices)
-            // Format: f pos/uv/normal pos/uv/normal pos/uv/normal
-            for (int i = 0; i < 3; ++i) {
-                uint32_t iv, it, in;
-                data >> iv; // A vertex must have at least the position
-                data >> ctrash;
-                if (!uvBuf.empty()) data >> it;
-                data >> ctrash;
-                if (!normalBuf.empty()) data >> in;
-
-                // .obj file index starts at 1
-                --iv;
-                --it;
-                --in;
-                auto candidate = Vertex{
-                    .pos = posBuf[iv],
-                    .normal = normalBuf.empty() ? glm::vec3{} : normalBuf[in],
-                    .uv = uvBuf.empty() ? glm::vec2{} : uvBuf[it],
-                    .color = RgbaColor(255, 255, 255), // TODO
-                };
-
-                auto iter = knownVerts.find(candidate);
-                if (iter != knownVerts.end()) {
-                    // The vertex already exists, reuse the known version
-                    tri[i] = iter->second;
-                } else {
-                    // The vertex does not exist, create it
-                    knownVerts.insert({ std::move(candidate), nextID });
-                    tri[i] = nextID;
-                    ++nextID;
+        }
+        TriangulateFace(face, obj.positions, chunk.triangles);
+    }
+    for (; statement < chunk.statements.size(); ++statement) {
+        chunk.statements[statement].position = chunk.triangles.size() / 3;
+    }
+
+    // Not needed past this point
+    chunk.corners = {};
+    chunk.faceSizes = {};
+}
+
+Vertex MakeVertex(std::span<const glm::vec3> positions, std::span<const glm::vec2> uvs, std::span<const glm::vec3> normals, const ObjCorner& corner) {
+    return Vertex{
+        .pos = positions[corner.v],
+        .normal = corner.vn == kNoIndex ? glm::vec3{} : normals[corner.vn],
+        .uv = corner.vt == kNoIndex ? glm::vec2{} : uvs[corner.vt],
+        .color = RgbaColor(255, 255, 255), // TODO
+    };
+}
+
+Vertex MakeVertex(const ObjData& obj, const ObjCorner& corner) {
+    return MakeVertex(obj.positions, obj.uvs, obj.normals, corner);
+}
+
+/// Writes records to a temporary file through a fixed-size buffer.
+class SpillFile {
+private:
+    std::string path;
+    std::ofstream out;
+    std::vector<char> buffer;
+
+public:
+    explicit SpillFile(std::string path)
+        : path{ std::move(path) }
+        , buffer(1 << 16) {
+        out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.open(this->path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Failed to create temporary file " + this->path);
+        }
+    }
+
+    template <class T>
+    void Write(const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    /// Closes the file and maps it back for random access.
+    template <class T>
+    std::span<const T> Finish(MappedFile& mapping) {
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Failed to write temporary file " + path);
+        }
+        mapping = MappedFile(path.c_str(), MappedFile::Access::Random);
+        return { reinterpret_cast<const T*>(mapping.Data()), mapping.Size() / sizeof(T) };
+    }
+};
+
+std::string MakeTempPath() {
+    static std::atomic<uint32_t> counter = 0;
+    std::random_device random;
+    auto name = "srender-" + std::to_string(random()) + "-" + std::to_string(counter.fetch_add(1));
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+/// Splits the `mtllib` arguments (whitespace separated file names) into `out`, skipping duplicates.
+void AddMaterialLibraries(std::string_view argument, std::vector<std::string>& out) {
+    while (!argument.empty()) {
+        size_t begin = argument.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) break;
+        size_t end = std::min(argument.find_first_of(" \t", begin), argument.size());
+        std::string name(argument.substr(begin, end - begin));
+        if (std::find(out.begin(), out.end(), name) == out.end()) {
+            out.push_back(std::move(name));
+        }
+        argument.remove_prefix(end);
+    }
+}
+
+/// Walks the statements of all chunks in file order and returns the group and material names in effect for each
+/// run of triangles (empty runs dropped). Also collects the `mtllib` files.
+std::vector<ObjTriangleRun> CollectTriangleRuns(const std::vector<ObjChunk>& chunks, size_t triangleCount, std::vector<std::string>& materialLibraries) {
+    std::vector<ObjTriangleRun> runs;
+    ObjTriangleRun current{};
+    for (auto& chunk : chunks) {
+        for (auto& statement : chunk.statements) {
+            if (statement.kind == ObjStatement::MaterialLibrary) {
+                AddMaterialLibraries(statement.argument, materialLibraries);
+                continue;
+            }
+            size_t position = chunk.triangleBase / 3 + statement.position;
+            if (position > current.first) {
+                runs.push_back(current);
+            }
+            current.first = position;
+            (statement.kind == ObjStatement::Group ? current.group : current.material) = statement.argument;
+        }
+    }
+    if (triangleCount > current.first) {
+        runs.push_back(current);
+    }
+    return runs;
+}
+
+/// Sorts the triangles of `indices` by material, then group, and describes the result in `submeshes`. Materials
+/// are numbered in order of first use, their names appended to `outMaterialNames`.
+void BuildSubmeshes(std::span<const ObjTriangleRun> runs, std::vector<uint32_t>& indices, std::vector<Submesh>& submeshes, std::vector<std::string>& outMaterialNames) {
+    // Number groups and materials in order of first use
+    std::vector<std::string_view> groupNames;
+    std::vector<std::string_view> materialNames;
+    std::unordered_map<std::string_view, uint32_t> groupIndices;
+    std::unordered_map<std::string_view, uint32_t> materialIndices;
+    auto intern = [](std::vector<std::string_view>& names, std::unordered_map<std::string_view, uint32_t>& indices, std::string_view name) {
+        auto [iter, inserted] = indices.try_emplace(name, static_cast<uint32_t>(names.size()));
+        if (inserted) {
+            names.push_back(name);
+        }
+        return iter->second;
+    };
+
+    struct Run {
+        uint32_t material;
+        uint32_t group;
+        uint32_t first;
+        uint32_t count;
+    };
+    std::vector<Run> sorted;
+    sorted.reserve(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i) {
+        size_t end = i + 1 < runs.size() ? runs[i + 1].first : indices.size() / 3;
+        sorted.push_back(Run{
+            .material = intern(materialNames, materialIndices, runs[i].material),
+            .group = intern(groupNames, groupIndices, runs[i].group),
+            .first = static_cast<uint32_t>(runs[i].first),
+            .count = static_cast<uint32_t>(end - runs[i].first),
+        });
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Run& a, const Run& b) {
+        return std::tie(a.material, a.group) < std::tie(b.material, b.group);
+    });
+
+    // Reorder the triangles to match, unless they already are (e.g. a single material and group)
+    bool inOrder = std::is_sorted(sorted.begin(), sorted.end(), [](const Run& a, const Run& b) { return a.first < b.first; });
+    if (!inOrder) {
+        std::vector<uint32_t> reordered;
+        reordered.reserve(indices.size());
+        for (auto& run : sorted) {
+            auto begin = indices.begin() + size_t(run.first) * 3;
+            reordered.insert(reordered.end(), begin, begin + size_t(run.count) * 3);
+        }
+        indices = std::move(reordered);
+    }
+
+    uint32_t offset = 0;
+    for (auto& run : sorted) {
+        if (!submeshes.empty() && submeshes.back().material == run.material && submeshes.back().group == groupNames[run.group]) {
+            submeshes.back().indexCount += run.count * 3;
+        } else {
+            submeshes.push_back(Submesh{
+                .group = std::string(groupNames[run.group]),
+                .material = run.material,
+                .indexOffset = offset,
+                .indexCount = run.count * 3,
+            });
+        }
+        offset += run.count * 3;
+    }
+
+    for (auto name : materialNames) {
+        outMaterialNames.emplace_back(name);
+    }
+}
+} // namespace
+
+void Mesh::ReadObj(std::istream& data, int threadCount) {
+    std::string content(std::istreambuf_iterator<char>(data), {});
+    ReadObj(std::string_view(content), threadCount);
+}
+
+void Mesh::ReadObj(std::string_view source, int threadCount) {
+    Reset();
+
+    if (threadCount <= 0) {
+        threadCount = JobSystem::Global().GetConcurrency();
+    }
+
+    ObjData obj;
+    size_t chunkCount = std::clamp<size_t>(source.size() / kMinChunkBytes, 1, threadCount * 4);
+    obj.chunks = SplitIntoChunks(source, chunkCount);
+    auto& chunks = obj.chunks;
+
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        CountChunk(chunks[i]);
+    });
+    ObjCounts total;
+    for (auto& chunk : chunks) {
+        chunk.base = total;
+        total.positions += chunk.counts.positions;
+        total.uvs += chunk.counts.uvs;
+        total.normals += chunk.counts.normals;
+        total.faces += chunk.counts.faces;
+        total.lines += chunk.counts.lines;
+    }
+
+    obj.positions.resize(total.positions);
+    obj.uvs.resize(total.uvs);
+    obj.normals.resize(total.normals);
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        ParseChunk(chunks[i], obj);
+    });
+    // Separately, since triangulating concave faces looks at positions, which may come from any earlier chunk
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        TriangulateChunk(chunks[i], obj);
+    });
+
+    size_t cornerCount = 0;
+    for (auto& chunk : chunks) {
+        chunk.triangleBase = cornerCount;
+        cornerCount += chunk.triangles.size();
+    }
+    if (cornerCount / 3 > std::numeric_limits<uint32_t>::max() / 3) {
+        throw std::runtime_error("OBJ has too many triangles");
+    }
+
+    auto runs = CollectTriangleRuns(chunks, cornerCount / 3, materialLibraries);
+
+    // Deduplication. Vertices are sharded by hash, so equal vertices always land in the same shard, and each
+    // shard is walked in file order by a single thread. Every corner then learns the first corner with an
+    // identical vertex, the same answer a sequential pass would give, for any thread count.
+    const size_t shardCount = threadCount;
+    std::vector<uint32_t> firstCorner(cornerCount);
+    // [chunk][shard] -> global indices of the chunk's corners that fall in that shard
+    std::vector<std::vector<std::vector<uint32_t>>> shardCorners(chunks.size());
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        auto& chunk = chunks[i];
+        auto& shards = shardCorners[i];
+        shards.resize(shardCount);
+        for (size_t j = 0; j < chunk.triangles.size(); ++j) {
+            size_t shard = shardCount == 1 ? 0 : VertexMap::Hash(MakeVertex(obj, chunk.triangles[j])) % shardCount;
+            shards[shard].push_back(static_cast<uint32_t>(chunk.triangleBase + j));
+        }
+    });
+    ParallelFor(shardCount, threadCount, [&](size_t shard) {
+        // A closed triangle mesh has about half as many vertices as faces; reserving one slot per face leaves
+        // room for uv/normal seams without rehashing in the common case
+        VertexMap knownVerts;
+        knownVerts.Reserve(total.faces / shardCount + 1);
+        // Shard-local vertex index -> first corner using it
+        std::vector<uint32_t> knownFirstCorner;
+        knownFirstCorner.reserve(total.faces / shardCount + 1);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            auto& chunk = chunks[i];
+            for (uint32_t corner : shardCorners[i][shard]) {
+                auto& objCorner = chunk.triangles[corner - chunk.triangleBase];
+                auto [index, inserted] = knownVerts.Insert(MakeVertex(obj, objCorner));
+                if (inserted) {
+                    knownFirstCorner.push_back(corner);
                 }
+                firstCorner[corner] = knownFirstCorner[index];
             }
+        }
+    });
+    shardCorners = {};
 
-            for (int i = 0; i < std::size(tri); ++i) {
-                indices.push_back(tri[i]);
+    // Vertices are numbered in order of first use: count the first uses in each chunk, then number them
+    std::vector<size_t> vertexBase(chunks.size() + 1, 0);
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        size_t begin = chunks[i].triangleBase;
+        size_t end = begin + chunks[i].triangles.size();
+        size_t count = 0;
+        for (size_t j = begin; j < end; ++j) {
+            count += firstCorner[j] == j;
+        }
+        vertexBase[i + 1] = count;
+    });
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        vertexBase[i + 1] += vertexBase[i];
+    }
+
+    vertices.resize(vertexBase.back());
+    indices.resize(cornerCount);
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        auto& chunk = chunks[i];
+        uint32_t next = static_cast<uint32_t>(vertexBase[i]);
+        for (size_t j = 0; j < chunk.triangles.size(); ++j) {
+            size_t global = chunk.triangleBase + j;
+            if (firstCorner[global] == global) {
+                vertices[next] = MakeVertex(obj, chunk.triangles[j]);
+                indices[global] = next++;
+            }
+        }
+    });
+    // Separate pass: a corner's first use may be in an earlier chunk, which must be numbered already
+    ParallelFor(chunks.size(), threadCount, [&](size_t i) {
+        size_t begin = chunks[i].triangleBase;
+        size_t end = begin + chunks[i].triangles.size();
+        for (size_t j = begin; j < end; ++j) {
+            if (firstCorner[j] != j) {
+                indices[j] = indices[firstCorner[j]];
             }
-        } else if (start == "g") {
-            // TODO
         }
+    });
+
+    std::vector<std::string> materialNames;
+    BuildSubmeshes(runs, indices, submeshes, materialNames);
+    for (auto& name : materialNames) {
+        materials.emplace_back().name = std::move(name);
     }
+    UpdateBounds();
+}
+
+void Mesh::ReadObjAt(const char* path, int threadCount) {
+    MappedFile file(path);
+    ReadObj(file.AsStringView(), threadCount);
 
-    vertices.reserve(knownVerts.size());
-    for (const auto& [vert, idx] : knownVerts) {
-        vertices.push_back(vert);
+    auto directory = std::filesystem::path(path).parent_path();
+    for (auto& library : materialLibraries) {
+        library = (directory / std::filesystem::path(library)).lexically_normal().string();
     }
 }
 
-void Mesh::ReadObjAt(const char* path) {
-    std::ifstream ifs(path);
-    if (!ifs) return;
-    ReadObj(ifs);
+void Mesh::StreamObjAt(const char* path, size_t batchTriangles, const std::function<void(std::span<const Vertex>)>& onBatch) {
+    MappedFile file(path);
+    auto source = file.AsStringView();
+    batchTriangles = std::max<size_t>(batchTriangles, 1);
+
+    // First pass: spill the attributes to temporary files. Faces may reference any attribute before them, and
+    // mapping the spills back gives random access without keeping them in (swappable) memory.
+    std::string tempPath = MakeTempPath();
+    MappedFile positionMapping, uvMapping, normalMapping;
+    DEFER {
+        // Unmap before removing, which Windows requires
+        positionMapping = MappedFile();
+        uvMapping = MappedFile();
+        normalMapping = MappedFile();
+        for (auto suffix : { ".v", ".vt", ".vn" }) {
+            std::error_code ec;
+            std::filesystem::remove(tempPath + suffix, ec);
+        }
+    };
+    SpillFile positionSpill(tempPath + ".v");
+    SpillFile uvSpill(tempPath + ".vt");
+    SpillFile normalSpill(tempPath + ".vn");
+
+    ObjScanner spillScanner(source);
+    while (!spillScanner.AtEnd()) {
+        spillScanner.SkipSpaces();
+        if (spillScanner.Keyword("v")) {
+            float x = spillScanner.ParseFloat();
+            float y = spillScanner.ParseFloat();
+            float z = spillScanner.ParseFloat();
+            positionSpill.Write(glm::vec3(x, y, z));
+        } else if (spillScanner.Keyword("vt")) {
+            float u = spillScanner.ParseFloat();
+            float v = spillScanner.ParseFloat();
+            uvSpill.Write(glm::vec2(u, v));
+        } else if (spillScanner.Keyword("vn")) {
+            float x = spillScanner.ParseFloat();
+            float y = spillScanner.ParseFloat();
+            float z = spillScanner.ParseFloat();
+            normalSpill.Write(glm::vec3(x, y, z));
+        }
+        spillScanner.NextLine();
+    }
+    auto positions = positionSpill.Finish<glm::vec3>(positionMapping);
+    auto uvs = uvSpill.Finish<glm::vec2>(uvMapping);
+    auto normals = normalSpill.Finish<glm::vec3>(normalMapping);
+
+    // Second pass: triangulate the faces in file order into bounded batches
+    std::vector<Vertex> batch;
+    batch.reserve(batchTriangles * 3);
+    std::vector<ObjCorner> face;
+    std::vector<ObjCorner> faceTriangles;
+    size_t positionCount = 0, uvCount = 0, normalCount = 0;
+    ObjScanner scanner(source);
+    while (!scanner.AtEnd()) {
+        scanner.SkipSpaces();
+        if (scanner.Keyword("v")) {
+            ++positionCount;
+        } else if (scanner.Keyword("vt")) {
+            ++uvCount;
+        } else if (scanner.Keyword("vn")) {
+            ++normalCount;
+        } else if (scanner.Keyword("f")) {
+            face.clear();
+            ParseFace(scanner, positionCount, uvCount, normalCount, face);
+            for (auto& c : face) {
+                if (!ValidateCorner(c, positions.size(), uvs.size(), normals.size())) {
+                    scanner.Fail("face references a nonexistent vertex attribute");
+                }
+            }
+            faceTriangles.clear();
+            TriangulateFace(face, positions, faceTriangles);
+            for (auto& c : faceTriangles) {
+                batch.push_back(MakeVertex(positions, uvs, normals, c));
+                if (batch.size() >= batchTriangles * 3) {
+                    onBatch(batch);
+                    batch.clear();
+                }
+            }
+        }
+        scanner.NextLine();
+    }
+    if (!batch.empty()) {
+        onBatch(batch);
+    }
+}
+
+std::span<const Material> Mesh::GetMaterials() const {
+    if (materialsLoaded) {
+        return materials;
+    }
+
+    std::vector<Material> defined;
+    for (auto& library : materialLibraries) {
+        try {
+            Material::ReadMtlAt(library.c_str(), defined);
+        } catch (const std::exception&) {
+            // Missing libraries are common in downloaded assets, the mesh is still usable without them
+        }
+    }
+    for (auto& material : materials) {
+        auto iter = std::find_if(defined.begin(), defined.end(), [&](const Material& m) { return m.name == material.name; });
+        if (iter != defined.end()) {
+            material = std::move(*iter);
+        }
+    }
+    materialsLoaded = true;
+
+    return materials;
+}
+
+std::span<const Vertex> Mesh::GetVertices() const {
+    return cacheFile.Data() ? mappedVertices : std::span<const Vertex>(vertices);
+}
+
+std::span<const uint32_t> Mesh::GetIndices() const {
+    return cacheFile.Data() ? mappedIndices : std::span<const uint32_t>(indices);
+}
+
+std::span<const uint32_t> Mesh::GetEdges() const {
+    if (edgesValid) {
+        return edgeIndices;
+    }
+
+    // Pack each edge into a single 64-bit key (smaller index in the high half), so that
+    // deduplication is a plain integer sort + unique instead of a node-based set
+    auto indices = GetIndices();
+    std::vector<uint64_t> keys;
+    keys.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        uint32_t tri[] = { indices[i + 0], indices[i + 1], indices[i + 2] };
+        for (int e = 0; e < 3; ++e) {
+            uint32_t a = tri[e];
+            uint32_t b = tri[(e + 1) % 3];
+            if (a > b) std::swap(a, b);
+            keys.push_back(uint64_t(a) << 32 | b);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    edgeIndices.clear();
+    edgeIndices.reserve(keys.size() * 2);
+    for (uint64_t key : keys) {
+        edgeIndices.push_back(static_cast<uint32_t>(key >> 32));
+        edgeIndices.push_back(static_cast<uint32_t>(key));
+    }
+    edgesValid = true;
+
+    return edgeIndices;
+}
+
+void Mesh::InvalidateEdges() {
+    edgesValid = false;
+    edgeIndices.clear();
+}
+
+void Mesh::Reset() {
+    vertices.clear();
+    indices.clear();
+    boundsMin = {};
+    boundsMax = {};
+    submeshes.clear();
+    materialLibraries.clear();
+    materials.clear();
+    materialsLoaded = false;
+    cacheFile = MappedFile();
+    mappedVertices = {};
+    mappedIndices = {};
+    InvalidateEdges();
+}
+
+void Mesh::UpdateBounds() {
+    auto verts = GetVertices();
+    if (verts.empty()) {
+        boundsMin = boundsMax = {};
+        return;
+    }
+    boundsMin = boundsMax = verts[0].pos;
+    for (auto& vert : verts) {
+        boundsMin = glm::min(boundsMin, vert.pos);
+        boundsMax = glm::max(boundsMax, vert.pos);
+    }
 }
@@ -1,20 +1,99 @@
 #pragma once
 
+#include "MappedFile.hpp"
+#include "Renderer/Material.hpp"
 #include "Renderer/Primitive.hpp"
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <glm/glm.hpp>
 #include <iosfwd>
+#include <span>
+#include <string>
 #include <string_view>
 #include <vector>
 
+/// A range of the index buffer sharing a group and a material.
+struct Submesh {
+    // Name from the `g` statement in effect, empty for faces before any
+    std::string group;
+    // Index into Mesh::GetMaterials()
+    uint32_t material = 0;
+    uint32_t indexOffset = 0;
+    uint32_t indexCount = 0;
+};
+
 class Mesh {
 public:
+    // Owned geometry. Both are left empty while the mesh is backed by a cache file, so read through
+    // GetVertices()/GetIndices() unless you filled them yourself.
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    // Axis-aligned bounds of the vertex positions, set by the loaders
+    glm::vec3 boundsMin{};
+    glm::vec3 boundsMax{};
+    // Cover the whole index buffer, sorted by material so that drawing them in order changes material as
+    // rarely as possible (the loaders reorder triangles to match)
+    std::vector<Submesh> submeshes;
+    // Paths of the `mtllib` files, resolved relative to the .obj file when loaded from a path
+    std::vector<std::string> materialLibraries;
+
+private:
+    // Set when the geometry lives in a memory-mapped cache file instead of `vertices`/`indices`
+    MappedFile cacheFile;
+    std::span<const Vertex> mappedVertices;
+    std::span<const uint32_t> mappedIndices;
+
+    // Line list of unique edges (2 indices per edge, smaller index first), built on demand by GetEdges()
+    mutable std::vector<uint32_t> edgeIndices;
+    mutable bool edgesValid = false;
+
+    // One per material name used by the faces, in order of first use; only the names are known until the
+    // libraries are parsed by GetMaterials()
+    mutable std::vector<Material> materials;
+    mutable bool materialsLoaded = false;
 
 public:
-    void ReadObj(std::istream& data);
-    void ReadObjAt(const char* path);
+    // Loading replaces the current content of the mesh, and throws std::runtime_error on malformed input.
+    // Large inputs are split into chunks parsed on up to `threadCount` threads of JobSystem::Global() (0 for all
+    // of them); the result is identical for any thread count.
+    void ReadObj(std::istream& data, int threadCount = 0);
+    void ReadObj(std::string_view source, int threadCount = 0);
+    // Memory-maps the file and parses it in place
+    void ReadObjAt(const char* path, int threadCount = 0);
+    // Like ReadObjAt(), but goes through a binary cache stored next to the file (at path + MeshCache::kExtension):
+    // a cache matching the file's size and modification time is mapped and used in place without parsing,
+    // otherwise the file is parsed and the cache (re)written. Failing to write the cache is not an error.
+    void ReadObjCached(const char* path, int threadCount = 0);
+
+    // Maps a cache file written by WriteCache() and references its content zero-copy. Only the structure of the
+    // file is validated, not every index. Throws std::runtime_error if the file is not a usable cache.
+    void ReadCache(const char* path);
+    // `sourceSize` and `sourceModifyTime` identify the file the mesh was loaded from, see ReadObjCached()
+    void WriteCache(const char* path, uint64_t sourceSize = 0, int64_t sourceModifyTime = 0) const;
+
+    // Out-of-core alternative to loading: triangulates the file in order and passes the triangles (3 vertices each,
+    // no index buffer) to `onBatch` at most `batchTriangles` at a time. Attributes are spilled to temporary files
+    // and mapped back, so memory use is bounded by the batch size rather than the size of the mesh. Throws
+    // std::runtime_error on malformed input, possibly after some batches were delivered.
+    static void StreamObjAt(const char* path, size_t batchTriangles, const std::function<void(std::span<const Vertex>)>& onBatch);
+
+    std::span<const Vertex> GetVertices() const;
+    std::span<const uint32_t> GetIndices() const;
+
+    // Parses `materialLibraries` on first call; libraries that cannot be read, and materials they do not define,
+    // are left at their defaults. Textures are only decoded when requested from a Material.
+    // Note: not thread safe on first call
+    std::span<const Material> GetMaterials() const;
+
+    // Note: builds the cache on first call after a change, which is not thread safe
+    std::span<const uint32_t> GetEdges() const;
+    // Must be called after modifying `vertices` or `indices` directly
+    void InvalidateEdges();
+
+private:
+    // Drops all geometry, including a mapped cache file
+    void Reset();
+    void UpdateBounds();
 };
@@ -0,0 +1,268 @@
+#include "MeshCache.hpp"
+
+#include "Renderer/Mesh.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+#    include <process.h>
+#else
+#    include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+struct SourceStamp {
+    uint64_t size;
+    int64_t modifyTime;
+};
+
+SourceStamp GetSourceStamp(const char* path) {
+    // Both throw fs::filesystem_error (a std::runtime_error) if the file does not exist
+    return SourceStamp{
+        .size = static_cast<uint64_t>(fs::file_size(path)),
+        .modifyTime = static_cast<int64_t>(fs::last_write_time(path).time_since_epoch().count()),
+    };
+}
+
+/// Path next to `path` that no other writer uses, in this process or any other.
+std::string MakeTempPath(const char* path) {
+    static std::atomic<uint64_t> counter = 0;
+#if defined(_WIN32)
+    long long pid = _getpid();
+#else
+    long long pid = getpid();
+#endif
+    return std::string(path) + "." + std::to_string(pid) + "." + std::to_string(counter.fetch_add(1)) + ".tmp";
+}
+
+size_t AlignUp(size_t offset) {
+    return (offset + MeshCache::kAlignment - 1) & ~(MeshCache::kAlignment - 1);
+}
+
+const MeshCache::Header& ValidateHeader(const MappedFile& file, const char* path) {
+    using namespace MeshCache;
+
+    auto fail = [&](const char* reason) {
+        throw std::runtime_error("Invalid mesh cache " + std::string(path) + ": " + reason);
+    };
+    if (file.Size() < sizeof(Header)) {
+        fail("file too small");
+    }
+    // Page aligned, so the header and section table can be read in place
+    auto& header = *reinterpret_cast<const Header*>(file.Data());
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) fail("bad magic");
+    if (header.version != kVersion) fail("unsupported version");
+    if (header.byteOrderMark != kByteOrderMark) fail("written with a different byte order");
+    if (header.headerSize != sizeof(Header)) fail("written with a different layout");
+    if (header.sectionCount > (file.Size() - sizeof(Header)) / sizeof(Section)) fail("truncated section table");
+    return header;
+}
+
+template <class T>
+std::span<const T> MapSection(const MappedFile& file, const MeshCache::Section& section, const char* path) {
+    auto fail = [&](const char* reason) {
+        throw std::runtime_error("Invalid mesh cache " + std::string(path) + ": " + reason);
+    };
+    if (section.elementSize != sizeof(T)) fail("section written with a different layout");
+    if (section.offset % alignof(T) != 0) fail("misaligned section");
+    if (section.offset > file.Size() || section.count > (file.Size() - section.offset) / sizeof(T)) fail("section out of bounds");
+    return { reinterpret_cast<const T*>(file.Data() + section.offset), static_cast<size_t>(section.count) };
+}
+
+void WritePadding(std::ofstream& out, size_t& offset) {
+    static constexpr char kZeros[MeshCache::kAlignment] = {};
+    size_t aligned = AlignUp(offset);
+    out.write(kZeros, static_cast<std::streamsize>(aligned - offset));
+    offset = aligned;
+}
+} // namespace
+
+void Mesh::ReadObjCached(const char* path, int threadCount) {
+    auto stamp = GetSourceStamp(path);
+    std::string cachePath = std::string(path) + MeshCache::kExtension;
+
+    std::error_code ec;
+    if (fs::exists(cachePath, ec)) {
+        try {
+            ReadCache(cachePath.c_str());
+            auto& header = *reinterpret_cast<const MeshCache::Header*>(cacheFile.Data());
+            if (header.sourceSize == stamp.size && header.sourceModifyTime == stamp.modifyTime) {
+                return;
+            }
+        } catch (const std::exception&) {
+            // Stale or corrupt, rebuild it below
+        }
+    }
+
+    ReadObjAt(path, threadCount);
+    try {
+        WriteCache(cachePath.c_str(), stamp.size, stamp.modifyTime);
+    } catch (const std::exception&) {
+        // The cache is only an optimization, e.g. the directory might be read-only
+    }
+}
+
+void Mesh::ReadCache(const char* path) {
+    using namespace MeshCache;
+
+    Reset();
+    MappedFile file(path);
+    auto& header = ValidateHeader(file, path);
+    auto sections = reinterpret_cast<const Section*>(file.Data() + sizeof(Header));
+
+    std::span<const Vertex> verts;
+    std::span<const uint32_t> inds;
+    std::span<const SubmeshRecord> cachedSubmeshes;
+    std::span<const uint32_t> materialNames;
+    std::span<const uint32_t> libraryPaths;
+    std::span<const char> strings;
+    for (uint32_t i = 0; i < header.sectionCount; ++i) {
+        switch (sections[i].kind) {
+            case SectionKind::Vertices: verts = MapSection<Vertex>(file, sections[i], path); break;
+            case SectionKind::Indices: inds = MapSection<uint32_t>(file, sections[i], path); break;
+            case SectionKind::Submeshes: cachedSubmeshes = MapSection<SubmeshRecord>(file, sections[i], path); break;
+            case SectionKind::Materials: materialNames = MapSection<uint32_t>(file, sections[i], path); break;
+            case SectionKind::MaterialLibraries: libraryPaths = MapSection<uint32_t>(file, sections[i], path); break;
+            case SectionKind::Strings: strings = MapSection<char>(file, sections[i], path); break;
+            default: break;
+        }
+    }
+
+    auto fail = [&](const char* reason) {
+        throw std::runtime_error("Invalid mesh cache " + std::string(path) + ": " + reason);
+    };
+    if (inds.size() % 3 != 0) fail("incomplete triangle");
+    auto getString = [&](uint32_t offset) {
+        // Strings are null-terminated, and the section ends with one
+        if (offset >= strings.size() || strings.back() != '\0') fail("string out of bounds");
+        return std::string(strings.data() + offset);
+    };
+
+    // The small tables are copied, only the vertex and index streams stay mapped
+    for (auto& submesh : cachedSubmeshes) {
+        if (submesh.indexOffset > inds.size() || submesh.indexCount > inds.size() - submesh.indexOffset) fail("submesh out of bounds");
+        if (submesh.material >= materialNames.size()) fail("submesh references a nonexistent material");
+        submeshes.push_back(Submesh{
+            .group = getString(submesh.group),
+            .material = submesh.material,
+            .indexOffset = submesh.indexOffset,
+            .indexCount = submesh.indexCount,
+        });
+    }
+    for (uint32_t offset : materialNames) {
+        materials.emplace_back().name = getString(offset);
+    }
+    for (uint32_t offset : libraryPaths) {
+        materialLibraries.push_back(getString(offset));
+    }
+
+    cacheFile = std::move(file);
+    mappedVertices = verts;
+    mappedIndices = inds;
+    boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+}
+
+void Mesh::WriteCache(const char* path, uint64_t sourceSize, int64_t sourceModifyTime) const {
+    using namespace MeshCache;
+
+    auto verts = GetVertices();
+    auto inds = GetIndices();
+
+    std::vector<char> strings;
+    auto addString = [&](const std::string& str) {
+        auto offset = static_cast<uint32_t>(strings.size());
+        strings.insert(strings.end(), str.begin(), str.end());
+        strings.push_back('\0');
+        return offset;
+    };
+    std::vector<SubmeshRecord> cachedSubmeshes;
+    for (auto& submesh : submeshes) {
+        cachedSubmeshes.push_back(SubmeshRecord{ submesh.indexOffset, submesh.indexCount, submesh.material, addString(submesh.group) });
+    }
+    std::vector<uint32_t> materialNames;
+    for (auto& material : materials) {
+        materialNames.push_back(addString(material.name));
+    }
+    std::vector<uint32_t> libraryPaths;
+    for (auto& library : materialLibraries) {
+        libraryPaths.push_back(addString(library));
+    }
+
+    struct Stream {
+        SectionKind kind;
+        uint32_t elementSize;
+        const void* data;
+        size_t count;
+    };
+    const Stream streams[] = {
+        { SectionKind::Vertices, sizeof(Vertex), verts.data(), verts.size() },
+        { SectionKind::Indices, sizeof(uint32_t), inds.data(), inds.size() },
+        { SectionKind::Submeshes, sizeof(SubmeshRecord), cachedSubmeshes.data(), cachedSubmeshes.size() },
+        { SectionKind::Materials, sizeof(uint32_t), materialNames.data(), materialNames.size() },
+        { SectionKind::MaterialLibraries, sizeof(uint32_t), libraryPaths.data(), libraryPaths.size() },
+        { SectionKind::Strings, sizeof(char), strings.data(), strings.size() },
+    };
+    constexpr size_t kStreamCount = std::size(streams);
+
+    Header header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byteOrderMark = kByteOrderMark;
+    header.headerSize = sizeof(Header);
+    header.sectionCount = kStreamCount;
+    header.sourceSize = sourceSize;
+    header.sourceModifyTime = sourceModifyTime;
+    for (int i = 0; i < 3; ++i) {
+        header.boundsMin[i] = boundsMin[i];
+        header.boundsMax[i] = boundsMax[i];
+    }
+
+    Section sections[kStreamCount];
+    size_t offset = AlignUp(sizeof(Header) + sizeof(sections));
+    for (size_t i = 0; i < kStreamCount; ++i) {
+        sections[i] = Section{ streams[i].kind, streams[i].elementSize, offset, streams[i].count };
+        offset = AlignUp(offset + streams[i].elementSize * streams[i].count);
+    }
+
+    // Write to a temporary file and rename it into place, so that a concurrent reader never sees a partial cache.
+    // The name is unique to this writer, concurrent writers of the same cache each rename a complete file.
+    std::string tempPath = MakeTempPath(path);
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Failed to open " + tempPath + " for writing");
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+        size_t written = sizeof(header) + sizeof(sections);
+        for (auto& stream : streams) {
+            WritePadding(out, written);
+            size_t bytes = stream.elementSize * stream.count;
+            out.write(static_cast<const char*>(stream.data), static_cast<std::streamsize>(bytes));
+            written += bytes;
+        }
+        if (!out.flush()) {
+            out.close();
+            fs::remove(tempPath);
+            throw std::runtime_error("Failed to write " + tempPath);
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tempPath, path, ec);
+    if (ec) {
+        fs::remove(tempPath, ec);
+        throw std::runtime_error("Failed to replace " + std::string(path) + ": " + ec.message());
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// On-disk layout of the binary mesh cache (see Mesh::ReadObjCached).
+///
+/// The file is memory-mapped and used in place, so everything is stored in native byte order and native
+/// struct layout; a file written on a machine that disagrees on either is rejected and rebuilt. The
+/// header is followed by a table of sections, each pointing at a stream aligned to kAlignment. Readers
+/// skip section kinds they do not know, so optional data (e.g. meshlets or LODs) can be added without
+/// bumping the version.
+namespace MeshCache {
+constexpr char kMagic[8] = { 'S', 'R', 'M', 'E', 'S', 'H', '\r', '\n' };
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr size_t kAlignment = 64;
+// Appended to the source path to get the path of its cache
+constexpr const char* kExtension = ".srmesh";
+
+enum class SectionKind : uint32_t {
+    Vertices = 1, // Vertex[count]
+    Indices = 2, // uint32_t[count], 3 per triangle
+    Submeshes = 3, // SubmeshRecord[count]
+    Materials = 4, // uint32_t[count], offsets of the material names in Strings
+    MaterialLibraries = 5, // uint32_t[count], offsets of the library paths in Strings
+    Strings = 6, // char[count], null-terminated strings
+};
+
+struct SubmeshRecord {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    uint32_t material;
+    // Offset of the group name in Strings
+    uint32_t group;
+};
+
+struct Section {
+    SectionKind kind;
+    uint32_t elementSize;
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t headerSize;
+    uint32_t sectionCount;
+    // Size and modification time of the source file, for invalidation
+    uint64_t sourceSize;
+    int64_t sourceModifyTime;
+    float boundsMin[3];
+    float boundsMax[3];
+    // Followed by Section[sectionCount]
+};
+} // namespace MeshCache
@@ -8,6 +8,7 @@ size_t std::hash<Vertex>::operator()(const Vertex& vert) const {
     seed ^= std::hash<glm::vec3>()(vert.pos) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     seed ^= std::hash<glm::vec3>()(vert.normal) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     seed ^= std::hash<glm::vec2>()(vert.uv) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    seed ^= std::hash<uint32_t>()(vert.color.r | vert.color.g << 8 | vert.color.b << 16 | uint32_t(vert.color.a) << 24) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
     return seed;
 }
 
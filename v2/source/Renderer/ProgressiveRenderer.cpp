@@ -0,0 +1,141 @@
+#include "ProgressiveRenderer.hpp"
+
+#include "Renderer/Mesh.hpp"
+
+#include <algorithm>
+#include <utility>
+
+ProgressiveRenderer::ProgressiveRenderer() {
+    mRasterizer.SetTarget(&mBack);
+}
+
+ProgressiveRenderer::~ProgressiveRenderer() {
+    Cancel();
+    // Render jobs never throw, errors go to mError
+    JobSystem::Global().Wait(mLastJob);
+}
+
+void ProgressiveRenderer::Start(Scene scene) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mFrontMutex);
+        generation = ++mGeneration;
+    }
+    mLastJob = JobSystem::Global().Schedule(
+        [this, scene = std::move(scene), generation]() {
+            try {
+                Render(scene, generation);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mFrontMutex);
+                if (!mError) mError = std::current_exception();
+            }
+        },
+        { mLastJob });
+}
+
+void ProgressiveRenderer::Cancel() {
+    // Under the lock, so that a tile being published either makes it in before this returns or not at all
+    std::lock_guard<std::mutex> lock(mFrontMutex);
+    ++mGeneration;
+}
+
+bool ProgressiveRenderer::IsRendering() const {
+    return mLastJob && !mLastJob->IsFinished();
+}
+
+float ProgressiveRenderer::GetProgress() const {
+    int total = mRowsTotal.load(std::memory_order_relaxed);
+    return total > 0 ? static_cast<float>(mRowsDone.load(std::memory_order_relaxed)) / total : 0.0f;
+}
+
+bool ProgressiveRenderer::CopyUpdated(FrameBuffer& out, int& rowBegin, int& rowEnd) {
+    std::lock_guard<std::mutex> lock(mFrontMutex);
+    if (mError) {
+        auto error = std::exchange(mError, nullptr);
+        std::rethrow_exception(error);
+    }
+
+    if (mDirtyBegin >= mDirtyEnd) return false;
+    if (out.dimensions != mFront.dimensions) {
+        out.Resize(mFront.dimensions);
+        mDirtyBegin = 0;
+        mDirtyEnd = mFront.dimensions.height;
+    }
+
+    size_t begin = static_cast<size_t>(mDirtyBegin) * mFront.dimensions.width;
+    size_t end = static_cast<size_t>(mDirtyEnd) * mFront.dimensions.width;
+    std::copy(mFront.pixels.begin() + begin, mFront.pixels.begin() + end, out.pixels.begin() + begin);
+    std::copy(mFront.depths.begin() + begin, mFront.depths.begin() + end, out.depths.begin() + begin);
+    rowBegin = mDirtyBegin;
+    rowEnd = mDirtyEnd;
+    mDirtyBegin = 0;
+    mDirtyEnd = 0;
+    return true;
+}
+
+void ProgressiveRenderer::Render(const Scene& scene, uint64_t generation) {
+    auto cancelled = [&]() { return mGeneration.load(std::memory_order_relaxed) != generation; };
+    if (cancelled()) return;
+
+    int height = scene.dimensions.height;
+    mRowsDone.store(0, std::memory_order_relaxed);
+    mRowsTotal.store(height, std::memory_order_relaxed);
+
+    if (mBack.dimensions != scene.dimensions) {
+        mBack.Resize(scene.dimensions);
+    }
+    mBack.ClearColor(scene.clearColor);
+    mBack.ClearDepth(scene.clearDepth);
+    {
+        std::lock_guard<std::mutex> lock(mFrontMutex);
+        if (cancelled()) return;
+        if (mFront.dimensions != scene.dimensions) {
+            // The old image doesn't fit, start from a cleared one instead
+            mFront = mBack;
+            mDirtyBegin = 0;
+            mDirtyEnd = height;
+        }
+    }
+
+    // Triangles and wireframes are cheap next to the mesh, and don't draw in pieces; they go out as one tile
+    if (!scene.mesh || scene.wireframe || !scene.trianglePositions.empty()) {
+        if (scene.mesh && scene.wireframe) {
+            mRasterizer.DrawMeshWireframe(scene.camera, *scene.mesh, scene.wireframeColor);
+        } else if (scene.mesh) {
+            mRasterizer.DrawMesh(scene.camera, *scene.mesh);
+        }
+        size_t triangleCount = std::min(scene.trianglePositions.size(), scene.triangleColors.size()) / 3;
+        for (size_t t = 0; t < triangleCount; ++t) {
+            mRasterizer.DrawTriangle(&scene.trianglePositions[t * 3], &scene.triangleColors[t * 3]);
+        }
+        Publish(0, height, generation);
+        return;
+    }
+
+    Rasterizer::PrepareMesh(scene.camera, *scene.mesh, scene.dimensions, nullptr, mPrepared);
+    for (int row = 0; row < height; row += kTileRows) {
+        if (cancelled()) return;
+        int rowEnd = std::min(height, row + kTileRows);
+        mRasterizer.DrawPreparedRows(mPrepared, row, rowEnd);
+        Publish(row, rowEnd, generation);
+    }
+}
+
+void ProgressiveRenderer::Publish(int rowBegin, int rowEnd, uint64_t generation) {
+    size_t begin = static_cast<size_t>(rowBegin) * mBack.dimensions.width;
+    size_t end = static_cast<size_t>(rowEnd) * mBack.dimensions.width;
+    {
+        std::lock_guard<std::mutex> lock(mFrontMutex);
+        if (mGeneration.load(std::memory_order_relaxed) != generation) return;
+        std::copy(mBack.pixels.begin() + begin, mBack.pixels.begin() + end, mFront.pixels.begin() + begin);
+        std::copy(mBack.depths.begin() + begin, mBack.depths.begin() + end, mFront.depths.begin() + begin);
+        if (mDirtyBegin >= mDirtyEnd) {
+            mDirtyBegin = rowBegin;
+            mDirtyEnd = rowEnd;
+        } else {
+            mDirtyBegin = std::min(mDirtyBegin, rowBegin);
+            mDirtyEnd = std::max(mDirtyEnd, rowEnd);
+        }
+    }
+    mRowsDone.fetch_add(rowEnd - rowBegin, std::memory_order_relaxed);
+}
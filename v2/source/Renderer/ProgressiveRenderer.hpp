@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Color.hpp"
+#include "JobSystem.hpp"
+#include "Renderer/Rasterizer.hpp"
+#include "Renderer/Scene.hpp"
+#include "Size.hpp"
+#include "all_fwd.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Renders scenes in a job on JobSystem::Global() into a back buffer, publishing the frame in tiles of kTileRows
+/// rows as they complete. A UI thread polls CopyUpdated() once per frame, which only copies what changed since the
+/// last poll, so it never waits for rendering no matter how large the scene is.
+///
+/// Starting another render or calling Cancel() abandons the current one at its next tile boundary.
+class ProgressiveRenderer {
+public:
+    static constexpr int kTileRows = 32;
+
+    /// Everything a render reads, copied so that the UI may change its own state while the render runs.
+    struct Scene {
+        Size2<int> dimensions = { 0, 0 };
+        RgbaColor clearColor = RgbaColor(255, 255, 255);
+        float clearDepth = 0.0f;
+
+        // Drawn tile by tile, unless `wireframe` is set
+        std::shared_ptr<const Mesh> mesh;
+        Camera camera;
+        bool wireframe = false;
+        RgbaColor wireframeColor = RgbaColor(0, 0, 0);
+
+        // Screen-space triangles, 3 positions and 3 colors each, drawn after the mesh
+        std::vector<glm::vec3> trianglePositions;
+        std::vector<RgbaColor> triangleColors;
+    };
+
+private:
+    // Only touched by render jobs, which run one at a time
+    FrameBuffer mBack;
+    Rasterizer mRasterizer;
+    PreparedMesh mPrepared;
+
+    std::mutex mFrontMutex;
+    // Published tiles, guarded by mFrontMutex along with the fields below
+    FrameBuffer mFront;
+    // Rows published since the last CopyUpdated(), empty if begin >= end
+    int mDirtyBegin = 0;
+    int mDirtyEnd = 0;
+    // First failure of a render job, rethrown by CopyUpdated()
+    std::exception_ptr mError;
+
+    // Bumped (under mFrontMutex) to abandon the running render; each job renders and publishes as long as this
+    // matches the value it started with
+    std::atomic<uint64_t> mGeneration = 0;
+    std::atomic<int> mRowsDone = 0;
+    std::atomic<int> mRowsTotal = 0;
+    // Most recently started render, which depends on the one before so that they share the back buffer in turn
+    JobSystem::JobHandle mLastJob;
+
+public:
+    ProgressiveRenderer();
+    /// Abandons the current render and waits for it to stop.
+    ~ProgressiveRenderer();
+
+    ProgressiveRenderer(const ProgressiveRenderer&) = delete;
+    ProgressiveRenderer& operator=(const ProgressiveRenderer&) = delete;
+
+    /// Starts rendering `scene` once the previous render, if any, has stopped.
+    void Start(Scene scene);
+    /// Abandons the current render, leaving the tiles it published so far. Does not wait for the render job to
+    /// stop, but none of its tiles are published after this returns.
+    void Cancel();
+
+    bool IsRendering() const;
+    /// Fraction of the current (or last) render's rows that were published, in [0, 1].
+    float GetProgress() const;
+
+    /// If anything was published since the last call, copies it into `out`, sets [rowBegin, rowEnd) to the rows
+    /// that changed and returns true. `out` keeps its other rows, unless it has to be resized to the rendered
+    /// dimensions, in which case all of the front buffer is copied. Rethrows the error of a failed render, once.
+    bool CopyUpdated(FrameBuffer& out, int& rowBegin, int& rowEnd);
+
+private:
+    void Render(const Scene& scene, uint64_t generation);
+    void Publish(int rowBegin, int rowEnd, uint64_t generation);
+};
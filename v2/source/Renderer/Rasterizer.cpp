@@ -1,8 +1,608 @@
 #include "Rasterizer.hpp"
 
 #include "Color.hpp"
+#include "JobSystem.hpp"
+#include "Math.hpp"
 #include "Renderer/Mesh.hpp"
 #include "Renderer/Scene.hpp"
+#include "ScopeGuard.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#    include <emmintrin.h>
+#    define SRENDER_SSE2 1
+#endif
+
+namespace {
+// Cohen-Sutherland region codes, in television coordinate space (y increases from top to bottom)
+enum OutCode : int {
+    kInside = 0,
+    kLeft = 1 << 0,
+    kRight = 1 << 1,
+    kTop = 1 << 2,
+    kBottom = 1 << 3,
+};
+
+int ComputeOutCode(const glm::vec3& p, glm::vec2 max) {
+    int code = kInside;
+    if (p.x < 0.0f) {
+        code |= kLeft;
+    } else if (p.x > max.x) {
+        code |= kRight;
+    }
+    if (p.y < 0.0f) {
+        code |= kTop;
+    } else if (p.y > max.y) {
+        code |= kBottom;
+    }
+    return code;
+}
+
+/// Clips the segment a-b to the rectangle [0, max.x] x [0, max.y], with z interpolated along.
+/// Returns false if no part of the segment is inside the rectangle.
+bool ClipLine(glm::vec3& a, glm::vec3& b, glm::vec2 max) {
+    // Non-finite endpoints (e.g. from a vertex on the camera plane) would never converge
+    if (!std::isfinite(a.x + a.y + b.x + b.y)) {
+        return false;
+    }
+
+    int codeA = ComputeOutCode(a, max);
+    int codeB = ComputeOutCode(b, max);
+    while (true) {
+        if (!(codeA | codeB)) return true;
+        if (codeA & codeB) return false;
+
+        int code = codeA ? codeA : codeB;
+        auto d = b - a;
+        glm::vec3 p;
+        // Snap the clipped coordinate exactly onto the edge, so rounding error can't push it back out
+        if (code & kLeft) {
+            p = a + d * ((0.0f - a.x) / d.x);
+            p.x = 0.0f;
+        } else if (code & kRight) {
+            p = a + d * ((max.x - a.x) / d.x);
+            p.x = max.x;
+        } else if (code & kTop) {
+            p = a + d * ((0.0f - a.y) / d.y);
+            p.y = 0.0f;
+        } else {
+            p = a + d * ((max.y - a.y) / d.y);
+            p.y = max.y;
+        }
+
+        if (code == codeA) {
+            a = p;
+            codeA = ComputeOutCode(a, max);
+        } else {
+            b = p;
+            codeB = ComputeOutCode(b, max);
+        }
+    }
+}
+
+// Depth is stepped along lines in 32.32 fixed point
+constexpr int kDepthFracBits = 32;
+constexpr double kDepthFixedMax = 1u << 30;
+
+int64_t DepthToFixed(float z) {
+    double clamped = std::clamp<double>(z, -kDepthFixedMax, kDepthFixedMax);
+    return static_cast<int64_t>(clamped * static_cast<double>(int64_t(1) << kDepthFracBits));
+}
+
+float DepthFromFixed(int64_t z) {
+    return static_cast<float>(static_cast<double>(z) * (1.0 / static_cast<double>(int64_t(1) << kDepthFracBits)));
+}
+
+uint32_t PackColor(RgbaColor color) {
+    uint32_t bits;
+    std::memcpy(&bits, &color, sizeof(bits));
+    return bits;
+}
+
+void FillSpan(RgbaColor* pixels, float* depths, int count, RgbaColor color, float z) {
+    int i = 0;
+#if SRENDER_SSE2
+    __m128i wideColor = _mm_set1_epi32(static_cast<int>(PackColor(color)));
+    __m128 wideZ = _mm_set1_ps(z);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), wideColor);
+        _mm_storeu_ps(depths + i, wideZ);
+    }
+#endif
+    for (; i < count; ++i) {
+        pixels[i] = color;
+        depths[i] = z;
+    }
+}
+
+/// Same test as FrameBuffer::SetPixel(): a pixel is written if its current depth is <= z.
+void FillSpanDepthTested(RgbaColor* pixels, float* depths, int count, RgbaColor color, float z) {
+    int i = 0;
+#if SRENDER_SSE2
+    __m128i wideColor = _mm_set1_epi32(static_cast<int>(PackColor(color)));
+    __m128 wideZ = _mm_set1_ps(z);
+    for (; i + 4 <= count; i += 4) {
+        __m128 oldZ = _mm_loadu_ps(depths + i);
+        __m128 pass = _mm_cmple_ps(oldZ, wideZ);
+        __m128i passInt = _mm_castps_si128(pass);
+        __m128i oldColor = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+
+        // SSE2 has no blend instruction, select with and/andnot/or instead
+        __m128i newColor = _mm_or_si128(_mm_and_si128(passInt, wideColor), _mm_andnot_si128(passInt, oldColor));
+        __m128 newZ = _mm_or_ps(_mm_and_ps(pass, wideZ), _mm_andnot_ps(pass, oldZ));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), newColor);
+        _mm_storeu_ps(depths + i, newZ);
+    }
+#endif
+    for (; i < count; ++i) {
+        if (depths[i] <= z) {
+            pixels[i] = color;
+            depths[i] = z;
+        }
+    }
+}
+
+void DrawClippedRectangle(FrameBuffer& fb, const Rect<float>& rect, RgbaColor color, float z, bool depthTest) {
+    int width = fb.dimensions.width;
+    int height = fb.dimensions.height;
+
+    // Covered pixels are those with x0 <= x < x1 (and the same for y); clamp in float first so huge
+    // rectangles don't overflow the integer conversion
+    int x0 = static_cast<int>(std::ceil(std::clamp(rect.x0(), 0.0f, static_cast<float>(width))));
+    int y0 = static_cast<int>(std::ceil(std::clamp(rect.y0(), 0.0f, static_cast<float>(height))));
+    int x1 = static_cast<int>(std::ceil(std::clamp(rect.x1(), 0.0f, static_cast<float>(width))));
+    int y1 = static_cast<int>(std::ceil(std::clamp(rect.y1(), 0.0f, static_cast<float>(height))));
+    if (x0 >= x1 || y0 >= y1) return;
+
+    int spanLen = x1 - x0;
+    RgbaColor* pixels = fb.pixels.data() + y0 * width + x0;
+    float* depths = fb.depths.data() + y0 * width + x0;
+    for (int y = y0; y < y1; ++y) {
+        if (depthTest) {
+            FillSpanDepthTested(pixels, depths, spanLen, color, z);
+        } else {
+            FillSpan(pixels, depths, spanLen, color, z);
+        }
+        pixels += width;
+        depths += width;
+    }
+}
+
+/// Screen-space setup shared by the triangle loops. Depth and color are affine over the triangle, so their
+/// gradients are constant; every loop evaluates depth with the exact same expression (RowBase() + x * dx)
+/// so that a depth prepass and the main pass agree bit-for-bit, which early-Z rejection relies on.
+/// (This also needs FP contraction off, see xmake.lua)
+struct TrianglePlane {
+    glm::vec3 origin;
+    glm::vec2 e1;
+    glm::vec2 e2;
+    float det;
+
+    explicit TrianglePlane(const glm::vec3 vertices[3])
+        : origin{ vertices[0] }
+        , e1{ vertices[1].x - vertices[0].x, vertices[1].y - vertices[0].y }
+        , e2{ vertices[2].x - vertices[0].x, vertices[2].y - vertices[0].y }
+        , det{ e1.x * e2.y - e2.x * e1.y } {
+    }
+
+    // Same degenerate triangle cutoff as Triangle::CalcBarycentric()
+    bool IsDegenerate() const { return MathUtils::Abs(det) < 1.0f; }
+
+    glm::vec2 Gradient(float a0, float a1, float a2) const {
+        return glm::vec2(
+            ((a1 - a0) * e2.y - (a2 - a0) * e1.y) / det,
+            ((a2 - a0) * e1.x - (a1 - a0) * e2.x) / det);
+    }
+
+    /// Value at (0, y) of the attribute whose value at the origin vertex is `a0`.
+    float RowBase(float a0, glm::vec2 gradient, int y) const {
+        return a0 + (static_cast<float>(y) - origin.y) * gradient.y - origin.x * gradient.x;
+    }
+};
+
+/// Rows [begin, end) of a target. Triangle loops only write inside the rows they are given, and compute
+/// everything else exactly as if drawing the whole target, so that drawing a triangle band by band gives the
+/// same pixels as drawing it in one go.
+struct RowRange {
+    int begin;
+    int end;
+};
+
+/// Calls `func(y, xBegin, count)` for every row span covered by the triangle, clipped to `dimensions` and `rows`.
+/// Covers the pixels whose top-left corner lies inside or on the triangle, up to rounding: on shared edges it may
+/// decide differently from ForEachBoundingBoxPixel().
+template <class TFunc>
+void ForEachTriangleSpan(const glm::vec3 vertices[3], Size2<int> dimensions, RowRange rows, TFunc&& func) {
+    const glm::vec3* v[] = { &vertices[0], &vertices[1], &vertices[2] };
+    // Sort the vertices top-to-bottom
+    if (v[0]->y > v[1]->y) std::swap(v[0], v[1]);
+    if (v[0]->y > v[2]->y) std::swap(v[0], v[2]);
+    if (v[1]->y > v[2]->y) std::swap(v[1], v[2]);
+    auto& p0 = *v[0];
+    auto& p1 = *v[1];
+    auto& p2 = *v[2];
+
+    int yBegin = std::max(rows.begin, static_cast<int>(std::ceil(p0.y)));
+    int yEnd = std::min({ dimensions.height - 1, rows.end - 1, static_cast<int>(std::floor(p2.y)) });
+
+    float invLong = 1.0f / (p2.y - p0.y);
+    float invUpper = p1.y > p0.y ? 1.0f / (p1.y - p0.y) : 0.0f;
+    float invLower = p2.y > p1.y ? 1.0f / (p2.y - p1.y) : 0.0f;
+    for (int y = yBegin; y <= yEnd; ++y) {
+        float fy = static_cast<float>(y);
+        float xa = p0.x + (p2.x - p0.x) * ((fy - p0.y) * invLong);
+        float xb = fy < p1.y
+            ? p0.x + (p1.x - p0.x) * ((fy - p0.y) * invUpper)
+            : p1.x + (p2.x - p1.x) * ((fy - p1.y) * invLower);
+        if (xa > xb) std::swap(xa, xb);
+
+        int xBegin = std::max(0, static_cast<int>(std::ceil(xa)));
+        int xEnd = std::min(dimensions.width - 1, static_cast<int>(std::floor(xb)));
+        if (xBegin > xEnd) continue;
+
+        func(y, xBegin, xEnd - xBegin + 1);
+    }
+}
+
+/// Bounding box of a triangle clipped to a target, i.e. the pixels the bounding box loop tests.
+struct TriangleBox {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+
+    TriangleBox(const glm::vec3 vertices[3], Size2<int> dimensions) {
+        auto& t0 = vertices[0];
+        auto& t1 = vertices[1];
+        auto& t2 = vertices[2];
+        x0 = std::max(0.0f, std::min({ t0.x, t1.x, t2.x }));
+        y0 = std::max(0.0f, std::min({ t0.y, t1.y, t2.y }));
+        x1 = std::min<float>(dimensions.width - 1, std::max({ t0.x, t1.x, t2.x }));
+        y1 = std::min<float>(dimensions.height - 1, std::max({ t0.y, t1.y, t2.y }));
+    }
+
+    bool IsEmpty() const { return x0 > x1 || y0 > y1; }
+};
+
+/// Picks the loop that draws a triangle with the clipped bounding box `box` in `mode`. Passes that must cover the
+/// same pixels, like a depth prepass and the color pass after it, have to resolve the same mode.
+Rasterizer::TriangleMode ResolveTriangleMode(const glm::vec3 vertices[3], const TriangleBox& box, Rasterizer::TriangleMode mode) {
+    using TriangleMode = Rasterizer::TriangleMode;
+    if (mode != TriangleMode::Auto) return mode;
+
+    // Large triangles that cover little of their (on-screen) bounding box, i.e. thin diagonal ones, waste
+    // most of the per-pixel tests in the bounding box loop; walking the edges only visits covered pixels
+    auto& t0 = vertices[0];
+    auto& t1 = vertices[1];
+    auto& t2 = vertices[2];
+    float boxArea = (box.x1 - box.x0 + 1) * (box.y1 - box.y0 + 1);
+    float triArea = MathUtils::Abs((t1.x - t0.x) * (t2.y - t0.y) - (t2.x - t0.x) * (t1.y - t0.y)) * 0.5f;
+    bool useScanline = boxArea >= Rasterizer::kScanlineMinBoxArea && triArea < boxArea * Rasterizer::kScanlineMaxCoverage;
+    return useScanline ? TriangleMode::Scanline : TriangleMode::BoundingBox;
+}
+
+/// Calls `func(x, y, bc)` for every pixel of `box` within `rows` that the triangle covers, where `bc` are the
+/// pixel's barycentric coordinates.
+template <class TFunc>
+void ForEachBoundingBoxPixel(const glm::vec3 vertices[3], TriangleBox box, RowRange rows, TFunc&& func) {
+    // Clipped after choosing the mode, which has to be the same in every band
+    box.y0 = std::max(box.y0, static_cast<float>(rows.begin));
+    box.y1 = std::min(box.y1, static_cast<float>(rows.end - 1));
+    if (box.IsEmpty()) return;
+
+    glm::ivec2 bbv1{ box.x0, box.y0 };
+    glm::ivec2 bbv2{ box.x1, box.y1 };
+    for (int y = bbv1.y; y <= bbv2.y; ++y) {
+        for (int x = bbv1.x; x <= bbv2.x; ++x) {
+            auto bc = Triangle::CalcBarycentric(glm::vec3(x, y, 0.0f), vertices);
+            if (bc.x >= 0 && bc.y >= 0 && bc.z >= 0) {
+                func(x, y, bc);
+            }
+        }
+    }
+}
+
+glm::vec4 ColorToVec(RgbaColor c) {
+    return glm::vec4(c.r, c.g, c.b, c.a);
+}
+
+RgbaColor VecToColor(glm::vec4 v) {
+    auto cc = glm::clamp(v, 0.0f, 255.0f);
+    return RgbaColor(
+        static_cast<int>(cc.x),
+        static_cast<int>(cc.y),
+        static_cast<int>(cc.z),
+        static_cast<int>(cc.w));
+}
+
+struct ColorGradient {
+    glm::vec4 ddx;
+    glm::vec4 ddy;
+
+    ColorGradient(const TrianglePlane& plane, const glm::vec4 c[3]) {
+        for (int i = 0; i < 4; ++i) {
+            auto d = plane.Gradient(c[0][i], c[1][i], c[2][i]);
+            ddx[i] = d.x;
+            ddy[i] = d.y;
+        }
+    }
+};
+
+void DrawTriangleScanline(FrameBuffer& fb, const glm::vec3 vertices[3], const RgbaColor colors[3], RowRange rows) {
+    TrianglePlane plane(vertices);
+    if (plane.IsDegenerate()) return;
+
+    glm::vec4 cv[] = { ColorToVec(colors[0]), ColorToVec(colors[1]), ColorToVec(colors[2]) };
+    glm::vec2 dz = plane.Gradient(vertices[0].z, vertices[1].z, vertices[2].z);
+    ColorGradient dc(plane, cv);
+
+    bool flatColor = colors[0] == colors[1] && colors[1] == colors[2];
+    bool flatDepth = dz.x == 0.0f;
+
+    int width = fb.dimensions.width;
+    ForEachTriangleSpan(vertices, fb.dimensions, rows, [&](int y, int xBegin, int count) {
+        RgbaColor* pixels = fb.pixels.data() + y * width + xBegin;
+        float* depths = fb.depths.data() + y * width + xBegin;
+        float zBase = plane.RowBase(vertices[0].z, dz, y);
+
+        if (flatColor && flatDepth) {
+            // Constant over the whole span, so fill it in one go
+            FillSpanDepthTested(pixels, depths, count, colors[0], zBase);
+        } else if (flatColor) {
+            for (int i = 0; i < count; ++i) {
+                float z = zBase + static_cast<float>(xBegin + i) * dz.x;
+                if (depths[i] <= z) {
+                    pixels[i] = colors[0];
+                    depths[i] = z;
+                }
+            }
+        } else {
+            glm::vec4 cBase = cv[0] + dc.ddy * (static_cast<float>(y) - plane.origin.y) - dc.ddx * plane.origin.x;
+            for (int i = 0; i < count; ++i) {
+                float x = static_cast<float>(xBegin + i);
+                float z = zBase + x * dz.x;
+                // Color is only computed for pixels that pass the depth test
+                if (depths[i] <= z) {
+                    pixels[i] = VecToColor(cBase + dc.ddx * x);
+                    depths[i] = z;
+                }
+            }
+        }
+    });
+}
+
+/// Minimal loop for depth-only targets: no color interpolation, no RgbaColor construction. Covers exactly the
+/// pixels DrawTriangle() does in the same `mode`.
+void DrawTriangleDepthOnly(float* depthsBuffer, Size2<int> dimensions, const glm::vec3 vertices[3], Rasterizer::TriangleMode mode, RowRange rows) {
+    TriangleBox box(vertices, dimensions);
+    if (box.IsEmpty()) return;
+
+    TrianglePlane plane(vertices);
+    glm::vec2 dz = plane.Gradient(vertices[0].z, vertices[1].z, vertices[2].z);
+    if (ResolveTriangleMode(vertices, box, mode) != Rasterizer::TriangleMode::Scanline) {
+        ForEachBoundingBoxPixel(vertices, box, rows, [&](int x, int y, glm::vec3) {
+            float& depth = depthsBuffer[y * dimensions.width + x];
+            depth = std::max(depth, plane.RowBase(vertices[0].z, dz, y) + static_cast<float>(x) * dz.x);
+        });
+        return;
+    }
+
+    if (plane.IsDegenerate()) return;
+    ForEachTriangleSpan(vertices, dimensions, rows, [&](int y, int xBegin, int count) {
+        float* depths = depthsBuffer + y * dimensions.width + xBegin;
+        float zBase = plane.RowBase(vertices[0].z, dz, y);
+        // Equivalent to the `depths[i] <= z` test, written as a max so that it vectorizes
+        for (int i = 0; i < count; ++i) {
+            float z = zBase + static_cast<float>(xBegin + i) * dz.x;
+            depths[i] = std::max(depths[i], z);
+        }
+    });
+}
+
+/// Color scanline loop that additionally interpolates the light-space position and attenuates by shadow map visibility.
+void DrawTriangleShadowed(FrameBuffer& fb, const glm::vec3 vertices[3], const RgbaColor colors[3], const glm::vec3 lightPositions[3], const ShadowMap& shadowMap, RowRange rows) {
+    TrianglePlane plane(vertices);
+    if (plane.IsDegenerate()) return;
+
+    glm::vec4 cv[] = { ColorToVec(colors[0]), ColorToVec(colors[1]), ColorToVec(colors[2]) };
+    glm::vec4 lv[] = { glm::vec4(lightPositions[0], 0.0f), glm::vec4(lightPositions[1], 0.0f), glm::vec4(lightPositions[2], 0.0f) };
+    glm::vec2 dz = plane.Gradient(vertices[0].z, vertices[1].z, vertices[2].z);
+    ColorGradient dc(plane, cv);
+    ColorGradient dl(plane, lv);
+
+    int width = fb.dimensions.width;
+    ForEachTriangleSpan(vertices, fb.dimensions, rows, [&](int y, int xBegin, int count) {
+        RgbaColor* pixels = fb.pixels.data() + y * width + xBegin;
+        float* depths = fb.depths.data() + y * width + xBegin;
+        float fy = static_cast<float>(y);
+        float zBase = plane.RowBase(vertices[0].z, dz, y);
+        glm::vec4 cBase = cv[0] + dc.ddy * (fy - plane.origin.y) - dc.ddx * plane.origin.x;
+        glm::vec4 lBase = lv[0] + dl.ddy * (fy - plane.origin.y) - dl.ddx * plane.origin.x;
+        for (int i = 0; i < count; ++i) {
+            float x = static_cast<float>(xBegin + i);
+            float z = zBase + x * dz.x;
+            if (depths[i] <= z) {
+                glm::vec4 c = cBase + dc.ddx * x;
+                glm::vec4 l = lBase + dl.ddx * x;
+                float visibility = shadowMap.SampleVisibility(glm::vec3(l));
+                float shade = 1.0f - shadowMap.darkness * (1.0f - visibility);
+                // Alpha is left alone
+                c = glm::vec4(c.x * shade, c.y * shade, c.z * shade, c.w);
+                pixels[i] = VecToColor(c);
+                depths[i] = z;
+            }
+        }
+    });
+}
+
+/// Integer Bresenham line, with the same depth test as FrameBuffer::SetPixel().
+void DrawClippedLine(FrameBuffer& fb, glm::vec3 a, glm::vec3 b, RgbaColor color) {
+    int width = fb.dimensions.width;
+    int height = fb.dimensions.height;
+    if (width <= 0 || height <= 0) return;
+    if (!ClipLine(a, b, glm::vec2(width - 1, height - 1))) return;
+
+    // Clipped endpoints are non-negative, truncation is the same as flooring here
+    int x0 = std::min(static_cast<int>(a.x), width - 1);
+    int y0 = std::min(static_cast<int>(a.y), height - 1);
+    int x1 = std::min(static_cast<int>(b.x), width - 1);
+    int y1 = std::min(static_cast<int>(b.y), height - 1);
+
+    int dx = std::abs(x1 - x0);
+    int dy = std::abs(y1 - y0);
+    int stepX = x0 < x1 ? 1 : -1;
+    int stepY = y0 < y1 ? width : -width;
+
+    // Walk the major axis one pixel at a time, the minor axis advances whenever the error term crosses zero
+    bool xMajor = dx >= dy;
+    int majorLen = xMajor ? dx : dy;
+    int minorLen = xMajor ? dy : dx;
+    int majorStep = xMajor ? stepX : stepY;
+    int minorStep = xMajor ? stepY : stepX;
+
+    int64_t z = DepthToFixed(a.z);
+    int64_t zStep = majorLen > 0 ? (DepthToFixed(b.z) - z) / majorLen : 0;
+
+    RgbaColor* pixels = fb.pixels.data();
+    float* depths = fb.depths.data();
+    int idx = y0 * width + x0;
+    int err = 2 * minorLen - majorLen;
+    for (int i = 0; i <= majorLen; ++i) {
+        float depth = DepthFromFixed(z);
+        if (depths[idx] <= depth) {
+            pixels[idx] = color;
+            depths[idx] = depth;
+        }
+
+        if (err > 0) {
+            idx += minorStep;
+            err -= 2 * majorLen;
+        }
+        err += 2 * minorLen;
+        idx += majorStep;
+        z += zStep;
+    }
+}
+
+/// Rasterizer::DrawTriangle() on any target, restricted to `rows`.
+void DrawTriangle(FrameBuffer& fb, const glm::vec3 vertices[3], const RgbaColor colors[3], Rasterizer::TriangleMode mode, RowRange rows) {
+    TriangleBox box(vertices, fb.dimensions);
+    if (box.IsEmpty()) return;
+
+    if (ResolveTriangleMode(vertices, box, mode) == Rasterizer::TriangleMode::Scanline) {
+        DrawTriangleScanline(fb, vertices, colors, rows);
+        return;
+    }
+
+    TrianglePlane plane(vertices);
+    glm::vec2 dz = plane.Gradient(vertices[0].z, vertices[1].z, vertices[2].z);
+    int width = fb.dimensions.width;
+    ForEachBoundingBoxPixel(vertices, box, rows, [&](int x, int y, glm::vec3 bc) {
+        // Same depth expression as the scanline loops, see TrianglePlane
+        float z = plane.RowBase(vertices[0].z, dz, y) + static_cast<float>(x) * dz.x;
+        int idx = y * width + x;
+        if (fb.depths[idx] > z) return;
+
+        RgbaColor color(
+            static_cast<int>(colors[0].r * bc.x + colors[1].r * bc.y + colors[2].r * bc.z),
+            static_cast<int>(colors[0].g * bc.x + colors[1].g * bc.y + colors[2].g * bc.z),
+            static_cast<int>(colors[0].b * bc.x + colors[1].b * bc.y + colors[2].b * bc.z),
+            static_cast<int>(colors[0].a * bc.x + colors[1].a * bc.y + colors[2].a * bc.z));
+
+        fb.pixels[idx] = color;
+        fb.depths[idx] = z;
+    });
+}
+
+/// Sorts triangles [0, triangleCount) into horizontal bands of a target of size `dimensions`, skipping those
+/// entirely off-screen. `positionsOf(i, out)` writes the screen-space corners of triangle i. Small draws are
+/// left in a single band, which DrawBins() draws without looking at the bins.
+template <class TPositions>
+void BinTriangles(Size2<int> dimensions, size_t triangleCount, TPositions&& positionsOf, TriangleBins& bins) {
+    auto& jobs = JobSystem::Global();
+    int width = dimensions.width;
+    int height = dimensions.height;
+    int bandCount = std::min(jobs.GetConcurrency() * Rasterizer::kBandsPerThread, height / Rasterizer::kMinBandRows);
+    if (bandCount <= 1 || triangleCount < Rasterizer::kMinBandedTriangles) {
+        bins.bandRows = height;
+        bins.bandCount = 1;
+        return;
+    }
+    bins.bandRows = (height + bandCount - 1) / bandCount;
+    bins.bandCount = (height + bins.bandRows - 1) / bins.bandRows;
+
+    // Sorted in slices of the draw, concatenated in slice order when drawing. The vectors are cleared rather
+    // than replaced, so that their capacity carries over from frame to frame.
+    size_t sliceCount = std::min<size_t>(jobs.GetConcurrency() * 4, (triangleCount + Rasterizer::kMinBandedTriangles - 1) / Rasterizer::kMinBandedTriangles);
+    size_t sliceSize = (triangleCount + sliceCount - 1) / sliceCount;
+    bins.slices.resize(sliceCount);
+    jobs.ParallelFor(sliceCount, 0, [&](size_t s) {
+        auto& sliceBins = bins.slices[s];
+        sliceBins.resize(bins.bandCount);
+        for (auto& band : sliceBins) {
+            band.clear();
+        }
+
+        size_t end = std::min(triangleCount, (s + 1) * sliceSize);
+        for (size_t i = s * sliceSize; i < end; ++i) {
+            glm::vec3 p[3];
+            positionsOf(i, p);
+
+            int first = 0;
+            int last = bins.bandCount - 1;
+            // Non-finite triangles go to every band, to be rejected (or not) exactly as an unbanded draw would
+            if (std::isfinite(p[0].x + p[1].x + p[2].x + p[0].y + p[1].y + p[2].y)) {
+                // Every triangle loop stays within [floor(min), ceil(max)] on both axes
+                float xMin = std::floor(std::min({ p[0].x, p[1].x, p[2].x }));
+                float xMax = std::ceil(std::max({ p[0].x, p[1].x, p[2].x }));
+                float yMin = std::floor(std::min({ p[0].y, p[1].y, p[2].y }));
+                float yMax = std::ceil(std::max({ p[0].y, p[1].y, p[2].y }));
+                if (xMax < 0.0f || xMin > static_cast<float>(width - 1)) continue;
+                if (yMax < 0.0f || yMin > static_cast<float>(height - 1)) continue;
+                first = static_cast<int>(std::max(yMin, 0.0f)) / bins.bandRows;
+                last = static_cast<int>(std::min(yMax, static_cast<float>(height - 1))) / bins.bandRows;
+            }
+            for (int b = first; b <= last; ++b) {
+                sliceBins[b].push_back(static_cast<uint32_t>(i));
+            }
+        }
+    });
+}
+
+/// Calls `draw(rows, i)` for the triangles sorted by BinTriangles(), limited to `range` (which must lie within the
+/// binned target). Bands are drawn in parallel on JobSystem::Global(), each drawing the triangles overlapping it in
+/// their original order, which gives the same pixels as drawing every triangle over the whole range in order.
+template <class TDraw>
+void DrawBins(const TriangleBins& bins, size_t triangleCount, RowRange range, TDraw&& draw) {
+    if (range.begin >= range.end) return;
+    if (bins.bandCount <= 1) {
+        for (size_t i = 0; i < triangleCount; ++i) {
+            draw(range, i);
+        }
+        return;
+    }
+
+    // Bands cover disjoint rows, so they can be drawn concurrently
+    int firstBand = range.begin / bins.bandRows;
+    int lastBand = (range.end - 1) / bins.bandRows;
+    JobSystem::Global().ParallelFor(lastBand - firstBand + 1, 0, [&](size_t k) {
+        int b = firstBand + static_cast<int>(k);
+        RowRange rows{ std::max(range.begin, b * bins.bandRows), std::min(range.end, (b + 1) * bins.bandRows) };
+        for (auto& sliceBins : bins.slices) {
+            for (uint32_t i : sliceBins[b]) {
+                draw(rows, i);
+            }
+        }
+    });
+}
+} // namespace
 
 FrameBuffer::FrameBuffer()
     : dimensions{ 0, 0 } {
@@ -43,6 +643,52 @@ void FrameBuffer::SetPixel(glm::ivec2 pos, float z, RgbaColor color) {
     }
 }
 
+DepthBuffer::DepthBuffer()
+    : dimensions{ 0, 0 } {
+}
+
+DepthBuffer::DepthBuffer(Size2<int> dimensions) {
+    Resize(dimensions);
+}
+
+void DepthBuffer::Resize(Size2<int> dimensions, float depth) {
+    this->dimensions = dimensions;
+    depths.resize(dimensions.Area(), depth);
+}
+
+void DepthBuffer::Clear(float depth) {
+    std::fill(depths.begin(), depths.end(), depth);
+}
+
+float DepthBuffer::GetDepth(glm::ivec2 pos) const {
+    return depths[pos.y * dimensions.width + pos.x];
+}
+
+float ShadowMap::SampleVisibility(glm::vec3 lightPos) const {
+    int width = depth.dimensions.width;
+    int height = depth.dimensions.height;
+    int cx = static_cast<int>(std::floor(lightPos.x));
+    int cy = static_cast<int>(std::floor(lightPos.y));
+    // Anything the light camera didn't see is treated as lit
+    if (cx < 0 || cy < 0 || cx >= width || cy >= height) {
+        return 1.0f;
+    }
+
+    // Larger z is closer, same as FrameBuffer: a point is lit unless something in the map is in front of it
+    float z = lightPos.z + bias;
+    int lit = 0;
+    int taps = 0;
+    for (int y = cy - pcfRadius; y <= cy + pcfRadius; ++y) {
+        for (int x = cx - pcfRadius; x <= cx + pcfRadius; ++x) {
+            int sx = std::clamp(x, 0, width - 1);
+            int sy = std::clamp(y, 0, height - 1);
+            lit += z >= depth.depths[sy * width + sx];
+            ++taps;
+        }
+    }
+    return static_cast<float>(lit) / static_cast<float>(taps);
+}
+
 FrameBuffer* Rasterizer::GetTarget() const {
     return this->framebuffer;
 }
@@ -52,118 +698,190 @@ void Rasterizer::SetTarget(FrameBuffer* framebuffer) {
 }
 
 void Rasterizer::DrawLine(const glm::vec3 vertices[2], RgbaColor color) {
-    auto a = vertices[0];
-    auto b = vertices[1];
-
-    bool steep = false;
-    if (std::abs(a.x - b.x) < std::abs(a.y - b.y)) {
-        std::swap(a.x, a.y);
-        std::swap(b.x, b.y);
-        steep = true;
-    }
-    if (a.x > b.x) {
-        std::swap(a, b);
-    }
-
-    int start = a.x;
-    int end = b.x;
-    for (int x = start; x <= end; ++x) {
-        float t = (x - a.x) / (b.x - a.x);
-        int y = a.y * (1.0f - t) + b.y * t;
-        float z = a.z * (1.0f - t) + b.z * t;
-        if (steep) {
-            framebuffer->SetPixel({ y, x }, z, color);
-        } else {
-            framebuffer->SetPixel({ x, y }, z, color);
-        }
+    ::DrawClippedLine(*framebuffer, vertices[0], vertices[1], color);
+}
+
+void Rasterizer::DrawLines(std::span<const Line> lines, RgbaColor color) {
+    auto& fb = *framebuffer;
+    for (auto& line : lines) {
+        ::DrawClippedLine(fb, line.vertices[0], line.vertices[1], color);
     }
 }
 
 void Rasterizer::DrawTriangle(const glm::vec3 vertices[3], const RgbaColor colors[3]) {
-    auto t0 = vertices[0];
-    auto t1 = vertices[1];
-    auto t2 = vertices[2];
-
-#if 0
-    // TODO fix z and color
-    // Sort the vertices, t0, t1, t2 lower−to−upper (bubblesort yay!)
-    if (t0.y > t1.y) std::swap(t0, t1);
-    if (t0.y > t2.y) std::swap(t0, t2);
-    if (t1.y > t2.y) std::swap(t1, t2);
-
-    int total_height = t2.y - t0.y;
-    for (int y = t0.y; y <= t1.y; y++) {
-        int segment_height = t1.y - t0.y + 1;
-        float alpha = (float)(y - t0.y) / total_height;
-        float beta = (float)(y - t0.y) / segment_height; // be careful with divisions by zero
-        glm::ivec2 A = t0 + (t2 - t0) * alpha;
-        glm::ivec2 B = t0 + (t1 - t0) * beta;
-        if (A.x > B.x) std::swap(A, B);
-        for (int j = A.x; j <= B.x;) {
-            // Attention, due to int casts t0.y+i != A.yj++) {
-            framebuffer->SetPixel({ j, y }, 0.0f, colors[0]);
-        }
-    }
-    for (int y = t1.y; y <= t2.y; y++) {
-        int segment_height = t2.y - t1.y + 1;
-        float alpha = (float)(y - t0.y) / total_height;
-        float beta = (float)(y - t1.y) / segment_height; // be careful with divisions by zero
-        glm::ivec2 A = t0 + (t2 - t0) * alpha;
-        glm::ivec2 B = t1 + (t2 - t1) * beta;
-        if (A.x > B.x) std::swap(A, B);
-        for (int j = A.x; j <= B.x; j++) {
-            // Attention, due to int casts t0.y+i != A.y
-            framebuffer->SetPixel({ j, y }, 0.0f, colors[0]);
-        }
-    }
-#else
-    glm::ivec2 bbv1{
-        std::max(0.0f, std::min({ t0.x, t1.x, t2.x })),
-        std::max(0.0f, std::min({ t0.y, t1.y, t2.y }))
-    };
-    glm::ivec2 bbv2{
-        std::min<int>(framebuffer->dimensions.width, std::max({ t0.x, t1.x, t2.x })),
-        std::min<int>(framebuffer->dimensions.height, std::max({ t0.y, t1.y, t2.y }))
+    ::DrawTriangle(*framebuffer, vertices, colors, triangleMode, { 0, framebuffer->dimensions.height });
+}
+
+void Rasterizer::DrawRectangle(const Rect<float>& rect, RgbaColor color, float z, bool depthTest) {
+    ::DrawClippedRectangle(*framebuffer, rect, color, z, depthTest);
+}
+
+void Rasterizer::DrawRectangles(std::span<const RectangleOp> rects, bool depthTest) {
+    auto& fb = *framebuffer;
+    for (auto& op : rects) {
+        ::DrawClippedRectangle(fb, op.rect, op.color, op.z, depthTest);
+    }
+}
+
+void Rasterizer::DrawMesh(const Camera& camera, const Mesh& mesh, const ShadowMap* shadowMap) {
+    PrepareMesh(camera, mesh, framebuffer->dimensions, shadowMap ? &shadowMap->lightCamera : nullptr, preparedMesh);
+    DrawPrepared(preparedMesh, shadowMap);
+}
+
+void Rasterizer::PrepareMesh(const Camera& camera, const Mesh& mesh, Size2<int> dimensions, const Camera* lightCamera, PreparedMesh& out) {
+    auto& jobs = JobSystem::Global();
+    out.mesh = &mesh;
+    out.dimensions = dimensions;
+
+    // The light-space transform runs alongside the camera one and the binning
+    JobSystem::JobHandle lightTransform;
+    if (lightCamera) {
+        lightTransform = jobs.Schedule([&]() { TransformPositions(*lightCamera, mesh, out.lightPositions); });
+    } else {
+        out.lightPositions.clear();
+    }
+    // Wait before unwinding, the job refers to the caller's arguments
+    DEFER {
+        try {
+            jobs.Wait(lightTransform);
+        } catch (...) {
+        }
     };
 
-    for (int y = bbv1.y; y <= bbv2.y; ++y) {
-        for (int x = bbv1.x; x <= bbv2.x; ++x) {
-            auto bc = Triangle::CalcBarycentric(glm::vec3(x, y, 0.0f), vertices);
-            if (bc.x >= 0 && bc.x <= 1 && bc.y >= 0 && bc.y <= 1) {
-                float bcX = t0.x * bc.x + t1.x * bc.y + t2.x * bc.z;
-                float bcY = t0.y * bc.x + t1.y * bc.y + t2.y * bc.z;
-                float bcZ = t0.z * bc.x + t1.z * bc.y + t2.z * bc.z;
-
-                RgbaColor color(
-                    colors[0].r * bc.x + colors[1].r * bc.y + colors[2].r * bc.z,
-                    colors[0].g * bc.x + colors[1].g * bc.y + colors[2].g * bc.z,
-                    colors[0].b * bc.x + colors[1].b * bc.y + colors[2].b * bc.z,
-                    colors[0].a * bc.x + colors[1].a * bc.y + colors[2].a * bc.z);
-
-                framebuffer->SetPixel({ x, y }, bcZ, color);
-            }
+    TransformPositions(camera, mesh, out.positions);
+    auto indices = mesh.GetIndices();
+    auto positionsOf = [&](size_t t, glm::vec3 p[3]) {
+        for (int j = 0; j < 3; ++j) {
+            p[j] = out.positions[indices[t * 3 + j]];
         }
-    }
-#endif
+    };
+    ::BinTriangles(dimensions, indices.size() / 3, positionsOf, out.bins);
+    jobs.Wait(lightTransform);
 }
 
-void Rasterizer::DrawRectangle(const Rect<float>& rect, float z) {
-    // TODO
+void Rasterizer::DrawPrepared(const PreparedMesh& prepared, const ShadowMap* shadowMap) {
+    DrawPreparedRows(prepared, 0, prepared.dimensions.height, shadowMap);
 }
 
-void Rasterizer::DrawMesh(const Camera& camera, const Mesh& mesh) {
-    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
-        glm::vec3 positions[] = {
-            camera.TransformPos(mesh.vertices[i + 0].pos),
-            camera.TransformPos(mesh.vertices[i + 1].pos),
-            camera.TransformPos(mesh.vertices[i + 2].pos),
+void Rasterizer::DrawPreparedRows(const PreparedMesh& prepared, int rowBegin, int rowEnd, const ShadowMap* shadowMap) {
+    auto& fb = *framebuffer;
+    if (fb.dimensions != prepared.dimensions) {
+        throw std::runtime_error("Mesh was prepared for a target of different dimensions");
+    }
+    if (shadowMap && prepared.lightPositions.size() != prepared.positions.size()) {
+        throw std::runtime_error("Mesh was prepared without the shadow map's light camera");
+    }
+
+    auto vertices = prepared.mesh->GetVertices();
+    auto indices = prepared.mesh->GetIndices();
+    auto& positions = prepared.positions;
+    auto& lightPositions = prepared.lightPositions;
+    RowRange range{ std::max(rowBegin, 0), std::min(rowEnd, fb.dimensions.height) };
+    ::DrawBins(prepared.bins, indices.size() / 3, range, [&](RowRange rows, size_t t) {
+        uint32_t i0 = indices[t * 3 + 0];
+        uint32_t i1 = indices[t * 3 + 1];
+        uint32_t i2 = indices[t * 3 + 2];
+        glm::vec3 trianglePositions[] = {
+            positions[i0],
+            positions[i1],
+            positions[i2],
         };
         RgbaColor colors[] = {
-            mesh.vertices[i + 0].color,
-            mesh.vertices[i + 1].color,
-            mesh.vertices[i + 2].color,
+            vertices[i0].color,
+            vertices[i1].color,
+            vertices[i2].color,
         };
 
-        DrawTriangle(positions, colors);
+        if (shadowMap) {
+            glm::vec3 lightSpace[] = {
+                lightPositions[i0],
+                lightPositions[i1],
+                lightPositions[i2],
+            };
+            ::DrawTriangleShadowed(fb, trianglePositions, colors, lightSpace, *shadowMap, rows);
+        } else {
+            ::DrawTriangle(fb, trianglePositions, colors, triangleMode, rows);
+        }
+    });
+}
+
+void Rasterizer::DrawObjStreamed(const Camera& camera, const char* path, size_t batchTriangles) {
+    auto& fb = *framebuffer;
+    Mesh::StreamObjAt(path, batchTriangles, [&](std::span<const Vertex> triangles) {
+        transformedPositions.resize(triangles.size());
+        size_t blockCount = (triangles.size() + kTransformBlockVertices - 1) / kTransformBlockVertices;
+        ParallelFor(blockCount, 0, [&](size_t b) {
+            size_t end = std::min(triangles.size(), (b + 1) * kTransformBlockVertices);
+            for (size_t i = b * kTransformBlockVertices; i < end; ++i) {
+                transformedPositions[i] = camera.TransformPos(triangles[i].pos);
+            }
+        });
+
+        auto positionsOf = [&](size_t t, glm::vec3 out[3]) {
+            std::copy_n(&transformedPositions[t * 3], 3, out);
+        };
+        ::BinTriangles(fb.dimensions, triangles.size() / 3, positionsOf, triangleBins);
+        ::DrawBins(triangleBins, triangles.size() / 3, RowRange{ 0, fb.dimensions.height }, [&](RowRange rows, size_t t) {
+            RgbaColor colors[] = {
+                triangles[t * 3 + 0].color,
+                triangles[t * 3 + 1].color,
+                triangles[t * 3 + 2].color,
+            };
+            ::DrawTriangle(fb, &transformedPositions[t * 3], colors, triangleMode, rows);
+        });
+    });
+}
+
+void Rasterizer::DrawMeshWireframe(const Camera& camera, const Mesh& mesh, RgbaColor color) {
+    auto edges = mesh.GetEdges();
+    TransformPositions(camera, mesh, transformedPositions);
+
+    auto& fb = *framebuffer;
+    for (size_t i = 0; i < edges.size(); i += 2) {
+        ::DrawClippedLine(fb, transformedPositions[edges[i + 0]], transformedPositions[edges[i + 1]], color);
     }
 }
+
+void Rasterizer::DrawMeshDepthOnly(const Camera& camera, const Mesh& mesh, DepthBuffer& target) {
+    DrawMeshDepthOnly(camera, mesh, target.depths.data(), target.dimensions, triangleMode);
+}
+
+void Rasterizer::DrawMeshDepthPrepass(const Camera& camera, const Mesh& mesh, const ShadowMap* shadowMap) {
+    // Shadowed triangles are always drawn by the scanline loop
+    auto mode = shadowMap ? TriangleMode::Scanline : triangleMode;
+    DrawMeshDepthOnly(camera, mesh, framebuffer->depths.data(), framebuffer->dimensions, mode);
+}
+
+void Rasterizer::DrawShadowMap(ShadowMap& shadowMap, const Mesh& mesh) {
+    shadowMap.depth.Clear(std::numeric_limits<float>::lowest());
+    DrawMeshDepthOnly(shadowMap.lightCamera, mesh, shadowMap.depth);
+}
+
+void Rasterizer::DrawMeshDepthOnly(const Camera& camera, const Mesh& mesh, float* depths, Size2<int> dimensions, TriangleMode mode) {
+    TransformPositions(camera, mesh, transformedPositions);
+
+    auto indices = mesh.GetIndices();
+    auto positionsOf = [&](size_t t, glm::vec3 out[3]) {
+        for (int j = 0; j < 3; ++j) {
+            out[j] = transformedPositions[indices[t * 3 + j]];
+        }
+    };
+    ::BinTriangles(dimensions, indices.size() / 3, positionsOf, triangleBins);
+    ::DrawBins(triangleBins, indices.size() / 3, RowRange{ 0, dimensions.height }, [&](RowRange rows, size_t t) {
+        glm::vec3 positions[3];
+        positionsOf(t, positions);
+        ::DrawTriangleDepthOnly(depths, dimensions, positions, mode, rows);
+    });
+}
+
+void Rasterizer::TransformPositions(const Camera& camera, const Mesh& mesh, std::vector<glm::vec3>& out) {
+    auto vertices = mesh.GetVertices();
+    out.resize(vertices.size());
+    size_t blockCount = (vertices.size() + kTransformBlockVertices - 1) / kTransformBlockVertices;
+    ParallelFor(blockCount, 0, [&](size_t b) {
+        size_t end = std::min(vertices.size(), (b + 1) * kTransformBlockVertices);
+        for (size_t i = b * kTransformBlockVertices; i < end; ++i) {
+            out[i] = camera.TransformPos(vertices[i].pos);
+        }
+    });
+}
@@ -2,9 +2,13 @@
 
 #include "Color.hpp"
 #include "Rect.hpp"
+#include "Renderer/Scene.hpp"
 #include "Size.hpp"
 #include "all_fwd.hpp"
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <vector>
 
 class FrameBuffer {
@@ -35,21 +39,151 @@ public:
     void SetPixel(glm::ivec2 pos, float z, RgbaColor color);
 };
 
+/// Depth-only render target, e.g. for shadow maps. Uses the same convention as FrameBuffer: larger z is closer.
+class DepthBuffer {
+public:
+    // Row-major
+    std::vector<float> depths;
+    Size2<int> dimensions;
+
+public:
+    DepthBuffer();
+    DepthBuffer(Size2<int> dimensions);
+
+    void Resize(Size2<int> dimensions, float depth = 0.0f);
+    void Clear(float depth);
+
+    float GetDepth(glm::ivec2 pos) const;
+};
+
+class ShadowMap {
+public:
+    // Transforms world space into the shadow map's pixel space, like the Camera used for the main pass
+    Camera lightCamera;
+    DepthBuffer depth;
+    // Added to the receiver's light-space depth before comparing, to avoid self-shadowing acne
+    float bias = 0.005f;
+    // Percentage-closer filtering over a (2r + 1)^2 neighborhood, 0 for a single hard-edged tap
+    int pcfRadius = 1;
+    // How much a fully shadowed pixel is darkened, in [0, 1]
+    float darkness = 0.6f;
+
+public:
+    /// Fraction of PCF taps that see the light from `lightPos` (a position already transformed by `lightCamera`).
+    float SampleVisibility(glm::vec3 lightPos) const;
+};
+
+/// Triangles of a draw sorted into horizontal bands of the target, see Rasterizer::PrepareMesh().
+class TriangleBins {
+public:
+    // Rows per band; the last band may be shorter
+    int bandRows = 0;
+    // A single band means the draw was too small to bin, and every triangle is drawn in order
+    int bandCount = 1;
+    // Triangle indices per [slice][band], sorted in contiguous slices of the draw so that binning runs in
+    // parallel. Each band draws its triangles slice by slice, which keeps the original order.
+    std::vector<std::vector<std::vector<uint32_t>>> slices;
+};
+
+/// Per-frame geometry work of Rasterizer::DrawMesh(), done ahead of drawing: screen-space positions and triangle
+/// bins. Keeping two of these around lets the geometry of one frame be prepared while another is drawn, see
+/// FramePipeline. The storage is reused when the same object is prepared again.
+class PreparedMesh {
+public:
+    // Must outlive the prepared data
+    const Mesh* mesh = nullptr;
+    Size2<int> dimensions = { 0, 0 };
+    std::vector<glm::vec3> positions;
+    // Empty unless prepared with a light camera
+    std::vector<glm::vec3> lightPositions;
+    TriangleBins bins;
+};
+
 class Rasterizer {
+public:
+    enum class TriangleMode {
+        // Choose per triangle, based on its size and how much of its bounding box it covers
+        Auto,
+        // Test every pixel in the triangle's bounding box
+        BoundingBox,
+        // Walk the triangle's edges and fill the spans between them
+        Scanline,
+    };
+
+    // Tuning for TriangleMode::Auto: scanline is used for triangles whose clipped bounding box has at least
+    // kScanlineMinBoxArea pixels and which cover less than kScanlineMaxCoverage of it
+    static constexpr float kScanlineMinBoxArea = 64.0f;
+    static constexpr float kScanlineMaxCoverage = 0.35f;
+    // Triangles read at a time by DrawObjStreamed()
+    static constexpr size_t kStreamBatchTriangles = 1 << 16;
+    // Meshes with at least kMinBandedTriangles triangles are drawn in horizontal bands in parallel, up to
+    // kBandsPerThread bands per thread of JobSystem::Global() and at least kMinBandRows rows each
+    static constexpr size_t kMinBandedTriangles = 1024;
+    static constexpr int kBandsPerThread = 4;
+    static constexpr int kMinBandRows = 16;
+    // Vertices transformed per job
+    static constexpr size_t kTransformBlockVertices = 1 << 14;
+
 public:
     FrameBuffer* framebuffer;
+    TriangleMode triangleMode = TriangleMode::Auto;
 
 public:
     FrameBuffer* GetTarget() const;
     void SetTarget(FrameBuffer* framebuffer);
 
+    // Lines are clipped against the framebuffer, endpoints may lie off-screen
     void DrawLine(const glm::vec3 vertices[2], RgbaColor color);
+    // Batched version of DrawLine(), for wireframes and debug overlays
+    void DrawLines(std::span<const Line> lines, RgbaColor color);
 
     void DrawTriangle(const glm::vec3 vertices[3], const RgbaColor colors[3]);
 
     // Helper for axis-aligned rectangles.
     // Increases rendering performance, compared to calling DrawTriangle twice
-    void DrawRectangle(const Rect<float>& rect, float z = 0.0f);
+    // The rectangle is clipped to the framebuffer, and covers pixels whose top-left corner lies within it
+    // (same sampling as DrawTriangle). With `depthTest` off, color and depth are written unconditionally.
+    void DrawRectangle(const Rect<float>& rect, RgbaColor color, float z = 0.0f, bool depthTest = true);
+
+    struct RectangleOp {
+        Rect<float> rect;
+        RgbaColor color;
+        float z = 0.0f;
+    };
+    void DrawRectangles(std::span<const RectangleOp> rects, bool depthTest = true);
+
+    // If `shadowMap` is given (and filled by DrawShadowMap()), pixels are darkened by their visibility from the light
+    void DrawMesh(const Camera& camera, const Mesh& mesh, const ShadowMap* shadowMap = nullptr);
+    /// First half of DrawMesh(): transforms `mesh` by `camera` (and by `lightCamera`, if given, for drawing with a
+    /// shadow map from that light) and bins it for a target of size `dimensions`. Touches no rasterizer state,
+    /// so it may run on any thread while the rasterizer draws something else.
+    static void PrepareMesh(const Camera& camera, const Mesh& mesh, Size2<int> dimensions, const Camera* lightCamera, PreparedMesh& out);
+    /// Second half of DrawMesh(). Throws std::runtime_error if `prepared` doesn't match the target's dimensions,
+    /// or lacks light-space positions while `shadowMap` is given.
+    void DrawPrepared(const PreparedMesh& prepared, const ShadowMap* shadowMap = nullptr);
+    /// DrawPrepared() limited to rows [rowBegin, rowEnd) of the target, for drawing a frame in pieces. Drawing every
+    /// row once, in any order and any number of pieces, gives the same pixels as DrawPrepared().
+    void DrawPreparedRows(const PreparedMesh& prepared, int rowBegin, int rowEnd, const ShadowMap* shadowMap = nullptr);
+    // Draws each unique edge of the mesh once, transforming every vertex exactly once
+    void DrawMeshWireframe(const Camera& camera, const Mesh& mesh, RgbaColor color);
+    // Same result as loading the .obj at `path` and calling DrawMesh(), but streams the file through
+    // Mesh::StreamObjAt() so that memory use does not grow with the size of the mesh
+    void DrawObjStreamed(const Camera& camera, const char* path, size_t batchTriangles = kStreamBatchTriangles);
+
+    // Depth-only rendering, skips all color work
+    void DrawMeshDepthOnly(const Camera& camera, const Mesh& mesh, DepthBuffer& target);
+    // Renders depth into the current target only. A following DrawMesh() with the same camera, shadow map and
+    // triangleMode then passes the depth test exactly for visible pixels, and computes no color for hidden ones.
+    void DrawMeshDepthPrepass(const Camera& camera, const Mesh& mesh, const ShadowMap* shadowMap = nullptr);
+    // Clears the shadow map and renders `mesh` into it from the light camera
+    void DrawShadowMap(ShadowMap& shadowMap, const Mesh& mesh);
+
+private:
+    // Scratch storage for transformed vertex positions, kept around to avoid reallocating every draw
+    std::vector<glm::vec3> transformedPositions;
+    TriangleBins triangleBins;
+    PreparedMesh preparedMesh;
 
-    void DrawMesh(const Camera& camera, const Mesh& mesh);
+    void DrawMeshDepthOnly(const Camera& camera, const Mesh& mesh, float* depths, Size2<int> dimensions, TriangleMode mode);
+    static void TransformPositions(const Camera& camera, const Mesh& mesh, std::vector<glm::vec3>& out);
 };
@@ -1,5 +1,30 @@
 #include "Scene.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+Camera Camera::MakeTurntable(glm::vec3 boundsMin, glm::vec3 boundsMax, Size2<int> resolution, float angle) {
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    float radius = std::max(glm::length(boundsMax - boundsMin) * 0.5f, std::numeric_limits<float>::min());
+    float scale = 0.9f * std::min(resolution.width, resolution.height) / (2.0f * radius);
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+
+    // Rotates around Y, then maps x/y to pixels (y pointing down) and keeps view space z as depth, so that
+    // points closer to the viewer at +z win the depth test
+    Camera camera;
+    camera.transformation[0] = glm::vec4(scale * c, 0.0f, -s, 0.0f);
+    camera.transformation[1] = glm::vec4(0.0f, -scale, 0.0f, 0.0f);
+    camera.transformation[2] = glm::vec4(scale * s, 0.0f, c, 0.0f);
+    camera.transformation[3] = glm::vec4(
+        resolution.width * 0.5f - scale * (c * center.x + s * center.z),
+        resolution.height * 0.5f + scale * center.y,
+        s * center.x - c * center.z,
+        1.0f);
+    return camera;
+}
+
 glm::vec4 Camera::TransformAffine(const glm::vec4& pos) const {
     return transformation * pos;
 }
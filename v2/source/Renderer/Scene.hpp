@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Renderer/Primitive.hpp"
+#include "Size.hpp"
 
 #include <glm/glm.hpp>
 #include <vector>
@@ -10,6 +11,10 @@ public:
     glm::mat4 transformation;
 
 public:
+    /// Orthographic camera looking at the box [boundsMin, boundsMax] from `angle` radians around the Y axis, with
+    /// the box's bounding sphere fitted into an image of size `resolution`.
+    static Camera MakeTurntable(glm::vec3 boundsMin, glm::vec3 boundsMax, Size2<int> resolution, float angle);
+
     glm::vec4 TransformAffine(const glm::vec4& pos) const;
     glm::vec3 TransformPos(glm::vec3 pos) const;
 };
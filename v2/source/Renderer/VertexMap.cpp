@@ -0,0 +1,87 @@
+#include "VertexMap.hpp"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#    include <intrin.h>
+#endif
+
+static_assert(sizeof(Vertex) == sizeof(float) * 8 + sizeof(RgbaColor), "VertexMap hashes and compares vertices bytewise, they must not contain padding");
+
+namespace {
+uint64_t Load64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t Load32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t Mix(uint64_t a, uint64_t b) {
+    // 64x64 -> 128 bit multiply folded back to 64 bits, as in wyhash
+#if defined(_MSC_VER) && defined(_M_X64)
+    uint64_t hi;
+    uint64_t lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+#elif defined(__SIZEOF_INT128__)
+    unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    uint64_t aLo = a & 0xFFFFFFFF, aHi = a >> 32;
+    uint64_t bLo = b & 0xFFFFFFFF, bHi = b >> 32;
+    uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+    uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    uint64_t lo = (ll & 0xFFFFFFFF) | (mid << 32);
+    uint64_t hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return lo ^ hi;
+#endif
+}
+} // namespace
+
+uint64_t VertexMap::Hash(const Vertex& vertex) {
+    constexpr uint64_t kSecret0 = 0xa0761d6478bd642f;
+    constexpr uint64_t kSecret1 = 0xe7037ed1a0b428db;
+    constexpr uint64_t kSecret2 = 0x8ebc6af09c88c6e3;
+
+    auto p = reinterpret_cast<const unsigned char*>(&vertex);
+    // 36 bytes: four 8-byte words and a 4-byte tail
+    uint64_t a = Mix(Load64(p + 0) ^ kSecret0, Load64(p + 8) ^ kSecret1);
+    uint64_t b = Mix(Load64(p + 16) ^ kSecret2, Load64(p + 24) ^ kSecret0);
+    uint64_t c = Mix(a ^ Load32(p + 32), b ^ kSecret1);
+    return Mix(c ^ sizeof(Vertex), kSecret2);
+}
+
+void VertexMap::Reserve(size_t count) {
+    mVertices.reserve(count);
+    size_t slotCount = std::bit_ceil(std::max<size_t>(count * 2, 16));
+    if (slotCount > mSlots.size()) {
+        Rehash(slotCount);
+    }
+}
+
+void VertexMap::Clear() {
+    mVertices.clear();
+    std::fill(mSlots.begin(), mSlots.end(), 0);
+}
+
+void VertexMap::Grow() {
+    Rehash(std::max<size_t>(mSlots.size() * 2, 16));
+}
+
+void VertexMap::Rehash(size_t slotCount) {
+    mSlots.assign(slotCount, 0);
+    mMask = slotCount - 1;
+    for (size_t index = 0; index < mVertices.size(); ++index) {
+        uint64_t hash = Hash(mVertices[index]);
+        size_t i = static_cast<size_t>(hash >> 32) & mMask;
+        while (mSlots[i] != 0) {
+            i = (i + 1) & mMask;
+        }
+        mSlots[i] = (hash & 0xFFFFFFFF00000000) | (index + 1);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Renderer/Primitive.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+#include <vector>
+
+/// Hash set of vertices that hands out dense indices in insertion order, used for welding vertices while
+/// loading meshes. Keys are stored contiguously (so iteration is in first-insertion order), the table
+/// itself is a flat array of slots with linear probing.
+///
+/// Vertices are hashed and compared by their bytes, unlike Vertex::operator== (which e.g. treats
+/// 0.0 and -0.0 as equal); the hash covers every member including the color.
+class VertexMap {
+private:
+    std::vector<Vertex> mVertices;
+    // Empty slots are 0, otherwise (upper 32 bits of the hash) << 32 | (index into mVertices + 1)
+    std::vector<uint64_t> mSlots;
+    size_t mMask = 0;
+
+public:
+    static uint64_t Hash(const Vertex& vertex);
+
+    void Reserve(size_t count);
+    void Clear();
+
+    /// Returns the index of `vertex` in insertion order, and whether it was newly inserted.
+    std::pair<uint32_t, bool> Insert(const Vertex& vertex) {
+        // Keep the load factor at or below 1/2
+        if ((mVertices.size() + 1) * 2 > mSlots.size()) {
+            Grow();
+        }
+
+        uint64_t hash = Hash(vertex);
+        uint64_t tag = hash & 0xFFFFFFFF00000000;
+        for (size_t i = static_cast<size_t>(hash >> 32) & mMask;; i = (i + 1) & mMask) {
+            uint64_t slot = mSlots[i];
+            if (slot == 0) {
+                auto index = static_cast<uint32_t>(mVertices.size());
+                mVertices.push_back(vertex);
+                mSlots[i] = tag | (index + 1);
+                return { index, true };
+            }
+            if ((slot & 0xFFFFFFFF00000000) == tag) {
+                auto index = static_cast<uint32_t>(slot) - 1;
+                if (std::memcmp(&mVertices[index], &vertex, sizeof(Vertex)) == 0) {
+                    return { index, false };
+                }
+            }
+        }
+    }
+
+    std::span<const Vertex> Vertices() const { return mVertices; }
+    size_t Size() const { return mVertices.size(); }
+
+private:
+    void Grow();
+    void Rehash(size_t slotCount);
+};
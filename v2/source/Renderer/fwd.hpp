@@ -1,6 +1,20 @@
 #pragma once
 
+// FramePipeline.hpp
+class FramePipeline;
+
+// FrameStream.hpp
+class FrameStream;
+
+// FrameWriter.hpp
+class FrameWriter;
+
+// Material.hpp
+class Texture;
+class Material;
+
 // Mesh.hpp
+struct Submesh;
 class Mesh;
 
 // Primitive.hpp
@@ -8,8 +22,15 @@ struct Vertex;
 struct Line;
 struct Triangle;
 
+// ProgressiveRenderer.hpp
+class ProgressiveRenderer;
+
 // Rasterizer.hpp
 class FrameBuffer;
+class DepthBuffer;
+class ShadowMap;
+class TriangleBins;
+class PreparedMesh;
 class Rasterizer;
 
 // Scene.hpp
@@ -19,7 +19,7 @@ public:
     /// parameter, so the normal argument that implicit conversion are harmful doesn't really apply here.
     // Delibrately not explicit to allow usages like: ScopeGuard var = lambda;
     ScopeGuard(TCleanupFunc&& function) noexcept
-        : mFunc{ std::move(mFunc) } {
+        : mFunc{ std::move(function) } {
     }
 
     ~ScopeGuard() noexcept {
@@ -32,8 +32,8 @@ public:
     ScopeGuard& operator=(const ScopeGuard&) = delete;
 
     ScopeGuard(ScopeGuard&& that) noexcept
-        : mFunc{ std::move(that.mFunc) } {
-        that.Cancel();
+        : mFunc{ std::move(that.mFunc) }
+        , mDismissed{ std::exchange(that.mDismissed, true) } {
     }
 
     ScopeGuard& operator=(ScopeGuard&& that) noexcept {
@@ -41,7 +41,8 @@ public:
             mFunc();
         }
         this->mFunc = std::move(that.mFunc);
-        this->cancelled = std::exchange(that.cancelled, true);
+        this->mDismissed = std::exchange(that.mDismissed, true);
+        return *this;
     }
 
     void Dismiss() noexcept {
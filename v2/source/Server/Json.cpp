@@ -0,0 +1,263 @@
+#include "Json.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+class Parser {
+public:
+    std::string_view text;
+    size_t pos = 0;
+
+public:
+    [[noreturn]] void Fail(const char* what) {
+        throw std::runtime_error("Invalid JSON at offset " + std::to_string(pos) + ": " + what);
+    }
+
+    void SkipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+            ++pos;
+        }
+    }
+
+    bool Consume(char c) {
+        SkipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(char c, const char* what) {
+        if (!Consume(c)) Fail(what);
+    }
+
+    bool ConsumeWord(std::string_view word) {
+        if (text.substr(pos, word.size()) != word) return false;
+        pos += word.size();
+        return true;
+    }
+
+    unsigned ParseHex4() {
+        if (pos + 4 > text.size()) Fail("truncated \\u escape");
+        unsigned value = 0;
+        auto [end, ec] = std::from_chars(text.data() + pos, text.data() + pos + 4, value, 16);
+        if (ec != std::errc() || end != text.data() + pos + 4) Fail("bad \\u escape");
+        pos += 4;
+        return value;
+    }
+
+    static void AppendUtf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    std::string ParseString() {
+        Expect('"', "expected a string");
+        std::string result;
+        while (true) {
+            if (pos >= text.size()) Fail("unterminated string");
+            char c = text[pos++];
+            if (c == '"') return result;
+            if (static_cast<unsigned char>(c) < 0x20) Fail("control character in string");
+            if (c != '\\') {
+                result.push_back(c);
+                continue;
+            }
+
+            if (pos >= text.size()) Fail("unterminated string");
+            switch (text[pos++]) {
+                case '"': result.push_back('"'); break;
+                case '\\': result.push_back('\\'); break;
+                case '/': result.push_back('/'); break;
+                case 'b': result.push_back('\b'); break;
+                case 'f': result.push_back('\f'); break;
+                case 'n': result.push_back('\n'); break;
+                case 'r': result.push_back('\r'); break;
+                case 't': result.push_back('\t'); break;
+                case 'u': {
+                    uint32_t cp = ParseHex4();
+                    if (cp >= 0xD800 && cp < 0xDC00) {
+                        // High surrogate, must be followed by a low one
+                        if (!ConsumeWord("\\u")) Fail("unpaired surrogate");
+                        uint32_t low = ParseHex4();
+                        if (low < 0xDC00 || low >= 0xE000) Fail("unpaired surrogate");
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    } else if (cp >= 0xDC00 && cp < 0xE000) {
+                        Fail("unpaired surrogate");
+                    }
+                    AppendUtf8(result, cp);
+                } break;
+                default: Fail("bad escape");
+            }
+        }
+    }
+
+    double ParseNumber() {
+        SkipSpace();
+        // from_chars would also take "inf", "nan" and their negations; like JSON, it doesn't take a leading '+'
+        size_t digit = pos < text.size() && text[pos] == '-' ? pos + 1 : pos;
+        if (digit >= text.size() || !(text[digit] >= '0' && text[digit] <= '9')) Fail("expected a value");
+        double value;
+        auto [end, ec] = std::from_chars(text.data() + pos, text.data() + text.size(), value);
+        if (ec != std::errc() || end == text.data() + pos) Fail("expected a value");
+        if (!std::isfinite(value)) Fail("expected a finite number");
+        pos = end - text.data();
+        return value;
+    }
+
+    Json::Value ParseValue() {
+        SkipSpace();
+        Json::Value value;
+        if (pos >= text.size()) Fail("expected a value");
+        switch (text[pos]) {
+            case '"': {
+                value.type = Json::Value::Type::String;
+                value.string = ParseString();
+            } break;
+            case '[': {
+                ++pos;
+                value.type = Json::Value::Type::NumberArray;
+                if (!Consume(']')) {
+                    do {
+                        value.numbers.push_back(ParseNumber());
+                    } while (Consume(','));
+                    Expect(']', "expected ',' or ']'");
+                }
+            } break;
+            case '{': Fail("nested objects are not supported");
+            default: {
+                if (ConsumeWord("true")) {
+                    value.type = Json::Value::Type::Bool;
+                    value.boolean = true;
+                } else if (ConsumeWord("false")) {
+                    value.type = Json::Value::Type::Bool;
+                } else if (ConsumeWord("null")) {
+                    value.type = Json::Value::Type::Null;
+                } else {
+                    value.type = Json::Value::Type::Number;
+                    value.number = ParseNumber();
+                }
+            } break;
+        }
+        return value;
+    }
+};
+
+void AppendQuoted(std::string& out, std::string_view s) {
+    out.push_back('"');
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static constexpr char kHex[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out.push_back(kHex[c >> 4]);
+                    out.push_back(kHex[c & 0xF]);
+                } else {
+                    out.push_back(c);
+                }
+            } break;
+        }
+    }
+    out.push_back('"');
+}
+
+void AppendNumber(std::string& out, double value) {
+    // JSON has no representation for these
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, end);
+}
+} // namespace
+
+Json::Object Json::ParseObject(std::string_view text) {
+    Parser parser{ .text = text };
+    Object result;
+    parser.Expect('{', "expected an object");
+    if (!parser.Consume('}')) {
+        do {
+            auto key = parser.ParseString();
+            parser.Expect(':', "expected ':'");
+            result[std::move(key)] = parser.ParseValue();
+        } while (parser.Consume(','));
+        parser.Expect('}', "expected ',' or '}'");
+    }
+    parser.SkipSpace();
+    if (parser.pos != text.size()) parser.Fail("trailing characters");
+    return result;
+}
+
+void Json::ObjectWriter::AddNull(std::string_view key) {
+    AddKey(key);
+    mText += "null";
+}
+
+void Json::ObjectWriter::AddBool(std::string_view key, bool value) {
+    AddKey(key);
+    mText += value ? "true" : "false";
+}
+
+void Json::ObjectWriter::AddNumber(std::string_view key, double value) {
+    AddKey(key);
+    AppendNumber(mText, value);
+}
+
+void Json::ObjectWriter::AddString(std::string_view key, std::string_view value) {
+    AddKey(key);
+    AppendQuoted(mText, value);
+}
+
+void Json::ObjectWriter::AddValue(std::string_view key, const Value& value) {
+    switch (value.type) {
+        case Value::Type::Null: AddNull(key); break;
+        case Value::Type::Bool: AddBool(key, value.boolean); break;
+        case Value::Type::Number: AddNumber(key, value.number); break;
+        case Value::Type::String: AddString(key, value.string); break;
+        case Value::Type::NumberArray: {
+            AddKey(key);
+            mText.push_back('[');
+            for (size_t i = 0; i < value.numbers.size(); ++i) {
+                if (i > 0) mText.push_back(',');
+                AppendNumber(mText, value.numbers[i]);
+            }
+            mText.push_back(']');
+        } break;
+    }
+}
+
+std::string Json::ObjectWriter::Finish() {
+    mText.push_back('}');
+    return std::move(mText);
+}
+
+void Json::ObjectWriter::AddKey(std::string_view key) {
+    if (mText.size() > 1) mText.push_back(',');
+    AppendQuoted(mText, key);
+    mText.push_back(':');
+}
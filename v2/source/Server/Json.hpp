@@ -0,0 +1,51 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Just enough JSON for the render server's line protocol: flat objects whose values are strings, numbers,
+/// booleans, null, or arrays of numbers. Nested objects and other arrays are rejected.
+namespace Json {
+class Value {
+public:
+    enum class Type {
+        Null,
+        Bool,
+        Number,
+        String,
+        NumberArray,
+    };
+
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<double> numbers;
+};
+
+using Object = std::map<std::string, Value, std::less<>>;
+
+/// Throws std::runtime_error if `text` is not a single object of the supported subset.
+Object ParseObject(std::string_view text);
+
+/// Builds an object one member at a time. Keys are not checked for duplicates.
+class ObjectWriter {
+private:
+    std::string mText = "{";
+
+public:
+    void AddNull(std::string_view key);
+    void AddBool(std::string_view key, bool value);
+    void AddNumber(std::string_view key, double value);
+    void AddString(std::string_view key, std::string_view value);
+    void AddValue(std::string_view key, const Value& value);
+
+    /// Closes the object; the writer must not be used afterwards.
+    std::string Finish();
+
+private:
+    void AddKey(std::string_view key);
+};
+} // namespace Json
@@ -0,0 +1,122 @@
+#include "MeshLruCache.hpp"
+
+#include "Renderer/Mesh.hpp"
+
+#include <exception>
+#include <filesystem>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+MeshLruCache::MeshLruCache(size_t budgetBytes)
+    : mBudgetBytes{ budgetBytes } {
+}
+
+std::shared_ptr<const Mesh> MeshLruCache::Get(const std::string& path, bool* hit) {
+    auto key = fs::absolute(path).lexically_normal().string();
+
+    // A file that can't be read leaves these at zero, and fails to load below
+    std::error_code ec;
+    uintmax_t fileSize = fs::file_size(key, ec);
+    if (ec) fileSize = 0;
+    auto writeTime = fs::last_write_time(key, ec);
+    int64_t modifyTime = ec ? 0 : static_cast<int64_t>(writeTime.time_since_epoch().count());
+
+    std::promise<std::shared_ptr<const Mesh>> promise;
+    uint64_t id;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto it = mEntries.find(key);
+        if (it != mEntries.end()) {
+            auto& entry = it->second;
+            if (entry.loading || (entry.fileSize == fileSize && entry.modifyTime == modifyTime)) {
+                mLru.splice(mLru.begin(), mLru, entry.lruPosition);
+                ++mHits;
+                auto mesh = entry.mesh;
+                lock.unlock();
+
+                if (hit) *hit = true;
+                return mesh.get();
+            }
+            // Stale, renders still holding the old mesh keep it alive
+            Erase(it);
+        }
+
+        ++mMisses;
+        id = mNextId++;
+        mLru.push_front(key);
+        mEntries.emplace(key, Entry{
+            .mesh = promise.get_future().share(),
+            .fileSize = fileSize,
+            .modifyTime = modifyTime,
+            .id = id,
+            .lruPosition = mLru.begin(),
+        });
+    }
+
+    if (hit) *hit = false;
+    std::shared_ptr<const Mesh> result;
+    try {
+        auto mesh = std::make_shared<Mesh>();
+        mesh->ReadObjCached(key.c_str());
+        result = std::move(mesh);
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntries.find(key);
+        if (it != mEntries.end() && it->second.id == id) {
+            Erase(it);
+        }
+        throw;
+    }
+    promise.set_value(result);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntries.find(key);
+    if (it != mEntries.end() && it->second.id == id) {
+        auto& entry = it->second;
+        entry.loading = false;
+        entry.bytes = SizeOf(*result);
+        mBytes += entry.bytes;
+        EvictOverBudget(key);
+    }
+    return result;
+}
+
+MeshLruCache::Stats MeshLruCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return Stats{
+        .entries = mEntries.size(),
+        .bytes = mBytes,
+        .budgetBytes = mBudgetBytes,
+        .hits = mHits,
+        .misses = mMisses,
+        .evictions = mEvictions,
+    };
+}
+
+size_t MeshLruCache::SizeOf(const Mesh& mesh) {
+    return mesh.GetVertices().size_bytes() + mesh.GetIndices().size_bytes() + mesh.submeshes.size() * sizeof(Submesh);
+}
+
+void MeshLruCache::Erase(std::unordered_map<std::string, Entry>::iterator it) {
+    mBytes -= it->second.bytes;
+    mLru.erase(it->second.lruPosition);
+    mEntries.erase(it);
+}
+
+void MeshLruCache::EvictOverBudget(const std::string& keep) {
+    auto position = mLru.end();
+    while (mBytes > mBudgetBytes && position != mLru.begin()) {
+        --position;
+        auto it = mEntries.find(*position);
+        // Loads in progress aren't counted yet, nothing to gain from dropping them
+        if (*position == keep || it->second.loading) continue;
+
+        // Step off the element before it goes away
+        ++position;
+        Erase(it);
+        ++mEvictions;
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "all_fwd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/// Loaded meshes kept in memory across requests, evicting the least recently used ones once their total size
+/// exceeds a budget. The most recently used mesh stays even if it alone is over budget.
+///
+/// Thread safe. Threads asking for a mesh that is being loaded wait for that load instead of starting their own.
+/// A mesh whose file changed size or modification time since it was loaded is loaded again. Meshes are shared
+/// between threads, so they must only be read (see the thread safety notes on Mesh).
+class MeshLruCache {
+public:
+    struct Stats {
+        size_t entries;
+        size_t bytes;
+        size_t budgetBytes;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+private:
+    struct Entry {
+        std::shared_future<std::shared_ptr<const Mesh>> mesh;
+        // Identify the loaded version of the file
+        uintmax_t fileSize;
+        int64_t modifyTime;
+        // Counted against the budget once loaded
+        size_t bytes = 0;
+        bool loading = true;
+        // Tells a finished load whether the entry is still the one it started
+        uint64_t id;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries;
+    // Keys of mEntries, most recently used first
+    std::list<std::string> mLru;
+    size_t mBudgetBytes;
+    size_t mBytes = 0;
+    uint64_t mNextId = 0;
+    uint64_t mHits = 0;
+    uint64_t mMisses = 0;
+    uint64_t mEvictions = 0;
+
+public:
+    explicit MeshLruCache(size_t budgetBytes);
+
+    MeshLruCache(const MeshLruCache&) = delete;
+    MeshLruCache& operator=(const MeshLruCache&) = delete;
+
+    /// Returns the mesh loaded from `path` by Mesh::ReadObjCached(), loading it on a miss. Sets `hit` (if given) to
+    /// whether the mesh was already loaded or being loaded. Rethrows the error of a failed load, which is not
+    /// cached.
+    std::shared_ptr<const Mesh> Get(const std::string& path, bool* hit = nullptr);
+
+    Stats GetStats() const;
+
+    /// Memory counted against the budget for `mesh`: its geometry, mapped or owned.
+    static size_t SizeOf(const Mesh& mesh);
+
+private:
+    void Erase(std::unordered_map<std::string, Entry>::iterator it);
+    void EvictOverBudget(const std::string& keep);
+};
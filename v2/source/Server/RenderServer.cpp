@@ -0,0 +1,324 @@
+#include "RenderServer.hpp"
+
+#include "Color.hpp"
+#include "Renderer/ImageWriter.hpp"
+#include "Renderer/Mesh.hpp"
+#include "Renderer/Scene.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#if !defined(_WIN32)
+#    include <cerrno>
+#    include <csignal>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+namespace {
+std::string EncodeBase64(const std::vector<uint8_t>& data) {
+    static constexpr char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string result;
+    result.reserve((data.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3) {
+        uint32_t bits = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+        result.push_back(kAlphabet[bits >> 18]);
+        result.push_back(kAlphabet[(bits >> 12) & 0x3F]);
+        result.push_back(kAlphabet[(bits >> 6) & 0x3F]);
+        result.push_back(kAlphabet[bits & 0x3F]);
+    }
+    if (i < data.size()) {
+        uint32_t bits = data[i] << 16 | (i + 1 < data.size() ? data[i + 1] << 8 : 0);
+        result.push_back(kAlphabet[bits >> 18]);
+        result.push_back(kAlphabet[(bits >> 12) & 0x3F]);
+        result.push_back(i + 1 < data.size() ? kAlphabet[(bits >> 6) & 0x3F] : '=');
+        result.push_back('=');
+    }
+    return result;
+}
+
+const Json::Value* Find(const Json::Object& object, std::string_view key, Json::Value::Type type) {
+    auto it = object.find(key);
+    if (it == object.end() || it->second.type == Json::Value::Type::Null) return nullptr;
+    if (it->second.type != type) {
+        throw std::runtime_error("Wrong type for \"" + std::string(key) + "\"");
+    }
+    return &it->second;
+}
+
+int GetDimension(const Json::Object& request, std::string_view key, int fallback) {
+    auto value = Find(request, key, Json::Value::Type::Number);
+    if (!value) return fallback;
+    if (!(value->number >= 1 && value->number <= RenderServer::kMaxDimension) || value->number != static_cast<int>(value->number)) {
+        throw std::runtime_error("\"" + std::string(key) + "\" must be an integer in [1, " + std::to_string(RenderServer::kMaxDimension) + "]");
+    }
+    return static_cast<int>(value->number);
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#if !defined(_WIN32)
+std::runtime_error MakeSocketError(const std::string& what) {
+    return std::runtime_error(what + ": " + strerror(errno));
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+#endif
+} // namespace
+
+RenderServer::RenderServer(size_t cacheBytes)
+    : mMeshes(cacheBytes) {
+}
+
+void RenderServer::ServeStdio() {
+    Session session;
+    std::string line;
+    while (!mStopping && std::getline(std::cin, line)) {
+        auto response = HandleRequest(session, line);
+        response.push_back('\n');
+        fwrite(response.data(), 1, response.size(), stdout);
+        fflush(stdout);
+    }
+}
+
+#if defined(_WIN32)
+void RenderServer::ServeSocket(const char*) {
+    throw std::runtime_error("Unix domain sockets are not supported on this platform, serve on stdin instead");
+}
+#else
+void RenderServer::ServeSocket(const char* path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + std::string(path));
+    }
+    strcpy(address.sun_path, path);
+
+    // Left behind by a server that didn't shut down cleanly; anything else at the path is not ours to delete
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd == -1) throw MakeSocketError("Failed to create socket");
+    if (bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1 || listen(listenFd, SOMAXCONN) == -1) {
+        auto error = MakeSocketError("Failed to listen on " + std::string(path));
+        close(listenFd);
+        throw error;
+    }
+    // A client that goes away should fail our write, rather than kill the process
+    std::signal(SIGPIPE, SIG_IGN);
+
+    struct Connection {
+        std::thread thread;
+        // Closed here after joining, so that the descriptor can't be reused while shutdown() may still target it
+        int fd;
+        std::atomic<bool> done = false;
+    };
+    std::list<Connection> connections;
+
+    auto serveConnection = [this, &address](Connection& connection) {
+        Session session;
+        std::string buffer;
+        size_t scanned = 0;
+        char chunk[4096];
+        while (!mStopping) {
+            auto newline = buffer.find('\n', scanned);
+            if (newline == std::string::npos) {
+                if (buffer.size() > kMaxLineBytes) break;
+                scanned = buffer.size();
+                ssize_t count = read(connection.fd, chunk, sizeof(chunk));
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) break;
+                buffer.append(chunk, count);
+                continue;
+            }
+
+            auto response = HandleRequest(session, std::string_view(buffer).substr(0, newline));
+            response.push_back('\n');
+            buffer.erase(0, newline + 1);
+            scanned = 0;
+            if (!WriteAll(connection.fd, response.data(), response.size())) break;
+        }
+
+        if (mStopping) {
+            // Wake up the accept loop, which only checks mStopping between connections
+            int wakeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (wakeFd != -1) {
+                connect(wakeFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+                close(wakeFd);
+            }
+        }
+        connection.done = true;
+    };
+
+    auto reap = [&](bool all) {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (all || it->done) {
+                it->thread.join();
+                close(it->fd);
+                it = connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    };
+
+    fprintf(stderr, "Serving on %s\n", path);
+    while (!mStopping) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        reap(false);
+        if (mStopping) {
+            close(fd);
+            break;
+        }
+
+        auto& connection = connections.emplace_back();
+        connection.fd = fd;
+        connection.thread = std::thread(serveConnection, std::ref(connection));
+    }
+
+    // Idle connections are blocked reading, cut them off
+    for (auto& connection : connections) {
+        if (!connection.done) shutdown(connection.fd, SHUT_RDWR);
+    }
+    reap(true);
+    close(listenFd);
+    unlink(path);
+}
+#endif
+
+std::string RenderServer::HandleRequest(Session& session, std::string_view line) {
+    Json::Object request;
+    try {
+        request = Json::ParseObject(line);
+    } catch (const std::exception& e) {
+        Json::ObjectWriter response;
+        response.AddBool("ok", false);
+        response.AddString("error", e.what());
+        return response.Finish();
+    }
+
+    auto id = request.find("id");
+    auto makeError = [&](const char* message) {
+        Json::ObjectWriter response;
+        if (id != request.end()) response.AddValue("id", id->second);
+        response.AddBool("ok", false);
+        response.AddString("error", message);
+        return response.Finish();
+    };
+
+    try {
+        auto cmd = Find(request, "cmd", Json::Value::Type::String);
+        if (!cmd || cmd->string == "render") {
+            return Render(session, request);
+        }
+
+        Json::ObjectWriter response;
+        if (id != request.end()) response.AddValue("id", id->second);
+        if (cmd->string == "stats") {
+            auto stats = mMeshes.GetStats();
+            response.AddBool("ok", true);
+            response.AddNumber("entries", static_cast<double>(stats.entries));
+            response.AddNumber("bytes", static_cast<double>(stats.bytes));
+            response.AddNumber("budgetBytes", static_cast<double>(stats.budgetBytes));
+            response.AddNumber("hits", static_cast<double>(stats.hits));
+            response.AddNumber("misses", static_cast<double>(stats.misses));
+            response.AddNumber("evictions", static_cast<double>(stats.evictions));
+        } else if (cmd->string == "shutdown") {
+            mStopping = true;
+            response.AddBool("ok", true);
+        } else {
+            return makeError(("Unknown command " + cmd->string).c_str());
+        }
+        return response.Finish();
+    } catch (const std::exception& e) {
+        return makeError(e.what());
+    }
+}
+
+std::string RenderServer::Render(Session& session, const Json::Object& request) {
+    auto meshPath = Find(request, "mesh", Json::Value::Type::String);
+    if (!meshPath) throw std::runtime_error("Missing \"mesh\"");
+    auto output = Find(request, "output", Json::Value::Type::String);
+    Size2<int> dimensions(GetDimension(request, "width", 1024), GetDimension(request, "height", 768));
+
+    // Checked before doing any work
+    auto format = ImageWriter::Format::Png;
+    if (output) {
+        format = ImageWriter::FormatFromPath(output->string.c_str());
+    } else if (auto name = Find(request, "format", Json::Value::Type::String)) {
+        format = ImageWriter::FormatFromPath(("." + name->string).c_str());
+    }
+
+    auto loadStart = std::chrono::steady_clock::now();
+    bool cached;
+    auto mesh = mMeshes.Get(meshPath->string, &cached);
+    double loadMilliseconds = MillisecondsSince(loadStart);
+
+    auto renderStart = std::chrono::steady_clock::now();
+    Camera camera;
+    if (auto matrix = Find(request, "camera", Json::Value::Type::NumberArray)) {
+        if (matrix->numbers.size() != 16) throw std::runtime_error("\"camera\" must have 16 numbers");
+        for (int i = 0; i < 16; ++i) {
+            camera.transformation[i / 4][i % 4] = static_cast<float>(matrix->numbers[i]);
+        }
+    } else {
+        auto angle = Find(request, "angle", Json::Value::Type::Number);
+        camera = Camera::MakeTurntable(mesh->boundsMin, mesh->boundsMax, dimensions, angle ? static_cast<float>(angle->number) : 0.0f);
+    }
+
+    // Same look as the CLI's frames
+    auto& frame = session.frame;
+    frame.Resize(dimensions);
+    frame.ClearColor(RgbaColor(0, 0, 0));
+    frame.ClearDepth(-std::numeric_limits<float>::infinity());
+    session.rasterizer.SetTarget(&frame);
+    session.rasterizer.DrawMesh(camera, *mesh);
+
+    Json::ObjectWriter response;
+    if (auto id = request.find("id"); id != request.end()) response.AddValue("id", id->second);
+    response.AddBool("ok", true);
+    if (output) {
+        ImageWriter::WriteFile(frame, output->string.c_str(), session.encoded);
+        response.AddString("output", output->string);
+    } else {
+        ImageWriter::Encode(frame, format, session.encoded);
+        response.AddString("format", format == ImageWriter::Format::Png ? "png" : "qoi");
+        response.AddString("image", EncodeBase64(session.encoded));
+    }
+    response.AddBool("cached", cached);
+    response.AddNumber("loadMs", loadMilliseconds);
+    response.AddNumber("renderMs", MillisecondsSince(renderStart));
+    return response.Finish();
+}
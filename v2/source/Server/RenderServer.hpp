@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Renderer/Rasterizer.hpp"
+#include "Server/Json.hpp"
+#include "Server/MeshLruCache.hpp"
+#include "all_fwd.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Long-running render server, so that repeated renders pay neither process startup nor parsing the same mesh
+/// again. Requests are JSON objects, one per line, each answered by one JSON line in the order received.
+///
+/// Request members, all optional except where noted:
+/// - "cmd": "render" (default), "stats" for the mesh cache's counters, or "shutdown" to stop the server
+/// - "id": echoed back in the response
+/// - "mesh": path of the .obj to render (required for "render")
+/// - "output": .png or .qoi path to write the image to; without it, the image is returned in the response as base64
+///   in "image", encoded as "format" ("png" or "qoi", default "png")
+/// - "width", "height": image size, default 1024x768
+/// - "angle": radians around the Y axis of a camera fitted to the mesh, like the CLI's turntable frames
+/// - "camera": 16 numbers, a column-major matrix from model space to pixels with depth (see Camera), overriding "angle"
+///
+/// Responses have "ok" and either "error" or the results: "output" or "image", "cached" (whether the mesh was
+/// already loaded), "loadMs" and "renderMs".
+class RenderServer {
+public:
+    static constexpr size_t kDefaultCacheBytes = size_t(1) << 30;
+    static constexpr int kMaxDimension = 16384;
+    // Longer request lines close the connection
+    static constexpr size_t kMaxLineBytes = 1 << 20;
+
+private:
+    /// Scratch state of one connection, reused across its requests
+    struct Session {
+        Rasterizer rasterizer;
+        FrameBuffer frame;
+        std::vector<uint8_t> encoded;
+    };
+
+    MeshLruCache mMeshes;
+    std::atomic<bool> mStopping = false;
+
+public:
+    explicit RenderServer(size_t cacheBytes = kDefaultCacheBytes);
+
+    RenderServer(const RenderServer&) = delete;
+    RenderServer& operator=(const RenderServer&) = delete;
+
+    /// Reads requests from stdin and answers on stdout, until the end of input or a shutdown request.
+    void ServeStdio();
+    /// Listens on a Unix domain socket at `path` (replacing a stale socket there), serving each connection on a
+    /// thread of its own, until a shutdown request. Throws std::runtime_error if the socket cannot be set up, or
+    /// on platforms without Unix domain sockets.
+    void ServeSocket(const char* path);
+
+private:
+    /// Answers one request line. Errors become error responses, this never throws.
+    std::string HandleRequest(Session& session, std::string_view line);
+    std::string Render(Session& session, const Json::Object& request);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+// Json.hpp
+namespace Json {
+class Value;
+class ObjectWriter;
+} // namespace Json
+
+// MeshLruCache.hpp
+class MeshLruCache;
+
+// RenderServer.hpp
+class RenderServer;
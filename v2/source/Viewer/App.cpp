@@ -1,8 +1,11 @@
 #include "App.hpp"
 
 #include "Color.hpp"
+#include "JobSystem.hpp"
 #include "Macros.hpp"
+#include "Renderer/ImageWriter.hpp"
 #include "Renderer/Mesh.hpp"
+#include "Renderer/ProgressiveRenderer.hpp"
 #include "Renderer/Scene.hpp"
 #include "Viewer/Notification.hpp"
 #include "Viewer/Utils.hpp"
@@ -16,6 +19,7 @@
 #include <memory>
 #include <stdexcept>
 #include <type_traits>
+#include <utility>
 
 namespace {
 enum class SceneType {
@@ -31,11 +35,15 @@ public:
 struct ModelSceneData : public ISceneData {
     RgbaColor clearColor = RgbaColor(255, 255, 255);
     Camera camera;
-    std::unique_ptr<Mesh> mesh;
+    // Shared with renders in flight, so a newly loaded mesh replaces this instead of overwriting it
+    std::shared_ptr<const Mesh> mesh;
 
     std::string meshFilePath;
     float clearDepth = 0.0f;
 
+    bool wireframe = false;
+    RgbaColor wireframeColor = RgbaColor(0, 0, 0);
+
     virtual bool IsReady() const override {
         return mesh != nullptr;
     }
@@ -52,18 +60,23 @@ struct TriangleSceneData : public ISceneData {
         return true;
     }
 };
-
-void UploadTexture(GLuint texture, const RgbaColor pixels[], Size2<int> size) {
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.width, size.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-}
 } // namespace
 
 struct App::Private {
+    // What is shown; filled from `renderer` as tiles complete, and drawn into directly by the one-off tools
     FrameBuffer canvas;
     Rasterizer rasterizer;
+    ProgressiveRenderer renderer;
     Size2<int> canvasSize;
     GLuint texture = 0;
+    // Dimensions the texture was last allocated with, none yet
+    Size2<int> textureSize = { -1, -1 };
+
+    // Saves and loads run as jobs, so that the UI keeps going; their results are picked up by PollFileJobs()
+    JobSystem::JobHandle saveJob;
+    std::string savePath;
+    JobSystem::JobHandle loadJob;
+    std::shared_ptr<Mesh> loadedMesh;
 
     SceneType currSceneType = SceneType::Model;
     ModelSceneData rd;
@@ -100,27 +113,38 @@ struct App::Private {
     }
 
     void RenderCurrentScene() {
+        ProgressiveRenderer::Scene scene;
+        scene.dimensions = canvasSize;
         switch (currSceneType) {
             case SceneType::Model: {
-                // TODO move rendering to other thread
-                canvas.ClearColor(rd.clearColor);
-                canvas.ClearDepth(rd.clearDepth);
-
-                rasterizer.DrawMesh(rd.camera, *rd.mesh);
+                scene.clearColor = rd.clearColor;
+                scene.clearDepth = rd.clearDepth;
+                scene.mesh = rd.mesh;
+                scene.camera = rd.camera;
+                scene.wireframe = rd.wireframe;
+                scene.wireframeColor = rd.wireframeColor;
             } break;
 
             case SceneType::Triangles: {
-                canvas.ClearColor(tsd.clearColor);
-                canvas.ClearDepth(tsd.clearDepth);
-
-                for (int i = 0, di = 0; i < tsd.positions.size(); ++i, di += 3) {
-                    auto positions = &tsd.positions[i];
-                    auto colors = &tsd.colors[di];
-                    rasterizer.DrawTriangle(positions, colors);
-                    i += 3;
-                }
+                scene.clearColor = tsd.clearColor;
+                scene.clearDepth = tsd.clearDepth;
+                scene.trianglePositions = tsd.positions;
+                scene.triangleColors = tsd.colors;
             } break;
         }
+        renderer.Start(std::move(scene));
+    }
+
+    /// Takes whatever the renderer finished since the last UI frame, uploading only if anything changed.
+    void PollRenderer() {
+        try {
+            int rowBegin, rowEnd;
+            if (renderer.CopyUpdated(canvas, rowBegin, rowEnd)) {
+                UploadRows(rowBegin, rowEnd);
+            }
+        } catch (const std::exception& e) {
+            ImGui::AddNotification(ImGuiToast(ImGuiToastType_Error, "Failed to render frame.\nReason: %s", e.what()));
+        }
     }
 
     void ResizeCanvas(Size2<int> newSize) {
@@ -128,8 +152,53 @@ struct App::Private {
         canvas.Resize(newSize);
     }
 
+    /// Posts the outcome of saves and loads that finished since the last UI frame.
+    void PollFileJobs() {
+        auto& jobs = JobSystem::Global();
+        if (saveJob && saveJob->IsFinished()) {
+            auto job = std::exchange(saveJob, nullptr);
+            try {
+                jobs.Wait(job);
+                ImGui::AddNotification(ImGuiToast(ImGuiToastType_Success, "Saved image to %s", savePath.c_str()));
+            } catch (const std::exception& e) {
+                ImGui::AddNotification(ImGuiToast(ImGuiToastType_Error, "Failed to save image to %s.\nReason: %s", savePath.c_str(), e.what()));
+            }
+        }
+        if (loadJob && loadJob->IsFinished()) {
+            auto job = std::exchange(loadJob, nullptr);
+            auto mesh = std::exchange(loadedMesh, nullptr);
+            auto& path = rd.meshFilePath;
+            try {
+                jobs.Wait(job);
+                rd.mesh = std::move(mesh);
+                if (currSceneType == SceneType::Model) {
+                    renderer.Cancel();
+                }
+                ImGui::AddNotification(ImGuiToast(ImGuiToastType_Success, "Successfully loaded model at %s", path.c_str()));
+            } catch (const std::exception& e) {
+                ImGui::AddNotification(ImGuiToast(ImGuiToastType_Error, "Failed to load model at %s.\nReason: %s", path.c_str(), e.what()));
+            }
+        }
+    }
+
     void UploadBuffers() {
-        ::UploadTexture(texture, canvas.pixels.data(), canvasSize);
+        UploadRows(0, canvas.dimensions.height);
+    }
+
+    /// Uploads rows [rowBegin, rowEnd) of the canvas. The texture is only allocated anew when the canvas was
+    /// resized, in which case all of it is uploaded.
+    void UploadRows(int rowBegin, int rowEnd) {
+        auto size = canvas.dimensions;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (textureSize != size) {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size.width, size.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, canvas.pixels.data());
+            textureSize = size;
+            return;
+        }
+        if (rowBegin >= rowEnd) return;
+
+        auto rows = canvas.pixels.data() + static_cast<size_t>(rowBegin) * size.width;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rowBegin, size.width, rowEnd - rowBegin, GL_RGBA, GL_UNSIGNED_BYTE, rows);
     }
 
     void ShowRendererEditor() {
@@ -141,6 +210,7 @@ struct App::Private {
             for (auto& elm : kScenes) {
                 if (ImGui::Selectable(elm.name, currSceneType == elm.value)) {
                     currSceneType = elm.value;
+                    renderer.Cancel();
                 }
             }
             ImGui::EndCombo();
@@ -149,6 +219,13 @@ struct App::Private {
         auto& currScene = GetCurrentScene();
         if (ImGui::TreeNode("Renderer Info")) {
             ImGui::Text("Canvas size: { %d, %d }", canvasSize.width, canvasSize.height);
+            if (renderer.IsRendering()) {
+                ImGui::Text("Rendering: %.0f%%", renderer.GetProgress() * 100.0f);
+                ImGui::SameLine();
+                if (ImGui::SmallButton("Cancel")) {
+                    renderer.Cancel();
+                }
+            }
             ImGui::TreePop();
         }
         if (ImGui::TreeNode("Scene Info")) {
@@ -157,14 +234,31 @@ struct App::Private {
         }
 
         bool readyToRender = currScene.IsReady();
+        // Restarts the render if one is already running
         if (ImGui::Button("Render frame", !readyToRender)) {
             RenderCurrentScene();
-            UploadBuffers();
         }
         if (!readyToRender) {
             ImGui::SameLine();
             ImGui::TextUnformatted("The current scene is invalid");
         }
+
+        // One save at a time, as savePath belongs to the one in flight
+        if (ImGui::Button("Save image", saveJob != nullptr)) {
+            nfdchar_t* promptOutPath = nullptr;
+            nfdresult_t promptResult = NFD_SaveDialog("png;qoi", nullptr, &promptOutPath);
+
+            if (promptResult == NFD_OKAY) {
+                savePath = std::string(promptOutPath);
+                // Snapshot, as the canvas keeps changing while the render runs
+                auto image = std::make_shared<const FrameBuffer>(canvas);
+                saveJob = JobSystem::Global().Schedule([image, path = savePath]() {
+                    ImageWriter::WriteFile(*image, path.c_str());
+                });
+            } else if (promptResult == NFD_ERROR) {
+                ImGui::AddNotification(ImGuiToast(ImGuiToastType_Error, "Error: %s.", NFD_GetError()));
+            }
+        }
     }
 
     struct {
@@ -179,6 +273,14 @@ struct App::Private {
             ImVec4 color;
         } line;
 
+        struct {
+            ImVec2 pos;
+            ImVec2 size;
+            ImVec4 color;
+            float depth = 0.0f;
+            bool depthTest = true;
+        } rectangle;
+
         struct {
 
         } triangle;
@@ -186,14 +288,21 @@ struct App::Private {
 
     void ShowRendererOneOffTools() {
         auto& dd = data_ShowRendererOneOffTools;
+        // A render still in flight would paint over these
+        auto beginOneOff = [&]() {
+            renderer.Cancel();
+            PollRenderer();
+        };
 
         if (ImGui::CollapsingHeader("Clear")) {
             auto& dc = dd.clear;
             if (ImGui::ColorEdit4("Clear color", &dc.clearColor)) {
+                beginOneOff();
                 canvas.ClearColor(dc.clearColor);
                 UploadBuffers();
             }
             if (ImGui::InputFloat("Clear depth", &dc.clearDepth)) {
+                beginOneOff();
                 canvas.ClearDepth(dc.clearDepth);
                 UploadBuffers();
             }
@@ -204,13 +313,29 @@ struct App::Private {
             ImGui::InputFloat2("Point 2", &dc.ptEnd.x);
             ImGui::ColorEdit4("Color", &dc.color.x);
             if (ImGui::Button("Draw line")) {
+                beginOneOff();
                 glm::vec3 vertices[] = {
                     glm::vec3(dc.ptBegin.x, dc.ptBegin.y, 0.0f),
                     glm::vec3(dc.ptEnd.x, dc.ptEnd.y, 0.0f),
                 };
                 RgbaColor color = Conv::ImVec4_To_RgbaColor(dc.color);
                 rasterizer.DrawLine(vertices, color);
-                ::UploadTexture(texture, canvas.pixels.data(), canvasSize);
+                UploadBuffers();
+            }
+        }
+        if (ImGui::CollapsingHeader("Rectangle")) {
+            auto& dc = dd.rectangle;
+            ImGui::InputFloat2("Position", &dc.pos.x);
+            ImGui::InputFloat2("Size", &dc.size.x);
+            ImGui::ColorEdit4("Fill color", &dc.color.x);
+            ImGui::InputFloat("Depth", &dc.depth);
+            ImGui::Checkbox("Depth test", &dc.depthTest);
+            if (ImGui::Button("Draw rectangle")) {
+                beginOneOff();
+                Rect<float> rect(dc.pos.x, dc.pos.y, dc.size.x, dc.size.y);
+                RgbaColor color = Conv::ImVec4_To_RgbaColor(dc.color);
+                rasterizer.DrawRectangle(rect, color, dc.depth, dc.depthTest);
+                UploadBuffers();
             }
         }
         if (ImGui::CollapsingHeader("Triangle")) {
@@ -220,33 +345,29 @@ struct App::Private {
     }
 
     void ShowModelEditor() {
-        ImGui::ColorEdit4("Clear color", &rd.clearColor);
-        ImGui::InputFloat("Clear depth", &rd.clearDepth);
+        // Any change makes the render in flight out of date
+        bool changed = false;
+        changed |= ImGui::ColorEdit4("Clear color", &rd.clearColor);
+        changed |= ImGui::InputFloat("Clear depth", &rd.clearDepth);
+        changed |= ImGui::Checkbox("Wireframe", &rd.wireframe);
+        if (rd.wireframe) {
+            changed |= ImGui::ColorEdit4("Wireframe color", &rd.wireframeColor);
+        }
+        if (changed && currSceneType == SceneType::Model) {
+            renderer.Cancel();
+        }
 
-        if (ImGui::Button("Load mesh")) {
+        // Replaces rd.mesh once read, see PollFileJobs()
+        if (ImGui::Button("Load mesh", loadJob != nullptr)) {
             nfdchar_t* promptOutPath = nullptr;
             nfdresult_t promptResult = NFD_OpenDialog(nullptr, nullptr, &promptOutPath);
 
             if (promptResult == NFD_OKAY) {
-                auto& mesh = rd.mesh;
-                auto& path = rd.meshFilePath;
-
-                path = std::string(promptOutPath);
-                if (!mesh) {
-                    mesh = std::make_unique<Mesh>();
-                }
-
-                bool exceptionCaught;
-                try {
-                    mesh->ReadObjAt(path.c_str());
-                    exceptionCaught = false;
-                } catch (const std::exception& e) {
-                    ImGui::AddNotification(ImGuiToast(ImGuiToastType_Error, "Failed to load model at %s.\nReason: %s", path.c_str(), e.what()));
-                    exceptionCaught = true;
-                }
-                if (!exceptionCaught) {
-                    ImGui::AddNotification(ImGuiToast(ImGuiToastType_Success, "Successfully loaded model at %s", path.c_str()));
-                }
+                rd.meshFilePath = std::string(promptOutPath);
+                loadedMesh = std::make_shared<Mesh>();
+                loadJob = JobSystem::Global().Schedule([mesh = loadedMesh, path = rd.meshFilePath]() {
+                    mesh->ReadObjCached(path.c_str());
+                });
             } else if (promptResult == NFD_CANCEL) {
                 ImGui::AddNotification(ImGuiToast(ImGuiToastType_Error, "No path was selected."));
             } else {
@@ -256,8 +377,12 @@ struct App::Private {
     }
 
     void ShowTriangleEditor() {
-        ImGui::ColorEdit4("Clear color", &tsd.clearColor);
-        ImGui::InputFloat("Clear depth", &tsd.clearDepth);
+        bool changed = false;
+        changed |= ImGui::ColorEdit4("Clear color", &tsd.clearColor);
+        changed |= ImGui::InputFloat("Clear depth", &tsd.clearDepth);
+        if (changed && currSceneType == SceneType::Triangles) {
+            renderer.Cancel();
+        }
 
         if (tsd.currentSelectedVertex != -1) {
             // TODO
@@ -304,6 +429,9 @@ App::~App() {
 }
 
 void App::Show() {
+    m->PollRenderer();
+    m->PollFileJobs();
+
     ImGui::Begin("Renderer Setup");
     if (ImGui::BeginTabBar("##")) {
         if (ImGui::BeginTabItem("Scene")) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Renderer/fwd.hpp"
+#include "Server/fwd.hpp"
 #include "Viewer/fwd.hpp"
 
 // Color.hpp
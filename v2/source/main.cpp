@@ -1,3 +1,11 @@
+#include "JobSystem.hpp"
+#include "Renderer/FramePipeline.hpp"
+#include "Renderer/FrameStream.hpp"
+#include "Renderer/FrameWriter.hpp"
+#include "Renderer/Mesh.hpp"
+#include "Renderer/Rasterizer.hpp"
+#include "Renderer/Scene.hpp"
+#include "Server/RenderServer.hpp"
 #include "Viewer/App.hpp"
 
 #define GLFW_INCLUDE_NONE
@@ -7,11 +15,29 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <imgui_impl_opengl3_loader.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cxxopts.hpp>
+#include <exception>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numbers>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace fs = std::filesystem;
 using namespace std::literals;
@@ -24,36 +50,338 @@ void GlfwErrorCallback(int error, const char* description) {
 struct RenderTask {
     fs::path inputPath;
     fs::path outputPath;
+    Size2<int> resolution;
+    // Frames of a turntable around the model; with more than one, each output file is numbered
+    int frameCount;
+    // If set, all frames go into a single uncompressed stream at outputPath ("-" for stdout) instead of image files
+    std::optional<FrameStream::Format> streamFormat;
+    int frameRate;
 };
 
 struct CliProgramOptions {
     std::vector<RenderTask> tasks;
+    // Tasks rendered at the same time, 0 for as many as the job system has threads
+    int maxConcurrentTasks = 0;
+    // If set, run a RenderServer on this socket path ("-" for stdin/stdout) instead of rendering tasks
+    std::optional<std::string> servePath;
+    size_t serverCacheBytes = RenderServer::kDefaultCacheBytes;
 
     static CliProgramOptions Parse(int argc, const char* argv[]) {
         cxxopts::Options decl("hnOsmium0001/soft-renderer", "");
         // clang-format off
         decl.add_options()
-            ("s,scene", "Scene file (input) to render", cxxopts::value<std::string>())
-            ("o,output", "Output path", cxxopts::value<std::string>());
+            ("s,scene", "Scene file (input) to render, currently a .obj model; repeat with -o for more tasks", cxxopts::value<std::vector<std::string>>())
+            ("o,output", "Output path, .png or .qoi; one per --scene", cxxopts::value<std::vector<std::string>>())
+            ("manifest", "File listing more tasks, one `scene output [width height]` per line (# starts a comment); relative paths in it are relative to the manifest's directory", cxxopts::value<std::string>())
+            ("W,width", "Output image's width", cxxopts::value<int>()->default_value("1024"))
+            ("H,height", "Output image's height", cxxopts::value<int>()->default_value("768"))
+            ("f,frames", "Number of turntable frames to render", cxxopts::value<int>()->default_value("1"))
+            ("stream", "Write all frames to one raw or y4m stream at the output path (- for stdout)", cxxopts::value<std::string>())
+            ("fps", "Frame rate recorded in y4m streams", cxxopts::value<int>()->default_value("30"))
+            ("j,jobs", "Tasks to render at the same time, 0 for one per core", cxxopts::value<int>()->default_value("0"))
+            ("serve", "Serve render requests on a Unix domain socket at this path (- for stdin/stdout) until shut down", cxxopts::value<std::string>())
+            ("cache-mb", "Memory budget of the server's mesh cache, in MiB", cxxopts::value<int>()->default_value("1024"));
         // clang-format on
         auto result = decl.parse(argc, argv);
 
         CliProgramOptions opts;
+        opts.maxConcurrentTasks = std::max(0, result["jobs"].as<int>());
+        if (result.count("serve")) {
+            // Requests name their own scenes and outputs, anything given here would be silently ignored
+            if (result.count("scene") || result.count("output") || result.count("manifest")) {
+                throw std::runtime_error("--serve can't be combined with --scene, --output or --manifest");
+            }
+            opts.servePath = result["serve"].as<std::string>();
+            opts.serverCacheBytes = static_cast<size_t>(std::max(0, result["cache-mb"].as<int>())) << 20;
+        }
 
-        opts.tasks.push_back(RenderTask{
-            .inputPath = fs::path(result["scene"].as<std::string>()),
-            .outputPath = fs::path(result["output"].as<std::string>()),
-        });
+        // Shared by every task, the manifest may override the resolution
+        RenderTask defaults{
+            .resolution = Size2<int>(result["width"].as<int>(), result["height"].as<int>()),
+            .frameCount = std::max(1, result["frames"].as<int>()),
+            .streamFormat = result.count("stream")
+                ? std::make_optional(FrameStream::ParseFormat(result["stream"].as<std::string>()))
+                : std::nullopt,
+            .frameRate = result["fps"].as<int>(),
+        };
+
+        auto scenes = result.count("scene") ? result["scene"].as<std::vector<std::string>>() : std::vector<std::string>();
+        auto outputs = result.count("output") ? result["output"].as<std::vector<std::string>>() : std::vector<std::string>();
+        if (scenes.size() != outputs.size()) {
+            throw std::runtime_error("Every --scene needs exactly one --output");
+        }
+        for (size_t i = 0; i < scenes.size(); ++i) {
+            auto& task = opts.tasks.emplace_back(defaults);
+            task.inputPath = fs::path(scenes[i]);
+            task.outputPath = fs::path(outputs[i]);
+        }
+        if (result.count("manifest")) {
+            ReadManifest(result["manifest"].as<std::string>(), defaults, opts.tasks);
+        }
+
+        if (opts.tasks.empty() && !opts.servePath) {
+            throw std::runtime_error("Nothing to render, give --scene and --output or a --manifest");
+        }
+        if (defaults.streamFormat) {
+            auto toStdout = std::count_if(opts.tasks.begin(), opts.tasks.end(), [](const RenderTask& task) {
+                return task.outputPath == FrameStream::kStdout;
+            });
+            if (toStdout > 1) {
+                throw std::runtime_error("Only one task can stream to stdout");
+            }
+        }
 
         return opts;
     }
+
+    static void ReadManifest(const std::string& path, const RenderTask& defaults, std::vector<RenderTask>& tasks) {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error("Failed to open manifest " + path);
+        }
+
+        // Relative paths in the manifest refer to its own directory, not the working directory, so that a manifest
+        // works from anywhere; an absolute path replaces the base entirely. Streams to stdout are left as they are.
+        auto base = fs::path(path).parent_path();
+        auto resolve = [&](const std::string& entry) {
+            bool toStdout = defaults.streamFormat && entry == FrameStream::kStdout;
+            return toStdout ? fs::path(entry) : base / entry;
+        };
+
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+            line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+
+            std::istringstream fields(line);
+            std::string scene;
+            if (!(fields >> scene)) continue;
+
+            auto& task = tasks.emplace_back(defaults);
+            std::string output;
+            int width, height;
+            if (!(fields >> output)) {
+                throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected an output path after the scene");
+            }
+            if (fields >> width) {
+                if (!(fields >> height) || width <= 0 || height <= 0) {
+                    throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected a positive width and height");
+                }
+                task.resolution = Size2<int>(width, height);
+            }
+            task.inputPath = resolve(scene);
+            task.outputPath = resolve(output);
+        }
+    }
 };
 
-int CliMain(CliProgramOptions& options) {
-    // TODO
+/// `path` itself for single frames, otherwise `path` with the zero-padded frame index added to its stem.
+std::string GetFramePath(const fs::path& path, int frame, int frameCount) {
+    if (frameCount == 1) return path.string();
+
+    char index[16];
+    snprintf(index, sizeof(index), "_%04d", frame);
+    auto numbered = path;
+    numbered.replace_filename(path.stem().string() + index + path.extension().string());
+    return numbered.string();
+}
+
+FrameBuffer& ClearFrame(FrameBuffer& frame, Size2<int> resolution) {
+    frame.Resize(resolution);
+    frame.ClearColor(RgbaColor(0, 0, 0));
+    frame.ClearDepth(-std::numeric_limits<float>::infinity());
+    return frame;
+}
+
+/// Renders every frame of `task`. Throws on failure, once the frames submitted so far are written.
+void RenderTurntable(const RenderTask& task, const Mesh& mesh) {
+    auto cameraOf = [&](int i) {
+        float angle = 2.0f * std::numbers::pi_v<float> * i / task.frameCount;
+        return Camera::MakeTurntable(mesh.boundsMin, mesh.boundsMax, task.resolution, angle);
+    };
+
+    Rasterizer rasterizer;
+    FramePipeline pipeline(rasterizer);
+    if (task.streamFormat) {
+        // The reader of the stream provides the backpressure, a single framebuffer is enough
+        FrameStream stream(task.outputPath.string().c_str(), *task.streamFormat, task.resolution, task.frameRate);
+        FrameBuffer frame;
+        pipeline.Render(
+            mesh, task.resolution, task.frameCount, cameraOf,
+            [&](int) -> FrameBuffer& { return ClearFrame(frame, task.resolution); },
+            [&](int, FrameBuffer& fb) { stream.WriteFrame(fb); });
+        return;
+    }
+
+    // Frame N is encoded and written on the writer's thread while frame N+1 renders here, and the geometry
+    // of frame N+2 is prepared alongside
+    FrameWriter writer;
+    pipeline.Render(
+        mesh, task.resolution, task.frameCount, cameraOf,
+        [&](int) -> FrameBuffer& { return ClearFrame(writer.AcquireFrame(), task.resolution); },
+        [&](int i, FrameBuffer&) { writer.SubmitFrame(GetFramePath(task.outputPath, i, task.frameCount)); });
+    writer.Flush();
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Value at fraction `q` of `sorted`, which must not be empty.
+double Percentile(const std::vector<double>& sorted, double q) {
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+}
+
+int ServerMain(const CliProgramOptions& options) {
+    try {
+        RenderServer server(options.serverCacheBytes);
+        if (*options.servePath == "-") {
+            server.ServeStdio();
+        } else {
+            server.ServeSocket(options.servePath->c_str());
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
     return 0;
 }
 
+/// Renders all tasks, several at a time. Tasks are grouped by their scene file, so that each file is loaded once
+/// and freed after the last task using it. A failing task doesn't stop the others; errors and a throughput and
+/// latency summary are printed to stderr at the end.
+int CliMain(CliProgramOptions& options) {
+    auto batchStart = std::chrono::steady_clock::now();
+
+    struct TaskResult {
+        // Time to render and write the task, not counting the scene load it shares with others
+        double milliseconds = 0.0;
+        std::string error;
+    };
+    struct MeshGroup {
+        std::mutex mutex;
+        // Loaded by the first task of the group to run, and dropped once every task is done with it
+        std::shared_ptr<const Mesh> mesh;
+        std::string error;
+        size_t remainingTasks = 0;
+        bool loaded = false;
+        double loadMilliseconds = 0.0;
+    };
+
+    // Tasks ordered by group, so that a group's tasks run close together and its mesh is freed early
+    std::vector<size_t> groupOf(options.tasks.size());
+    size_t groupCount = 0;
+    {
+        std::unordered_map<std::string, size_t> groupOfPath;
+        for (size_t i = 0; i < options.tasks.size(); ++i) {
+            auto key = fs::absolute(options.tasks[i].inputPath).lexically_normal().string();
+            auto [it, inserted] = groupOfPath.try_emplace(std::move(key), groupCount);
+            if (inserted) ++groupCount;
+            groupOf[i] = it->second;
+        }
+    }
+    std::vector<size_t> order(options.tasks.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return groupOf[a] < groupOf[b]; });
+
+    std::vector<TaskResult> results(options.tasks.size());
+    std::vector<MeshGroup> groups(groupCount);
+    for (size_t i = 0; i < options.tasks.size(); ++i) {
+        ++groups[groupOf[i]].remainingTasks;
+    }
+
+    auto runTask = [&](size_t i) {
+        auto& group = groups[groupOf[i]];
+        auto& task = options.tasks[i];
+
+        std::shared_ptr<const Mesh> mesh;
+        {
+            // Other tasks of the group wait here while the first one loads the mesh
+            std::lock_guard<std::mutex> lock(group.mutex);
+            if (!group.loaded && group.error.empty()) {
+                auto loadStart = std::chrono::steady_clock::now();
+                try {
+                    auto loading = std::make_shared<Mesh>();
+                    loading->ReadObjCached(task.inputPath.string().c_str());
+                    group.mesh = std::move(loading);
+                    group.loaded = true;
+                } catch (const std::exception& e) {
+                    group.error = "Failed to load "s + task.inputPath.string() + ": " + e.what();
+                }
+                group.loadMilliseconds = MillisecondsSince(loadStart);
+            }
+            mesh = group.mesh;
+        }
+
+        if (mesh) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                RenderTurntable(task, *mesh);
+            } catch (const std::exception& e) {
+                results[i].error = e.what();
+            }
+            results[i].milliseconds = MillisecondsSince(start);
+        }
+
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (!mesh) {
+            results[i].error = group.error;
+        }
+        if (--group.remainingTasks == 0) {
+            group.mesh = nullptr;
+        }
+    };
+
+    // Tasks run on threads of their own, which use the job system for the parallel parts of each task. If tasks
+    // were jobs themselves, a task waiting for its own jobs could pick up another task, and finish only after it.
+    int runnerCount = options.maxConcurrentTasks > 0 ? options.maxConcurrentTasks : JobSystem::Global().GetConcurrency();
+    runnerCount = static_cast<int>(std::min<size_t>(runnerCount, order.size()));
+    std::atomic<size_t> next = 0;
+    auto runner = [&]() {
+        for (size_t k; (k = next.fetch_add(1, std::memory_order_relaxed)) < order.size();) {
+            runTask(order[k]);
+        }
+    };
+    std::vector<std::thread> runners;
+    for (int t = 1; t < runnerCount; ++t) {
+        runners.emplace_back(runner);
+    }
+    runner();
+    for (auto& thread : runners) {
+        thread.join();
+    }
+
+    double batchMilliseconds = MillisecondsSince(batchStart);
+
+    int failed = 0;
+    int frames = 0;
+    std::vector<double> latencies;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].error.empty()) {
+            fprintf(stderr, "Error: %s -> %s: %s\n", options.tasks[i].inputPath.string().c_str(), options.tasks[i].outputPath.string().c_str(), results[i].error.c_str());
+            ++failed;
+            continue;
+        }
+        frames += options.tasks[i].frameCount;
+        latencies.push_back(results[i].milliseconds);
+    }
+    int loaded = 0;
+    double loadMilliseconds = 0.0;
+    for (auto& group : groups) {
+        loaded += group.loaded;
+        loadMilliseconds += group.loadMilliseconds;
+    }
+
+    int succeeded = static_cast<int>(results.size()) - failed;
+    double seconds = batchMilliseconds / 1000.0;
+    fprintf(stderr, "Rendered %d of %zu tasks (%d frames) in %.3f s: %.1f tasks/s, %.1f frames/s\n", succeeded, results.size(), frames, seconds, succeeded / seconds, frames / seconds);
+    fprintf(stderr, "Loaded %d of %zu scenes in %.1f ms total\n", loaded, groups.size(), loadMilliseconds);
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        fprintf(stderr, "Task latency: min %.1f ms, median %.1f ms, p95 %.1f ms, max %.1f ms\n", latencies.front(), Percentile(latencies, 0.5), Percentile(latencies, 0.95), latencies.back());
+    }
+    return failed > 0 ? 1 : 0;
+}
+
 int GuiMain() {
     if (!glfwInit()) {
         return -1;
@@ -132,10 +460,17 @@ int GuiMain() {
 int main(int argc, const char* argv[]) {
     // Assume the first element is the executable name
     if (argc > 1) {
-        printf("Running in headless mode...\n");
+        // Not on stdout, which may be carrying a frame stream
+        fprintf(stderr, "Running in headless mode...\n");
 
-        auto opts = CliProgramOptions::Parse(argc, argv);
-        return CliMain(opts);
+        CliProgramOptions opts;
+        try {
+            opts = CliProgramOptions::Parse(argc, argv);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "Error: %s\n", e.what());
+            return 1;
+        }
+        return opts.servePath ? ServerMain(opts) : CliMain(opts);
     } else {
         return GuiMain();
     }
@@ -12,4 +12,7 @@ target("soft-renderer-v2")
     set_kind("binary")
     add_files("source/**.cpp")
     add_includedirs("source/")
+    -- The depth prepass relies on every raster loop computing bit-identical depth, which FMA contraction
+    -- (applied differently to scalar and vectorized loops) would break
+    add_cxflags("-ffp-contract=off", {tools = {"gcc", "clang"}})
     add_packages("cxxopts", "stb", "glfw3", "glm", "imgui", "imguizmo", "nativefiledialog")